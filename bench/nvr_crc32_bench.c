@@ -0,0 +1,96 @@
+/**
+  ******************************************************************************
+  * @file    nvr_crc32_bench.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Throughput of the CRC-32 engines for 16 B .. 64 KiB records.
+  *          Build with -O2 (and -mpclmul on x86 for the HW engine).
+  ******************************************************************************
+  */
+
+#include "nvram_crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+
+
+#define MAX_SIZE                (64 * 1024)
+#define BYTES_PER_RUN           (64 * 1024 * 1024)  // every size hashes that much data
+
+
+
+typedef uint32_t (*CRCUpdate_t)(uint32_t crc, const uint8_t *data, uint32_t size);
+
+typedef struct {
+    const char                  *Name;
+    CRCUpdate_t                 Update;
+} Engine_t;
+
+
+static const Engine_t           Engines[] = {
+    {"bitwise", NVRCRC32UpdateBitwise},
+    {"slice8",  NVRCRC32UpdateSlice8},
+#ifdef NVR_CRC32_HW_AVAILABLE
+    {"hw",      NVRCRC32UpdateHW},
+#endif
+};
+
+static uint8_t                  Data[MAX_SIZE];
+
+
+
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+int main(void)
+{
+    uint32_t i, size, e;
+    volatile uint32_t sink = 0;
+    
+    srand(1);
+    for (i = 0; i < MAX_SIZE; i++) Data[i] = (uint8_t)rand();
+    
+    printf("%-8s", "size");
+    for (e = 0; e < sizeof(Engines) / sizeof(Engines[0]); e++) printf("%14s", Engines[e].Name);
+    printf("   (MiB/s)\n");
+    
+    for (size = 16; size <= MAX_SIZE; size *= 4) {
+        uint32_t ref = NVRCRC32Final(NVRCRC32UpdateBitwise(NVR_CRC32_INIT, Data, size));
+        printf("%-8u", size);
+        for (e = 0; e < sizeof(Engines) / sizeof(Engines[0]); e++) {
+            uint32_t runs = BYTES_PER_RUN / size;
+            if (Engines[e].Update == NVRCRC32UpdateBitwise) runs /= 16;     // keep the reference engine tolerable
+            if (NVRCRC32Final(Engines[e].Update(NVR_CRC32_INIT, Data, size)) != ref) {
+                printf("%14s", "MISMATCH");
+                continue;
+            }
+            double t = Now();
+            for (i = 0; i < runs; i++) sink += Engines[e].Update(NVR_CRC32_INIT, Data, size);
+            t = Now() - t;
+            printf("%14.1f", (double)runs * size / t / (1024 * 1024));
+        }
+        printf("\n");
+    }
+    return (int)(sink & 0);
+}
+
+
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
@@ -0,0 +1,442 @@
+/**
+  ******************************************************************************
+  * @file    nvr_kv_bench.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Store operations on the simulated NOR: mount, exact id, MAX_ID and NEAREST
+  *          lookup, sequential write, wrap-around, iteration and range reads for several store sizes,
+  *          hot reads through the page cache, writes through the write-back page buff, compressed writes and reads of sparse records,
+  *          the snapshot export and import of the whole store,
+  *          record sizes and NVR_FLAGS_PAGE_ALIGN. Prints the host time, the modelled
+  *          device time and the LL traffic per operation. The data and the ids are
+  *          generated from a fixed seed, so the device columns repeat from run to run.
+  *          Usage: nvr_kv_bench [quick]
+  ******************************************************************************
+  */
+
+#include "nvram_kv.h"
+#include "nvr_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+
+
+#define PAGE_SIZE               256
+#define SECTOR_SIZE             4096
+#define SCAN_OPS_MAX            200         // lookups that scan the memory are slow, measure that many
+#define LOOKUP_OPS              2000
+#define RANGE_LEN               16          // records of a range read
+#define CACHE_PAGES             16
+
+
+
+typedef struct {
+    const char                  *Name;
+    uint32_t                    Ops;
+    double                      Time;
+    NVRSimStats_t               Stats;
+} Result_t;
+
+
+static const NVRSimTiming_t     Timing = {
+    .ReadUs = 1,                // command and address of a SPI NOR read
+    .ProgramUs = 400,           // page program
+    .EraseUs = 45000,           // 4 KiB sector erase
+    .BusNsPerByte = 20,         // quad SPI at ~50 MB/s
+};
+
+static NVRSim_t                 Sim;
+static uint8_t                  Page[PAGE_SIZE];
+static uint8_t                  ReadAhead[4 * PAGE_SIZE];
+static uint8_t                  WriteBack[PAGE_SIZE];
+static uint8_t                  CachePages[CACHE_PAGES * PAGE_SIZE];
+static NVRCacheSlot_t           CacheSlots[CACHE_PAGES];
+static NVRPageCache_t           Cache;
+static uint8_t                  Data[64 * 1024];
+static uint8_t                  Sparse[1024];
+static uint32_t                 Work[(NVR_LZ_WORK_MIN + sizeof(Sparse)) / 4];
+static NVRIndexEntry_t          *Index;
+static uint8_t                  *Snapshot;
+static uint32_t                 SnapshotLen, SnapshotPos;
+static uint32_t                 Seed;
+static uint64_t                 Violations;         // of all the runs
+
+
+
+static double Now(void);
+static uint32_t Rand(void);
+static void Begin(Result_t *r, const char *name);
+static void End(Result_t *r, uint32_t ops);
+static void Print(uint32_t storeSize, uint32_t recSize, uint32_t flags, const Result_t *r);
+static void Open(NVRamKV_t *nvr, uint32_t storeSize, uint32_t flags);
+static void MakeSparse(uint32_t n, uint32_t size);
+static int32_t SnapshotWrite(void *ctx, const uint8_t *data, uint32_t size);
+static int32_t SnapshotRead(void *ctx, uint8_t *data, uint32_t size);
+static void Run(uint32_t storeSize, uint32_t recSize, uint32_t flags);
+
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+int main(int argc, char **argv)
+{
+    static const uint32_t storeSizes[] = {64 * 1024, 256 * 1024, 1024 * 1024};
+    static const uint32_t recSizes[] = {16, 128, 1024};
+    uint32_t quick = (argc > 1) && (0 == strcmp(argv[1], "quick"));
+    uint32_t s, r, a;
+
+    for (r = 0; r < sizeof(Data); r++) Data[r] = (uint8_t)(r * 131 + 7);
+
+    printf("%-8s %-6s %-5s %-14s %8s %12s %12s %10s %12s %8s\n",
+           "store", "record", "align", "operation", "ops", "host us/op", "dev us/op", "reads/op", "read B/op", "erases");
+    for (s = 0; s < sizeof(storeSizes) / sizeof(storeSizes[0]); s++) {
+        if ((quick) && (s > 0)) break;
+        for (r = 0; r < sizeof(recSizes) / sizeof(recSizes[0]); r++) {
+            for (a = 0; a < 2; a++) Run(storeSizes[s], recSizes[r], a ? NVR_FLAGS_PAGE_ALIGN : 0);
+        }
+    }
+    if (Violations) printf("NOR violations: %llu\n", (unsigned long long)Violations);
+    return (Violations) ? 1 : 0;
+}
+
+/**
+  * @brief      All the operations on a fresh store
+  * @param
+  * @retval
+  */
+static void Run(uint32_t storeSize, uint32_t recSize, uint32_t flags)
+{
+    NVRamKV_t nvr;
+    NVRIter_t it;
+    Result_t res;
+    uint32_t i, j, n, ops, size, capacity = storeSize / (recSize + NVRHeaderSize) + 1;
+    uint64_t id;
+
+    if (0 != NVRSimInit(&Sim, 0, storeSize, PAGE_SIZE, SECTOR_SIZE, &Timing)) exit(1);
+    NVRSimBind(&Sim);
+    Index = malloc(capacity * sizeof(NVRIndexEntry_t));
+    Seed = 1;
+
+    // sequential write: fill the memory up to the end, ids ascend
+    Open(&nvr, storeSize, flags);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    Begin(&res, "write");
+    for (n = 0; ; n++) {
+        if (NVRGetNextAddr(&nvr) + NVRHeaderSize + recSize > storeSize) break;     // the next write would wrap
+        if (NVR_ERROR_NONE != NVRWriteFile(&nvr, n + 1, Data, recSize)) break;
+    }
+    End(&res, n);
+    Print(storeSize, recSize, flags, &res);
+
+    // mount: one scan building the index
+    Open(&nvr, storeSize, flags);
+    Begin(&res, "mount");
+    if (NVR_ERROR_NONE != NVRMount(&nvr, Index, capacity)) exit(1);
+    End(&res, 1);
+    Print(storeSize, recSize, flags, &res);
+
+    Begin(&res, "exact (index)");
+    for (i = 0; i < LOOKUP_OPS; i++) NVROpenFile(&nvr, 1 + Rand() % n, &size, 0, 0);
+    End(&res, LOOKUP_OPS);
+    Print(storeSize, recSize, flags, &res);
+
+    Begin(&res, "nearest(index)");
+    for (i = 0; i < LOOKUP_OPS; i++) NVROpenFile(&nvr, 1 + Rand() % (n + 1), &size, NVR_OPEN_FLAGS_NEAREST, 0);
+    End(&res, LOOKUP_OPS);
+    Print(storeSize, recSize, flags, &res);
+    
+    // RANGE_LEN hot records opened and read over and over, then the same through the page cache
+    Begin(&res, "hot read");
+    for (i = 0; i < LOOKUP_OPS; i++) {
+        NVROpenFile(&nvr, 1 + (Rand() % RANGE_LEN) * (n / RANGE_LEN), &size, 0, 0);
+        if (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, nvr.FoundFileSize)) exit(1);
+    }
+    End(&res, LOOKUP_OPS);
+    Print(storeSize, recSize, flags, &res);
+    
+    if (NVR_ERROR_NONE != NVRPageCacheInit(&nvr, &Cache, CacheSlots, CachePages, CACHE_PAGES)) exit(1);
+    Begin(&res, "hot (cache)");
+    for (i = 0; i < LOOKUP_OPS; i++) {
+        NVROpenFile(&nvr, 1 + (Rand() % RANGE_LEN) * (n / RANGE_LEN), &size, 0, 0);
+        if (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, nvr.FoundFileSize)) exit(1);
+    }
+    End(&res, LOOKUP_OPS);
+    Print(storeSize, recSize, flags, &res);
+
+    // the same lookups scanning the memory
+    Open(&nvr, storeSize, flags);
+    ops = (n < SCAN_OPS_MAX) ? n : SCAN_OPS_MAX;
+    Begin(&res, "exact (scan)");
+    for (i = 0; i < ops; i++) NVROpenFile(&nvr, 1 + Rand() % n, &size, 0, 0);
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+
+    Begin(&res, "nearest (scan)");
+    for (i = 0; i < ops; i++) NVROpenFile(&nvr, 1 + Rand() % (n + 1), &size, NVR_OPEN_FLAGS_NEAREST, 0);
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+
+    Begin(&res, "max id (scan)");
+    for (i = 0; i < ops; i++) NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+
+    Begin(&res, "max id (binary)");
+    for (i = 0; i < ops; i++) NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID | NVR_OPEN_FLAGS_BINARY_SEARCH, 0);
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+
+    // iteration over all the records from the start
+    NVRMoveToStart(&nvr);
+    Begin(&res, "iterate");
+    for (i = 0; NVR_ERROR_OPENED == NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_NEXT, 0); i++) {
+        if (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, size)) exit(1);
+    }
+    if (i != n) exit(1);
+    End(&res, i);
+    Print(storeSize, recSize, flags, &res);
+    
+    // RANGE_LEN records from a random id: an exact open and the NEXT opens, an iterator
+    Begin(&res, "range (next)");
+    for (i = 0; i < ops; i++) {
+        NVROpenFile(&nvr, 1 + Rand() % n, &size, 0, 0);     // END_MEM if the scan ran up to the end, the record is opened still
+        size = nvr.FoundFileSize;
+        for (j = 0; j < RANGE_LEN; j++) {
+            if (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, size)) exit(1);
+            if (NVR_ERROR_OPENED != NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_NEXT, 0)) break;
+        }
+    }
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+    
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    NVRIterInit(&nvr, &it, ReadAhead, sizeof(ReadAhead));
+    Begin(&res, "range (iter)");
+    for (i = 0; i < ops; i++) {
+        id = 1 + Rand() % n;
+        if (NVR_ERROR_OPENED != NVRIterSeek(&nvr, &it, id, id + RANGE_LEN - 1, 0)) exit(1);
+        do {
+            if (NVR_ERROR_NONE != NVRIterRead(&nvr, &it, 0, Data, it.Rec.Size)) exit(1);
+        } while (NVR_ERROR_OPENED == NVRIterNext(&nvr, &it));
+    }
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+    
+    // the store streamed out in the read-ahead blocks and back into the erased memory by whole pages
+    Snapshot = malloc(storeSize + n * sizeof(NVRSnapshotFrame_t) + 64);
+    SnapshotLen = 0;
+    Open(&nvr, storeSize, flags);
+    if (NVR_ERROR_NONE != NVRMount(&nvr, Index, capacity)) exit(1);     // the index tells the latest versions
+    Begin(&res, "export");
+    if ((NVR_ERROR_NONE != NVRExport(&nvr, SnapshotWrite, 0, ReadAhead, sizeof(ReadAhead), &i)) || (i != n)) exit(1);
+    End(&res, i);
+    Print(storeSize, recSize, flags, &res);
+    
+    Open(&nvr, storeSize, flags);
+    if (NVR_ERROR_NONE != NVREraseAll(&nvr)) exit(1);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    SnapshotPos = 0;
+    Begin(&res, "import");
+    if ((NVR_ERROR_NONE != NVRImport(&nvr, SnapshotRead, 0, Data, sizeof(Data), &i)) || (i != n)) exit(1);
+    End(&res, i);
+    Print(storeSize, recSize, flags, &res);
+    free(Snapshot);
+
+    // wrap-around: the memory twice more, every sector is erased on the way
+    Open(&nvr, storeSize, flags);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    id = NVRGetFoundId(&nvr);
+    ops = 2 * n;
+    Begin(&res, "write (wrap)");
+    for (i = 0; i < ops; i++) {
+        NVRError_t ret = NVRWriteFile(&nvr, ++id, Data, recSize);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) exit(1);     // END_MEM tells the memory wrapped
+    }
+    End(&res, ops);
+    Print(storeSize, recSize, flags, &res);
+    
+    // the sequential write through the write-back, the small records share the page programs
+    Open(&nvr, storeSize, flags);
+    if ((NVR_ERROR_NONE != NVREraseAll(&nvr)) || (NVR_ERROR_NONE != NVRWriteBackInit(&nvr, WriteBack, 0, 0))) exit(1);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    Begin(&res, "write (wb)");
+    for (n = 0; ; n++) {
+        if (NVRGetNextAddr(&nvr) + NVRHeaderSize + recSize > storeSize) break;
+        if (NVR_ERROR_NONE != NVRWriteFile(&nvr, n + 1, Data, recSize)) break;
+    }
+    if (NVR_ERROR_NONE != NVRSync(&nvr)) exit(1);
+    End(&res, n);
+    Print(storeSize, recSize, flags, &res);
+
+    // the sequential write with the compact headers, more of the small records fit the memory
+    Open(&nvr, storeSize, flags | NVR_FLAGS_HEADER_V2);
+    if (NVR_ERROR_NONE != NVREraseAll(&nvr)) exit(1);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    Begin(&res, "write (v2)");
+    for (n = 0; ; n++) {
+        if (NVRGetNextAddr(&nvr) + NVRGetHeaderSize(&nvr) + recSize > storeSize) break;
+        if (NVR_ERROR_NONE != NVRWriteFile(&nvr, n + 1, Data, recSize)) break;
+    }
+    End(&res, n);
+    Print(storeSize, recSize, flags, &res);
+
+    NVRMoveToStart(&nvr);
+    Begin(&res, "iterate (v2)");
+    for (i = 0; NVR_ERROR_OPENED == NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_NEXT, 0); i++) {
+        if (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, size)) exit(1);
+    }
+    if (i != n) exit(1);
+    End(&res, i);
+    Print(storeSize, recSize, flags, &res);
+
+    // sparse records compressed: the sequential write and the reads back
+    Open(&nvr, storeSize, flags);
+    if ((NVR_ERROR_NONE != NVREraseAll(&nvr)) || (NVR_ERROR_NONE != NVRCompressInit(&nvr, (uint8_t *)Work, sizeof(Work)))) exit(1);
+    NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    Begin(&res, "write (lz)");
+    for (n = 0; ; n++) {
+        MakeSparse(n, recSize);
+        if (NVRGetNextAddr(&nvr) + NVRHeaderSize + recSize > storeSize) break;
+        if (NVR_ERROR_NONE != NVRWriteFile(&nvr, n + 1, Sparse, recSize)) break;
+    }
+    End(&res, n);
+    Print(storeSize, recSize, flags, &res);
+    
+    NVRMoveToStart(&nvr);
+    Begin(&res, "iterate (lz)");
+    for (i = 0; NVR_ERROR_OPENED == NVROpenFile(&nvr, 0, &size, NVR_OPEN_FLAGS_NEXT, 0); i++) {
+        MakeSparse(i, recSize);
+        if ((size != recSize) || (NVR_ERROR_NONE != NVRReadFile(&nvr, 0, Data, size)) || (0 != memcmp(Data, Sparse, size))) exit(1);
+    }
+    if (i != n) exit(1);
+    End(&res, i);
+    Print(storeSize, recSize, flags, &res);
+
+    free(Index);
+    NVRSimDeInit(&Sim);
+}
+
+/**
+  * @brief      Opens the store without the index
+  * @param
+  * @retval
+  */
+static void Open(NVRamKV_t *nvr, uint32_t storeSize, uint32_t flags)
+{
+    if ((NVR_ERROR_NONE != NVRInit(nvr, PAGE_SIZE, SECTOR_SIZE, 0, storeSize, Page, flags)) ||
+        (NVR_ERROR_NONE != NVRInitLL(nvr, NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL))) exit(1);
+}
+
+/**
+  * @brief      A telemetry-like record: a counter every 16 bytes, zeros in between
+  * @param
+  * @retval
+  */
+static void MakeSparse(uint32_t n, uint32_t size)
+{
+    uint32_t i, v;
+    memset(Sparse, 0, size);
+    for (i = 0; i + sizeof(v) <= size; i += 16) {
+        v = n * 3 + i;
+        memcpy(&Sparse[i], &v, sizeof(v));
+    }
+}
+
+/**
+  * @brief      The snapshot stream in the RAM
+  * @param
+  * @retval
+  */
+static int32_t SnapshotWrite(void *ctx, const uint8_t *data, uint32_t size)
+{
+    (void)ctx;
+    memcpy(&Snapshot[SnapshotLen], data, size);
+    SnapshotLen += size;
+    return 0;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static int32_t SnapshotRead(void *ctx, uint8_t *data, uint32_t size)
+{
+    (void)ctx;
+    if (SnapshotPos + size > SnapshotLen) return -1;
+    memcpy(data, &Snapshot[SnapshotPos], size);
+    SnapshotPos += size;
+    return 0;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static void Begin(Result_t *r, const char *name)
+{
+    r->Name = name;
+    NVRSimResetStats(&Sim);
+    r->Time = Now();
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static void End(Result_t *r, uint32_t ops)
+{
+    r->Time = Now() - r->Time;
+    r->Ops = ops;
+    r->Stats = Sim.Stats;
+    Violations += Sim.Stats.Violations;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static void Print(uint32_t storeSize, uint32_t recSize, uint32_t flags, const Result_t *r)
+{
+    double ops = r->Ops ? r->Ops : 1;
+    printf("%-8u %-6u %-5s %-14s %8u %12.2f %12.1f %10.1f %12.0f %8llu\n", storeSize / 1024, recSize, (flags & NVR_FLAGS_PAGE_ALIGN) ? "yes" : "no",
+           r->Name, r->Ops, r->Time * 1e6 / ops, r->Stats.TimeNs / 1e3 / ops, r->Stats.Reads / ops, r->Stats.ReadBytes / ops,
+           (unsigned long long)r->Stats.Erases);
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+  * @brief      xorshift, the same sequence on every platform
+  * @param
+  * @retval
+  */
+static uint32_t Rand(void)
+{
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+
+
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
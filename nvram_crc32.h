@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file    nvram_crc32.h
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   CRC-32 (IEEE 802.3, reflected 0xEDB88320) engines with a streaming API.
+  *          The result equals the zlib style CalcCRC32(data, size, 0).
+  ******************************************************************************
+  */
+#ifndef _NVRAM_CRC32_H
+#define _NVRAM_CRC32_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+
+
+#define NVR_CRC32_ENGINE_BITWISE                        0
+#define NVR_CRC32_ENGINE_SLICE8                         1
+#define NVR_CRC32_ENGINE_HW                             2       // PCLMUL folding on x86, CRC32 instructions on ARMv8
+#define NVR_CRC32_ENGINE_EXTERNAL                       3       // CalcCRC32() from crc32.h of the project
+
+
+#if (defined(__PCLMUL__) && defined(__SSE2__)) || defined(__ARM_FEATURE_CRC32)
+#define NVR_CRC32_HW_AVAILABLE
+#endif
+
+#ifndef NVR_CRC32_ENGINE
+#ifdef NVR_CRC32_HW_AVAILABLE
+#define NVR_CRC32_ENGINE                                NVR_CRC32_ENGINE_HW
+#else
+#define NVR_CRC32_ENGINE                                NVR_CRC32_ENGINE_SLICE8
+#endif
+#endif
+
+#if (NVR_CRC32_ENGINE == NVR_CRC32_ENGINE_HW) && !defined(NVR_CRC32_HW_AVAILABLE)
+#error "NVR_CRC32_ENGINE_HW needs -mpclmul (x86) or the crc extension (ARMv8)"
+#endif
+
+
+
+#define NVR_CRC32_INIT                                  0xFFFFFFFF
+
+
+uint32_t NVRCRC32Init(void);
+uint32_t NVRCRC32Update(uint32_t crc, const uint8_t *data, uint32_t size);
+uint32_t NVRCRC32Final(uint32_t crc);
+uint32_t NVRCRC32(const uint8_t *data, uint32_t size);
+
+uint32_t NVRCRC32UpdateBitwise(uint32_t crc, const uint8_t *data, uint32_t size);
+uint32_t NVRCRC32UpdateSlice8(uint32_t crc, const uint8_t *data, uint32_t size);
+#ifdef NVR_CRC32_HW_AVAILABLE
+uint32_t NVRCRC32UpdateHW(uint32_t crc, const uint8_t *data, uint32_t size);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NVRAM_CRC32_H
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
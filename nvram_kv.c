@@ -9,22 +9,109 @@
 #include "nvram_kv.h"
 #include <string.h>
 
-#include "crc32.h"
+#include "nvram_crc32.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NVR_SCAN_AVX2
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define NVR_SCAN_SSE2
+#endif
 
 
 
 #define PREAMBLE                0x1FACADE1
+#define CHECKPOINT_PREAMBLE     0x1FACADE2
+#define CHECKPOINT_NO_INDEX     0xFFFFFFFF
+#define SIZE_LZ                 0x80000000      // DataSize flag: the payload is compressed
 
+#define PREAMBLE_V2             0x2FACADE1
+#define HEADER_V2_SIZE          25              // preamble, data crc, id, prev addr, 16 bit size, version, header crc16
+#define HEADER_V2_VERSION       2
+#define HEADER_V2_LZ            0x80            // version byte flag, as SIZE_LZ
+#define HEADER_V2_SIZE_MAX      0xFFFF
+#define HEADER_V2(nvr)          ((nvr)->Flags & NVR_FLAGS_HEADER_V2)
+#define HEADER_SIZE(nvr)        ((nvr)->HeaderSize)
+#define HEADER_PREAMBLE(nvr)    ((HEADER_V2(nvr)) ? PREAMBLE_V2 : PREAMBLE)
+#define HEADER_SIZE_FITS(nvr, size)     ((HEADER_V2(nvr) == 0) || ((size) <= HEADER_V2_SIZE_MAX))
 
-#define FILE_FOUND()            do {nvr->FileFound = 1; \
-                                    nvr->FoundFileId = fileId; \
-                                    nvr->FoundFileAddr = addr + NVRHeaderSize - nvr->MemoryStartAddr; /* - startAddr => make relative addr*/ \
-                                    nvr->FoundFileSize = s - NVRHeaderSize; \
-                                    nvr->CRC32Temp = crc; \
-                                    nvr->FileAddrPrev = addrPrev; \
+
+#define LZ_LITERALS_MAX         0x80            // token < 0x80: token + 1 literals follow
+#define LZ_MATCH_MIN            3               // token >= 0x80: match of (token & 0x7F) + 3 bytes, the offset follows in 2 bytes
+#define LZ_MATCH_MAX            (0x7F + LZ_MATCH_MIN)
+#define LZ_NONE                 0xFFFFFFFF
+#define LZ_TABLE(nvr)           ((uint32_t *)&(nvr)->LZWork[NVR_LZ_WINDOW])
+#define LZ_OUT(nvr)             (&(nvr)->LZWork[NVR_LZ_WORK_MIN])
+
+#define LZ_STATE_SIZE           0               // the unpacked size ahead of the tokens
+#define LZ_STATE_TOKEN          1
+#define LZ_STATE_LITERALS       2
+#define LZ_STATE_OFFSET_LO      3
+#define LZ_STATE_OFFSET_HI      4
+#define LZ_STATE_MATCH          5
+
+#if (NVR_LZ_WINDOW & (NVR_LZ_WINDOW - 1)) || (NVR_LZ_WINDOW > 32768)
+#error "NVR_LZ_WINDOW must be a power of 2 up to 32768"
+#endif
+
+
+#ifdef NVR_PAGE_SIZE
+#define PAGE_SIZE(nvr)          ((uint32_t)NVR_PAGE_SIZE)
+#else
+#define PAGE_SIZE(nvr)          ((nvr)->PageSize)
+#endif
+#ifdef NVR_SECTOR_SIZE
+#define SECTOR_SIZE(nvr)        ((uint32_t)NVR_SECTOR_SIZE)
+#else
+#define SECTOR_SIZE(nvr)        ((nvr)->SectorSize)
+#endif
+#ifdef NVR_MEMORY_START
+#define MEM_START(nvr)          ((uint32_t)NVR_MEMORY_START)
+#else
+#define MEM_START(nvr)          ((nvr)->MemoryStartAddr)
+#endif
+#ifdef NVR_MEMORY_SIZE
+#define MEM_SIZE(nvr)           ((uint32_t)NVR_MEMORY_SIZE)
+#else
+#define MEM_SIZE(nvr)           ((nvr)->MemorySize)
+#endif
+
+
+#define ASYNC_JOB_NONE          0
+#define ASYNC_JOB_WRITE         1
+#define ASYNC_JOB_READ          2
+
+
+#define FILE_FOUND()            do {cur->FileFound = 1; \
+                                    cur->FoundFileId = fileId; \
+                                    cur->FoundFileAddr = addr + HEADER_SIZE(nvr) - MEM_START(nvr); /* - startAddr => make relative addr*/ \
+                                    cur->FoundFileSize = s - HEADER_SIZE(nvr); \
+                                    cur->CRC32Temp = crc; \
+                                    cur->FileAddrPrev = addrPrev; \
                                 } while(0)
 
+#define FILE_DELETED()          do {cur->FileFound = cur->FoundFileAddr = cur->FoundFileSize = cur->FoundFileId = 0;} while(0)
+
+#define READ_LOCK()             do {if (nvr->Lock) nvr->Lock->ReadLock(nvr->Lock->Ctx);} while(0)
+#define READ_UNLOCK()           do {if (nvr->Lock) nvr->Lock->ReadUnlock(nvr->Lock->Ctx);} while(0)
+#define WRITE_LOCK()            do {if (nvr->Lock) nvr->Lock->WriteLock(nvr->Lock->Ctx); nvr->Generation++;} while(0)
+#define WRITE_UNLOCK()          do {if (nvr->Lock) nvr->Lock->WriteUnlock(nvr->Lock->Ctx);} while(0)
+
+#ifdef NVR_STATS
+#define STATS_ADD(field, n)     do {if (nvr->Stats) nvr->Stats->field += (n);} while(0)
+#define STATS_START()           uint32_t statsStart = (nvr->Clock) ? nvr->Clock() : 0
+#define STATS_STOP(op)          NVRStatsHist(nvr, op, statsStart)
+#else
+#define STATS_ADD(field, n)     
+#define STATS_START()           
+#define STATS_STOP(op)          
+#define NVRReadLL(nvr, addr, data, size)    (nvr)->NVRReadDataLL(addr, data, size)      // nothing to count
+#define NVRWriteLL(nvr, addr, data, size)   (NVRCacheDrop(nvr, addr, size), (nvr)->NVRWriteDataLL(addr, data, size))
+#define NVRWriteVLL(nvr, addr, iov, cnt)    (NVRCacheDrop(nvr, addr, 1), (nvr)->NVRWriteDataVLL(addr, iov, cnt))      // the fragments dont cross a page
+#define NVREraseLL(nvr, addr)               (NVRCacheDrop(nvr, addr, SECTOR_SIZE(nvr)), (nvr)->NVREraseSectorLL(addr))
+#endif
+
 
 
 typedef struct {
@@ -38,14 +125,117 @@ typedef struct {
     uint32_t                    FileAddrPrevInv;    
 } NVRHeader_t;
 
+typedef struct {
+    uint32_t                    Preamble;
+    uint32_t                    CRC32;              // of the rest and of the index copy
+    uint32_t                    Seq;
+    uint32_t                    Count;              // entries of the index copy following, CHECKPOINT_NO_INDEX if none
+    NVRIndexEntry_t             Head;               // the last written record, Addr == 0 if none
+} NVRCheckpoint_t;
+
+typedef struct {
+    uint32_t                    Sectors;
+    uint32_t                    HeadSector;         // the newest one, the ring starts behind it
+    uint32_t                    DeadFrom;           // relative addr, the sectors from here up to the end were skipped by the last wrap around
+} NVRRing_t;
+
 const uint32_t                  NVRHeaderSize = sizeof(NVRHeader_t);
-static NVRHeader_t              EmptyNVRHeader;
 
 
 
 
-static NVRError_t NVRCheckHeader(NVRamKV_t *nvr, uint32_t addr, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc);
-static NVRError_t NVRWrite(NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size, uint32_t flags);
+#ifdef NVR_STATS
+static int32_t NVRReadLL(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size);
+static int32_t NVRWriteLL(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size);
+static int32_t NVRWriteVLL(const NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt);
+static int32_t NVREraseLL(const NVRamKV_t *nvr, uint32_t addr);
+static void NVRStatsHist(const NVRamKV_t *nvr, uint32_t op, uint32_t start);
+#endif
+static NVRError_t NVRMountLocked(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity);
+static NVRError_t NVRWriteFileVLocked(NVRamKV_t *nvr, uint64_t id, const NVRIOVec_t *iov, uint32_t iovCnt);
+static NVRError_t NVRWriteBatchLocked(NVRamKV_t *nvr, const NVRRecord_t *recs, uint32_t count, uint32_t *written);
+static NVRError_t NVRExportLocked(NVRamKV_t *nvr, NVRStreamWrite_t write, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count);
+static NVRError_t NVRExportRange(NVRamKV_t *nvr, NVRIter_t *it, uint32_t start, uint32_t end, NVRStreamWrite_t write, void *ctx, uint32_t *count);
+static NVRError_t NVRImportLocked(NVRamKV_t *nvr, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count);
+static NVRError_t NVRImportRecord(NVRamKV_t *nvr, NVRPageBuf_t *pb, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, const NVRSnapshotFrame_t *f, NVRError_t *fail, uint32_t *wrapped);
+static NVRError_t NVRAsyncWriteFileLocked(NVRamKV_t *nvr, uint64_t id, const uint8_t *data, uint32_t size);
+static NVRError_t NVRAsyncReadFileLocked(NVRamKV_t *nvr, uint8_t *data);
+static NVRError_t NVRAsyncPollLocked(NVRamKV_t *nvr);
+static NVRError_t NVRMaintenanceLocked(NVRamKV_t *nvr, uint32_t maxSectors);
+static NVRError_t NVRCheckpointLocked(NVRamKV_t *nvr);
+static NVRError_t NVREraseAllLocked(NVRamKV_t *nvr);
+static NVRError_t NVRCheckHeader(const NVRamKV_t *nvr, uint8_t *buf, uint32_t addr, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc);
+static NVRError_t NVRFindHeader(const NVRamKV_t *nvr, const uint8_t *b, uint32_t addr, uint32_t bytesToRead, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc);
+static uint8_t NVRHeaderValid(const NVRHeader_t *h);
+static uint8_t NVRHeaderParse(const NVRamKV_t *nvr, const uint8_t *b, NVRHeader_t *h);
+static uint32_t NVRHeaderPack(const NVRamKV_t *nvr, const NVRHeader_t *h, uint8_t *b);
+static uint16_t NVRHeaderCRC16(const uint8_t *b);
+static uint8_t NVRHeaderPacked(const NVRamKV_t *nvr, const uint8_t *b);
+static uint32_t NVRFindPreamble(const uint8_t *buf, uint32_t offset, uint32_t end, uint32_t preamble);
+static uint8_t NVRIsErased(const uint8_t *buf, uint32_t size);
+static uint32_t NVRNextFileAddr(const NVRamKV_t *nvr, uint32_t size, uint32_t *owf);
+static void NVRMakeHeader(NVRamKV_t *nvr, NVRHeader_t *h, NVRIndexEntry_t *e, uint64_t id, uint32_t addr, uint32_t size, uint32_t crc);
+static NVRError_t NVRPageAppend(NVRamKV_t *nvr, NVRPageBuf_t *pb, uint32_t addr, const uint8_t *data, uint32_t size, uint32_t src);
+static NVRError_t NVRPageFlush(NVRamKV_t *nvr, NVRPageBuf_t *pb);
+static NVRError_t NVRPageProgram(NVRamKV_t *nvr, NVRPageBuf_t *pb, const uint8_t *data);
+static NVRError_t NVRRead(NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size);
+static void NVRAsyncSubmit(NVRamKV_t *nvr);
+static NVRError_t NVRWrite(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt);
+static int32_t NVRWritePage(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t *iovIdx, uint32_t *iovOffset, uint32_t size);
+static uint8_t NVRTakeErased(NVRamKV_t *nvr, uint32_t addr);
+static uint8_t NVRAheadSector(const NVRamKV_t *nvr, const NVRIndexEntry_t *e, uint32_t *sector);
+static NVRError_t NVREraseAhead(NVRamKV_t *nvr, const NVRIndexEntry_t *e, uint8_t written);
+static void NVRCheckpointTick(NVRamKV_t *nvr);
+static uint8_t NVRCheckpointFind(NVRamKV_t *nvr, NVRCheckpoint_t *c, uint32_t *pos);
+static uint32_t NVRCheckpointCRC(NVRamKV_t *nvr, const NVRCheckpoint_t *c, uint32_t addr, uint32_t size);
+static NVRError_t NVRCheckpointLoad(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity);
+static void NVRMountHead(NVRamKV_t *nvr, const NVRIndexEntry_t *head);
+static void NVRMoveToHead(NVRamKV_t *nvr);
+static uint8_t NVRLiveSector(const NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint8_t margin, uint32_t *sector);
+static NVRError_t NVRCompactFor(NVRamKV_t *nvr, uint32_t size);
+static NVRError_t NVRCompactSector(NVRamKV_t *nvr, uint32_t sector);
+static NVRError_t NVRRelocate(NVRamKV_t *nvr, NVRIndexEntry_t x);
+static uint8_t NVRRecordIntact(NVRamKV_t *nvr, const NVRIndexEntry_t *e);
+static NVRError_t NVRScan(NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags, uint32_t emptyPagesLim);
+static uint32_t NVRCursorNextAddr(const NVRamKV_t *nvr, const NVRCursor_t *cur);
+static void NVRCursorLoad(const NVRamKV_t *nvr, NVRCursor_t *cur);
+static void NVRCursorStore(NVRamKV_t *nvr, const NVRCursor_t *cur);
+static NVRError_t NVRIndexOpen(const NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags);
+static uint32_t NVRIndexFind(const NVRamKV_t *nvr, uint64_t id);
+static uint8_t NVRDeleted(const NVRamKV_t *nvr, uint64_t id, uint32_t size);
+static const uint8_t *NVRIterFetch(NVRamKV_t *nvr, NVRIter_t *it, uint32_t addr, uint32_t size, uint32_t end);
+static uint8_t NVRIterHeader(NVRamKV_t *nvr, NVRIter_t *it, uint32_t addr, uint32_t end, NVRIndexEntry_t *e);
+static uint32_t NVRIterNextAddr(const NVRamKV_t *nvr, const NVRIndexEntry_t *e);
+static uint8_t NVRIterStep(NVRamKV_t *nvr, NVRIter_t *it, const NVRIndexEntry_t *cur, NVRIndexEntry_t *e, uint8_t backward);
+static uint8_t NVRIterPrev(NVRamKV_t *nvr, NVRIter_t *it, const NVRIndexEntry_t *cur, NVRIndexEntry_t *e);
+static uint8_t NVRIterProbe(NVRamKV_t *nvr, NVRIter_t *it, const NVRRing_t *r, uint32_t k, NVRIndexEntry_t *e);
+static uint8_t NVRIterStart(NVRamKV_t *nvr, NVRIter_t *it, uint64_t key, NVRIndexEntry_t *e);
+static uint8_t NVRIterCheck(NVRamKV_t *nvr, NVRIter_t *it);
+static void NVRIndexInsert(NVRamKV_t *nvr, const NVRIndexEntry_t *e);
+static NVRError_t NVRIndexScanAdd(NVRamKV_t *nvr, NVRIndexEntry_t *index, const NVRIndexEntry_t *e, uint32_t headAddr);
+static void NVRIndexPurge(NVRamKV_t *nvr);
+static void NVRIndexDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size);
+static uint8_t NVREraseRange(const NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint32_t *start, uint32_t *end);
+static void NVRSummaryReset(NVRamKV_t *nvr);
+static void NVRSummaryAdd(NVRamKV_t *nvr, const NVRIndexEntry_t *e);
+static void NVRSummaryDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size);
+static void NVRHeaderCachePut(NVRamKV_t *nvr, const NVRIndexEntry_t *e);
+static void NVRHeaderCacheDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size);
+static uint8_t NVRHeaderCachePrev(NVRamKV_t *nvr, NVRCursor_t *cur);
+static uint8_t NVRHeaderCacheStep(NVRamKV_t *nvr, const NVRIndexEntry_t *x, NVRIndexEntry_t *e);
+static uint32_t NVRLZCompress(NVRamKV_t *nvr, const uint8_t *data, uint32_t size);
+static NVRError_t NVRLZDecode(NVRamKV_t *nvr, NVRReadStream_t *rs, uint8_t *data, uint32_t size);
+static void NVRLZBegin(NVRamKV_t *nvr, NVRReadStream_t *rs, uint32_t raw);
+static NVRError_t NVRFoundRaw(NVRamKV_t *nvr, uint32_t *raw);
+static NVRError_t NVRWriteBackPut(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt);
+static NVRError_t NVRWriteBackSync(NVRamKV_t *nvr);
+static uint8_t NVRWriteBackDue(const NVRamKV_t *nvr);
+static int32_t NVRCacheRead(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size, uint8_t keep);
+static void NVRCacheDrop(const NVRamKV_t *nvr, uint32_t addr, uint32_t size);
+static uint8_t NVRWriteBackHit(const NVRamKV_t *nvr, uint32_t addr, uint32_t size);
+static void NVRWriteBackOverlay(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size);
+static uint8_t NVRSummaryMiss(const NVRamKV_t *nvr, uint32_t addr, uint64_t id);
+static uint64_t NVRSummaryHash(uint64_t id);
 
 
 /**
@@ -56,9 +246,45 @@ static NVRError_t NVRWrite(NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_
 NVRError_t NVRInit(NVRamKV_t *nvr, uint32_t pageSize, uint32_t sectorSize, uint32_t startAddr, uint32_t memSize, uint8_t *page, uint32_t flags)
 {    
     if ((pageSize == 0) || (sectorSize == 0) || (memSize == 0) || (sectorSize < pageSize) || (page == 0)) return NVR_ERROR_INIT;
+#ifdef NVR_PAGE_SIZE
+    if (pageSize != NVR_PAGE_SIZE) return NVR_ERROR_INIT;     // the geometry fixed at compile time
+#endif
+#ifdef NVR_SECTOR_SIZE
+    if (sectorSize != NVR_SECTOR_SIZE) return NVR_ERROR_INIT;
+#endif
+#ifdef NVR_MEMORY_START
+    if (startAddr != NVR_MEMORY_START) return NVR_ERROR_INIT;
+#endif
+#ifdef NVR_MEMORY_SIZE
+    if (memSize != NVR_MEMORY_SIZE) return NVR_ERROR_INIT;
+#endif
     nvr->NotReady = 1;
     nvr->FoundFileId = nvr->FoundFileAddr = nvr->FoundFileSize = nvr->FileAddrPrev = 0;
     nvr->FileFound = nvr->TryToOpen = 0;
+    nvr->NVRWriteDataVLL = 0;
+    nvr->Base = 0;
+    memset(&nvr->Async, 0, sizeof(NVRAsync_t));
+    nvr->Index = 0;
+    nvr->IndexCapacity = nvr->IndexCount = 0;
+    memset(&nvr->IndexHead, 0, sizeof(NVRIndexEntry_t));
+    nvr->EraseReserve = nvr->ErasedAddr = nvr->ErasedCount = 0;
+    nvr->HeadEnd = nvr->HeadKnown = 0;
+    nvr->CheckpointAddr = nvr->CheckpointSize = nvr->CheckpointInterval = 0;
+    nvr->Summary = 0;
+    nvr->SummaryValid = nvr->SummaryLive = 0;
+    memset(&nvr->HeaderCache, 0, sizeof(NVRHeaderCache_t));
+    nvr->LZWork = 0;
+    nvr->LZWorkSize = nvr->FoundFileRaw = nvr->FoundFileRawAddr = 0;
+    memset(&nvr->WriteBack, 0, sizeof(NVRPageBuf_t));
+    nvr->WriteBackClock = 0;
+    nvr->WriteBackTimeout = nvr->WriteBackSince = 0;
+    nvr->Cache = 0;
+    nvr->Lock = 0;
+    nvr->Generation = 0;
+#ifdef NVR_STATS
+    nvr->Stats = 0;
+    nvr->Clock = 0;
+#endif
     
     nvr->PageSize = pageSize;
     nvr->SectorSize = sectorSize;
@@ -66,8 +292,7 @@ NVRError_t NVRInit(NVRamKV_t *nvr, uint32_t pageSize, uint32_t sectorSize, uint3
     nvr->MemorySize = memSize;
     nvr->Page = page;
     nvr->Flags = flags;
-    
-    memset(&EmptyNVRHeader, 0xFF, NVRHeaderSize);
+    nvr->HeaderSize = (flags & NVR_FLAGS_HEADER_V2) ? HEADER_V2_SIZE : NVRHeaderSize;
     
     return NVR_ERROR_NONE;
 }
@@ -89,6 +314,65 @@ NVRError_t NVRInitLL(NVRamKV_t *nvr, NVRReadData_t nvrRead, NVRWriteData_t nvrWr
     return NVR_ERROR_NONE;
 }
 
+/**
+  * @brief      Sets the optional gathering write, the fragments are programmed without copying
+  * @param
+  * @retval
+  */
+NVRError_t NVRInitLLV(NVRamKV_t *nvr, NVRWriteDataV_t nvrWriteV)
+{
+    nvr->NVRWriteDataVLL = nvrWriteV;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the direct access to the memory mapped store (NOR on the bus, mmap'd file or /dev/mtd):
+  *             the headers are parsed in place, the reads are copied without NVRReadDataLL, 
+  *             NVRGetView gives the payload without copying. The writes and the erases still go through the LL.
+  * @param      base: address of the byte at MemoryStartAddr, 0 - off
+  * @retval
+  */
+NVRError_t NVRInitDirect(NVRamKV_t *nvr, const uint8_t *base)
+{
+    nvr->Base = base;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the reader-writer lock for the use from several threads: the cursors read
+  *             under the shared lock, the writes and the maintenance run under the exclusive one.
+  *             The store's own cursor (NVROpenFile, NVRReadFile...) belongs to the writer thread.
+  *             The LL functions must allow concurrent reads.
+  * @param      lock: 0 - single thread
+  * @retval
+  */
+NVRError_t NVRInitLock(NVRamKV_t *nvr, const NVRLock_t *lock)
+{
+    if ((lock) && ((lock->ReadLock == 0) || (lock->ReadUnlock == 0) || (lock->WriteLock == 0) || (lock->WriteUnlock == 0))) return NVR_ERROR_INIT;
+    nvr->Lock = lock;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Scans the whole memory once and builds the RAM index (id -> latest record).
+  *             NVROpenFile answers exact id, NVR_OPEN_FLAGS_MAX_ID and NVR_OPEN_FLAGS_NEAREST
+  *             from the index afterwards, NVRWriteFile keeps it up to date.
+  *             If the index overflows later on it is dropped and NVROpenFile scans the memory again.
+  *             With checkpoints the newest one is loaded and only the records written after it are scanned.
+  * @param      index: caller's memory for capacity entries, 0 with checkpoints to find just the head 
+  *             and open the last written record
+  * @param      capacity: entries for the distinct ids on the memory, the deleted ones whose 
+  *             tombstones are still there included
+  * @retval     NVR_ERROR_FULL if the memory holds more ids than capacity
+  */
+NVRError_t NVRMount(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRMountLocked(nvr, index, capacity);
+    WRITE_UNLOCK();
+    return ret;
+}
+
 /**
   * @brief      todo: BST
   * @param
@@ -99,112 +383,241 @@ NVRError_t NVROpenFile(NVRamKV_t *nvr, uint64_t id, uint32_t *size, uint32_t fla
     if (nvr->NotReady) return NVR_ERROR_INIT;
     if (size == 0) return NVR_ERROR_ARGUMENT;   // check pointer
     
-    NVRError_t ret = NVR_ERROR_NONE;
+    STATS_START();
+    NVRCursor_t cur;
+    NVRCursorLoad(nvr, &cur);
+    NVRError_t ret;
+    if (((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) && (NVRHeaderCachePrev(nvr, &cur))) {
+        *size = cur.FoundFileSize;
+        ret = NVR_ERROR_OPENED;
+    } else {
+        ret = NVRScan(nvr, &cur, id, size, flags, emptyPagesLim);
+    }
+    NVRCursorStore(nvr, &cur);
+    uint32_t raw;
+    if ((ret == NVR_ERROR_OPENED) && (NVR_ERROR_NONE == NVRFoundRaw(nvr, &raw)) && (raw)) *size = raw;
+    
+    if (((ret == NVR_ERROR_OPENED) || ((ret == NVR_ERROR_END_MEM) && (nvr->FileFound))) && ((flags & (NVR_OPEN_FLAGS_MAX_ID | NVR_OPEN_FLAGS_ANY_ID)) == NVR_OPEN_FLAGS_MAX_ID) &&
+        ((nvr->Index == 0) || (flags & NVR_OPEN_FLAGS_FROM_CURRENT_POS))) {    // the scan has found the head, END_MEM if the records go up to the end of memory
+        WRITE_LOCK();
+        nvr->IndexHead.Id = nvr->FoundFileId;
+        nvr->IndexHead.Addr = nvr->FoundFileAddr;
+        nvr->IndexHead.Size = nvr->FoundFileSize;
+        nvr->IndexHead.CRC32 = nvr->CRC32Temp;
+        nvr->IndexHead.AddrPrev = nvr->FileAddrPrev;
+        nvr->HeadEnd = nvr->FoundFileAddr + nvr->FoundFileSize;
+        nvr->HeadKnown = 1;
+        WRITE_UNLOCK();
+    }
+    STATS_STOP(NVR_STATS_OPEN);
+    return ret;
+}
+
+/**
+  * @brief      Sets the cursor of a reader thread
+  * @param      page: buff of PageSize bytes used by the cursor for the scans
+  * @retval
+  */
+NVRError_t NVRCursorInit(NVRamKV_t *nvr, NVRCursor_t *cur, uint8_t *page)
+{
+    (void)nvr;
+    if ((cur == 0) || (page == 0)) return NVR_ERROR_ARGUMENT;
+    memset(cur, 0, sizeof(NVRCursor_t));
+    cur->Page = page;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVROpenFile for a cursor, many readers may open and read at once while one thread writes
+  * @param
+  * @retval
+  */
+NVRError_t NVRCursorOpen(NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags, uint32_t emptyPagesLim)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if ((cur == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
     
-    uint32_t start, end, half, exit = 0;   
+    STATS_START();
+    READ_LOCK();
+    NVRError_t ret = NVRScan(nvr, cur, id, size, flags, emptyPagesLim);
+    cur->Generation = nvr->Generation;
+    READ_UNLOCK();
+    STATS_STOP(NVR_STATS_OPEN);
+    return ret;
+}
+
+/**
+  * @brief      NVRReadFile for a cursor. If the memory has been written since the open
+  *             the header is checked again, the record may have been erased.
+  *             A compressed record is not unpacked: the readers dont share the window of the work buff.
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND if the record is gone, NVR_ERROR_ARGUMENT if it is compressed
+  */
+NVRError_t NVRCursorRead(NVRamKV_t *nvr, NVRCursor_t *cur, uint32_t pos, uint8_t *data, uint32_t size)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (cur == 0) return NVR_ERROR_ARGUMENT;
+    if ((cur->FileFound == 0) || (cur->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
+    if ((pos + size > cur->FoundFileSize) || (pos + size < pos) || (data == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
     
-    *size = 0;
+    STATS_START();
+    NVRError_t ret = NVR_ERROR_NONE;
+    READ_LOCK();
+    if (cur->Generation != nvr->Generation) {
+        uint32_t addr, addrPrev, s, crc;
+        uint64_t fileId;
+        uint32_t headerAddr = cur->FoundFileAddr - HEADER_SIZE(nvr) + MEM_START(nvr);
+        if ((NVR_ERROR_NONE != NVRCheckHeader(nvr, cur->Page, headerAddr, &addr, &addrPrev, &fileId, &s, &crc)) || 
+            (addr != headerAddr) || (fileId != cur->FoundFileId) || (s != HEADER_SIZE(nvr) + cur->FoundFileSize) || (crc != cur->CRC32Temp)) {
+            ret = NVR_ERROR_NOT_FOUND;
+        }
+        cur->Generation = nvr->Generation;
+    }
+    if ((ret == NVR_ERROR_NONE) && (nvr->LZWork)) {
+        ret = NVRRead(nvr, cur->FoundFileAddr - HEADER_SIZE(nvr) + MEM_START(nvr), cur->Page, HEADER_SIZE(nvr));
+        if ((ret == NVR_ERROR_NONE) && (NVRHeaderPacked(nvr, cur->Page))) ret = NVR_ERROR_ARGUMENT;
+    }
+    if (ret == NVR_ERROR_NONE) ret = NVRRead(nvr, cur->FoundFileAddr + pos + MEM_START(nvr), data, size);
+    READ_UNLOCK();
     
-    if (((flags & NVR_OPEN_FLAGS_FROM_CURRENT_POS) == 0) || (nvr->FoundFileAddr == 0)) {
-        if (flags & NVR_OPEN_FLAGS_BINARY_SEARCH) {
-            half = nvr->MemorySize / 2; 
-            start = nvr->MemoryStartAddr + half;         
-        } else {
-            start = nvr->MemoryStartAddr;          
+    if (ret == NVR_ERROR_NOT_FOUND) cur->FileFound = 0;
+    if (ret == NVR_ERROR_NONE) {
+        STATS_ADD(CRCBytes, size);
+        if (NVRCRC32(data, size) != cur->CRC32Temp) ret = NVR_ERROR_CRC;
+    }
+    STATS_STOP(NVR_STATS_READ);
+    return ret;
+}
+
+/**
+  * @brief      Sets an iterator over a range of ids, the ids are expected to ascend in the order of writing (time series)
+  * @param      buf: read-ahead of the iterator, at least PageSize bytes, not used if the store is memory mapped
+  * @retval
+  */
+NVRError_t NVRIterInit(NVRamKV_t *nvr, NVRIter_t *it, uint8_t *buf, uint32_t bufSize)
+{
+    (void)nvr;
+    if ((it == 0) || (buf == 0) || (bufSize < PAGE_SIZE(nvr))) return NVR_ERROR_ARGUMENT;
+    memset(it, 0, sizeof(NVRIter_t));
+    it->Buf = buf;
+    it->BufSize = bufSize - bufSize % PAGE_SIZE(nvr);
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Moves the iterator to the first record with id >= idFrom or, with NVR_OPEN_FLAGS_BACKWARD, 
+  *             to the last one with id <= idTo. The RAM index is searched if there is one, else a binary search 
+  *             over the sectors in the ring order reads the first header of log2(sectors) sectors.
+  *             The head has to be known: NVRMount or NVROpenFile with NVR_OPEN_FLAGS_MAX_ID before.
+  * @param      flags: NVR_OPEN_FLAGS_BACKWARD or 0
+  * @retval     NVR_ERROR_OPENED, the record is in it->Rec
+  */
+NVRError_t NVRIterSeek(NVRamKV_t *nvr, NVRIter_t *it, uint64_t idFrom, uint64_t idTo, uint32_t flags)
+{
+    if ((nvr->NotReady) || (nvr->HeadKnown == 0)) return NVR_ERROR_INIT;
+    if ((it == 0) || (it->Buf == 0) || (idFrom > idTo)) return NVR_ERROR_ARGUMENT;
+    
+    STATS_START();
+    NVRIndexEntry_t e, n;
+    uint8_t found = 0;
+    READ_LOCK();
+    it->IdFrom = idFrom;
+    it->IdTo = idTo;
+    it->Flags = flags & NVR_OPEN_FLAGS_BACKWARD;
+    it->BufLen = 0;
+    it->Generation = nvr->Generation;
+    if (nvr->IndexHead.Addr == 0) {
+        found = 0;                                  // nothing is written
+    } else if (flags & NVR_OPEN_FLAGS_BACKWARD) {
+        e = nvr->IndexHead;
+        found = (e.Size) || (NVRIterStep(nvr, it, &nvr->IndexHead, &e, 1));    // the newest present record
+        if ((found) && (idTo < e.Id)) {
+            found = NVRIterStart(nvr, it, idTo + 1, &e) && (e.Id <= idTo);
+            while ((found) && (NVRIterStep(nvr, it, &e, &n, 0)) && (n.Id <= idTo)) e = n;
         }
+        found = found && (e.Id >= idFrom);
     } else {
-        if ((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) {
-            int32_t a = NVRGetPrevAddr(nvr);
-            if (a >= 0) start = a + nvr->MemoryStartAddr;
-            else exit = 1;  // exit
-        } else {
-            if ((flags & NVR_OPEN_FLAGS_NEXT) == NVR_OPEN_FLAGS_NEXT) {
-                start = NVRGetNextAddr(nvr) + nvr->MemoryStartAddr;
-            } else {
-                start = NVRGetCurrAddr(nvr) + nvr->MemoryStartAddr;
-            }
+        found = NVRIterStart(nvr, it, idFrom, &e);
+        while ((found) && (e.Id < idFrom)) {
+            found = NVRIterStep(nvr, it, &e, &n, 0);
+            if (found) e = n;
         }
+        found = found && (e.Id <= idTo);
     }
-    end = nvr->MemoryStartAddr + nvr->MemorySize; 
+    READ_UNLOCK();
     
-    uint64_t fileId = 0, fileIdPrev = 0, fileIdMax = 0;
-    uint32_t addr, addrPrev, s, crc, emptyPages = 0;   // we need crc holded separatly  
-    nvr->TryToOpen = 1;
-    nvr->FileFound = nvr->FoundFileAddr = nvr->FoundFileSize = nvr->FoundFileId = 0;
-    while ((start < end) && (exit == 0)) {
-        switch (ret = NVRCheckHeader(nvr, start, &addr, &addrPrev, &fileId, &s, &crc)) {
-            case NVR_ERROR_NONE:
-                start = addr + s;  // next addr to scan
-                if (nvr->Flags & NVR_FLAGS_PAGE_ALIGN) {
-                    uint32_t pageFilled = start % nvr->PageSize;
-                    if (pageFilled) start += nvr->PageSize - pageFilled;    // else if 0 then addr is page aligned already
-                }                             
-                if ((id == fileId) || (flags & NVR_OPEN_FLAGS_ANY_ID)) {                    
-                    FILE_FOUND();
-                    exit = flags & NVR_OPEN_FLAGS_FIRST_MATCH;
-                } else {
-                    if (flags & NVR_OPEN_FLAGS_NEAREST) {
-                        if ((id > fileIdPrev) && (id < fileId)) {
-                            FILE_FOUND();
-                            exit = 1;
-                        }
-                    } else {
-                        if (flags & NVR_OPEN_FLAGS_MAX_ID) {
-                            if (fileId >= fileIdMax) {
-                                fileIdMax = fileId;
-                                FILE_FOUND();
-                            } else {                                
-                                exit = 1;
-                            }
-                        }
-                    }
-                }
-                fileIdPrev = fileId;
-            break;
-            case NVR_ERROR_EMPTY:
-                if (emptyPages < emptyPagesLim) emptyPages++;
-                else exit = 1;
-                if (fileIdPrev == 0) {
-                    if (flags & NVR_OPEN_FLAGS_BINARY_SEARCH) {
-                        if (half >= nvr->PageSize * 2) {
-                            half /= 2;
-                        }                        
-                        if (start >= nvr->MemoryStartAddr + half) start -= half;
-                        else { 
-                            if (start == nvr->MemoryStartAddr) return NVR_ERROR_EMPTY;
-                            else start = nvr->MemoryStartAddr;
-                        }
-                    } else {
-                        start += nvr->PageSize;
-                    }
-                } else {
-                    exit = 1;
-                }
-                if (nvr->FileFound) exit = 1;   // a file was found in a prev cycle
-            break;
-            case NVR_ERROR_HEADER:  // whether corrupted page or random place in a long (more than 1 page) entry
-                if ((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) {
-                    if (start >= nvr->PageSize) start -= nvr->PageSize;
-                    else exit = 1;
-                } else {
-                    start += nvr->PageSize;
-                }
-            break; 
-            default:
-                return ret;
-            break;
+    it->Valid = found;
+    if (found) it->Rec = e;
+    STATS_STOP(NVR_STATS_OPEN);
+    return (found) ? NVR_ERROR_OPENED : NVR_ERROR_NOT_FOUND;
+}
+
+/**
+  * @brief      The next record of the range: the headers are parsed from the read-ahead, 
+  *             forward along the write order, backward along FileAddrPrev
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND at the end of the range or if the record has been erased meanwhile
+  */
+NVRError_t NVRIterNext(NVRamKV_t *nvr, NVRIter_t *it)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (it == 0) return NVR_ERROR_ARGUMENT;
+    if (it->Valid == 0) return NVR_ERROR_NOT_FOUND;
+    
+    STATS_START();
+    NVRIndexEntry_t n;
+    uint8_t backward = (it->Flags & NVR_OPEN_FLAGS_BACKWARD) ? 1 : 0;
+    READ_LOCK();
+    uint8_t found = (NVRIterCheck(nvr, it)) && (NVRIterStep(nvr, it, &it->Rec, &n, backward));
+    READ_UNLOCK();
+    
+    if (found) found = (backward) ? (n.Id >= it->IdFrom) : (n.Id <= it->IdTo);
+    if (found) it->Rec = n;
+    else it->Valid = 0;
+    STATS_STOP(NVR_STATS_OPEN);
+    return (found) ? NVR_ERROR_OPENED : NVR_ERROR_NOT_FOUND;
+}
+
+/**
+  * @brief      NVRReadFile for an iterator, the record is read from the read-ahead if it fits in there.
+  *             A compressed record is not unpacked, as by NVRCursorRead.
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND if the record is gone, NVR_ERROR_ARGUMENT if it is compressed
+  */
+NVRError_t NVRIterRead(NVRamKV_t *nvr, NVRIter_t *it, uint32_t pos, uint8_t *data, uint32_t size)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (it == 0) return NVR_ERROR_ARGUMENT;
+    if (it->Valid == 0) return NVR_ERROR_NOT_FOUND;
+    if ((pos + size > it->Rec.Size) || (pos + size < pos) || (data == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
+    
+    STATS_START();
+    NVRError_t ret = NVR_ERROR_NONE;
+    READ_LOCK();
+    if (NVRIterCheck(nvr, it)) {
+        uint32_t end = (it->Flags & NVR_OPEN_FLAGS_BACKWARD) ? it->Rec.Addr + it->Rec.Size : 0;
+        const uint8_t *p = (nvr->LZWork) ? NVRIterFetch(nvr, it, it->Rec.Addr - HEADER_SIZE(nvr), HEADER_SIZE(nvr), end) : 0;
+        if ((p) && (NVRHeaderPacked(nvr, p))) {
+            ret = NVR_ERROR_ARGUMENT;
+        } else {
+            p = NVRIterFetch(nvr, it, it->Rec.Addr + pos, size, end);
+            if (p) memcpy(data, p, size);
+            else ret = NVRRead(nvr, it->Rec.Addr + pos + MEM_START(nvr), data, size);     // bigger than the read-ahead
         }
-    }
-    if (nvr->FileFound) {
-        *size = nvr->FoundFileSize;
-        ret = NVR_ERROR_OPENED;
-    } else {   
+    } else {
         ret = NVR_ERROR_NOT_FOUND;
     }
+    READ_UNLOCK();
+    
+    if (ret == NVR_ERROR_NOT_FOUND) it->Valid = 0;
+    if (ret == NVR_ERROR_NONE) {
+        STATS_ADD(CRCBytes, size);
+        if (NVRCRC32(data, size) != it->Rec.CRC32) ret = NVR_ERROR_CRC;
+    }
+    STATS_STOP(NVR_STATS_READ);
     return ret;
 }
 
-    
 /**
   * @brief      
   * @param
@@ -212,7 +625,7 @@ NVRError_t NVROpenFile(NVRamKV_t *nvr, uint64_t id, uint32_t *size, uint32_t fla
   */
 uint32_t NVRGetCurrAddr(const NVRamKV_t *nvr)
 {
-    if (nvr->FoundFileAddr > NVRHeaderSize) return nvr->FoundFileAddr - NVRHeaderSize;
+    if (nvr->FoundFileAddr > HEADER_SIZE(nvr)) return nvr->FoundFileAddr - HEADER_SIZE(nvr);
     else return 0;
 }
 
@@ -237,8 +650,8 @@ uint32_t NVRGetNextAddr(const NVRamKV_t *nvr)
     if (nvr->FoundFileAddr > 0) {
         addr = nvr->FoundFileAddr + nvr->FoundFileSize;
         if (nvr->Flags & NVR_FLAGS_PAGE_ALIGN) {            
-            uint32_t pageFilled = addr % nvr->PageSize;
-            if (pageFilled) addr += nvr->PageSize - pageFilled; // else if 0 then addr is page aligned already
+            uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+            if (pageFilled) addr += PAGE_SIZE(nvr) - pageFilled; // else if 0 then addr is page aligned already
         } 
     }     
     return addr;
@@ -251,7 +664,7 @@ uint32_t NVRGetNextAddr(const NVRamKV_t *nvr)
   */
 uint32_t NVRGetPrevAddr(const NVRamKV_t *nvr)
 {    
-    return nvr->FileAddrPrev ? (nvr->FileAddrPrev - NVRHeaderSize) : (uint32_t)-1;
+    return nvr->FileAddrPrev ? (nvr->FileAddrPrev - HEADER_SIZE(nvr)) : (uint32_t)-1;
 }
 
 /**
@@ -297,6 +710,16 @@ uint64_t NVRGetFoundId(const NVRamKV_t *nvr)
     return nvr->FoundFileId;
 }
 
+/**
+  * @brief
+  * @param
+  * @retval     bytes of a record header in the store, NVRHeaderSize or less for NVR_FLAGS_HEADER_V2
+  */
+uint32_t NVRGetHeaderSize(const NVRamKV_t *nvr)
+{
+    return HEADER_SIZE(nvr);
+}
+
 /**
   * @brief  Read opened file before
   * @param
@@ -306,239 +729,3375 @@ NVRError_t NVRReadFile(NVRamKV_t *nvr, uint32_t pos, uint8_t *data, uint32_t siz
 {
     if (nvr->NotReady) return NVR_ERROR_INIT;
     if ((nvr->FileFound == 0) || (nvr->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
-    uint32_t addr = nvr->FoundFileAddr + pos; 
-    uint32_t pageFilled = addr % nvr->PageSize;
-    if ((addr + size > nvr->FoundFileAddr + nvr->FoundFileSize) || (data == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
     
-    NVRError_t ret = NVR_ERROR_NONE;    
-    uint32_t remain = size, offset = 0;
+    uint32_t raw;
+    NVRError_t ret = NVRFoundRaw(nvr, &raw);
+    if (ret != NVR_ERROR_NONE) return ret;
+    if ((pos + size > ((raw) ? raw : nvr->FoundFileSize)) || (pos + size < pos) || (data == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
     
-    addr += nvr->MemoryStartAddr;       // make absolute addr
+    STATS_START();
+    if (raw) {      // the whole record is read to check the CRC of the stored bytes
+        NVRReadStream_t rs;
+        NVRLZBegin(nvr, &rs, raw);
+        if ((NVR_ERROR_NONE == (ret = NVRLZDecode(nvr, &rs, 0, pos))) && (NVR_ERROR_NONE == (ret = NVRLZDecode(nvr, &rs, data, size)))) {
+            ret = NVRReadFinish(nvr, &rs);
+        }
+    } else {
+        ret = NVRRead(nvr, nvr->FoundFileAddr + pos + MEM_START(nvr), data, size);
     
-    if ((pageFilled) && ((pageFilled + size) > nvr->PageSize)) {
-        int s = nvr->PageSize - pageFilled;
-        if (0 == nvr->NVRReadDataLL(addr, data, s)) {
-            offset += s;
-            remain -= s;
-        } else {
-            return NVR_ERROR_HW;            
+        if (ret == NVR_ERROR_NONE) {
+            STATS_ADD(CRCBytes, size);
+            if (NVRCRC32(data, size) != nvr->CRC32Temp) ret = NVR_ERROR_CRC;
         }
     }
-    uint32_t stop = 0;
-    do {
-        uint32_t chunkSize;
-        if (remain > nvr->PageSize) {
-            chunkSize = nvr->PageSize;
-            remain -= nvr->PageSize;
-        } else {
-            chunkSize = remain;
-            stop = 1;
-        }
-        if (0 == nvr->NVRReadDataLL(addr + offset, &data[offset], chunkSize)) {
-            offset += chunkSize;
-        } else {
-            ret = NVR_ERROR_HW;
-            stop = 1;
-        }
-    } while (stop == 0); 
-    
-    if (ret != NVR_ERROR_NONE) return ret;    
-    if (CalcCRC32(data, size, 0) != nvr->CRC32Temp) return NVR_ERROR_CRC;
-    else return NVR_ERROR_NONE;
+    STATS_STOP(NVR_STATS_READ);
+    return ret;
 }
 
 
 /**
-  * @brief
+  * @brief  Reads a part of the opened file without the CRC check, e.g. a field at a fixed offset
   * @param
   * @retval
   */
-NVRError_t NVRWriteFile(NVRamKV_t *nvr, uint64_t id, uint8_t *data, uint32_t size)
+NVRError_t NVRReadFileRaw(NVRamKV_t *nvr, uint32_t pos, uint8_t *data, uint32_t size)
 {
     if (nvr->NotReady) return NVR_ERROR_INIT;
-    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
-    if (data == 0) return NVR_ERROR_ARGUMENT;
+    if ((nvr->FileFound == 0) || (nvr->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
     
-    NVRError_t ret = NVR_ERROR_NONE;
-    uint32_t owf = 0;
-    uint32_t addr = (nvr->FoundFileAddr == 0) ? 0 : nvr->FoundFileAddr + nvr->FoundFileSize;
-    uint32_t pageFilled = addr % nvr->PageSize;
-    uint32_t pageRemain = nvr->PageSize - pageFilled;
-    if ((pageFilled && (nvr->Flags & NVR_FLAGS_PAGE_ALIGN)) || (pageRemain < NVRHeaderSize)) {     // align to the nearest start of the page if the flag is set or there is no place for the whole header
-        addr += pageRemain;
-        pageFilled = 0;
-    }       
+    uint32_t raw;
+    NVRError_t ret = NVRFoundRaw(nvr, &raw);
+    if (ret != NVR_ERROR_NONE) return ret;
+    if ((pos + size > ((raw) ? raw : nvr->FoundFileSize)) || (pos + size < pos) || (data == 0) || (size == 0)) return NVR_ERROR_ARGUMENT;
     
-    if ((addr + NVRHeaderSize + size) > nvr->MemorySize) {
-        addr = 0;
-        owf = 1;        
+    if (raw) {
+        NVRReadStream_t rs;
+        NVRLZBegin(nvr, &rs, raw);
+        if (NVR_ERROR_NONE != (ret = NVRLZDecode(nvr, &rs, 0, pos))) return ret;
+        return NVRLZDecode(nvr, &rs, data, size);
     }
-    nvr->FileAddrPrev = nvr->FoundFileAddr;     // update addr
-    nvr->FoundFileAddr = addr + NVRHeaderSize;  // to allaw instant access to the file after writing
-    nvr->FoundFileSize = size;
-    nvr->FoundFileId = id;
-    
-    addr += nvr->MemoryStartAddr;       // make absolute addr        
-    
-    NVRHeader_t *h = (NVRHeader_t *)nvr->Page;    // fill header and copy to the page buff
-    memset(nvr->Page, 0, NVRHeaderSize);
-    h->Preamble = PREAMBLE;
-    h->FileId = id;
-    h->FileIdInv = ~id;
-    h->DataSize = size;  
-    h->DataSizeInv = ~size; 
-    h->FileAddrPrev = nvr->FileAddrPrev;
-    h->FileAddrPrevInv = ~nvr->FileAddrPrev;
-    h->DataCRC32 = CalcCRC32(data, size, 0);
-                        
-    if ((pageFilled + NVRHeaderSize + size) > nvr->PageSize) {
-        int s = nvr->PageSize - pageFilled - NVRHeaderSize;        
-        memcpy(&nvr->Page[NVRHeaderSize], data, s);    
-        size -= s;
-        if (0 != (ret = NVRWrite(nvr, addr, nvr->Page, nvr->PageSize - pageFilled, nvr->Flags))) return ret;
-        ret = NVRWrite(nvr, addr + NVRHeaderSize + s, &data[s], size, nvr->Flags);
-        if (owf) return NVR_ERROR_END_MEM;
-        else return ret;
-    } else {
-        memcpy(&nvr->Page[NVRHeaderSize], data, size); 
-        ret = NVRWrite(nvr, addr, nvr->Page, size + NVRHeaderSize, nvr->Flags);
-        if (owf) return NVR_ERROR_END_MEM;
-        else return ret;
-    }    
+    return NVRRead(nvr, nvr->FoundFileAddr + pos + MEM_START(nvr), data, size);
 }
 
-
 /**
-  * @brief
+  * @brief  Gives the payload of the opened file in place, the CRC is checked once.
+  *         The pointer is valid until the record's sector is erased (wrap, compaction, NVREraseAll)
   * @param
-  * @retval
+  * @retval NVR_ERROR_INIT if the direct access isnt set, NVR_ERROR_ARGUMENT if the record is compressed
   */
-NVRError_t NVRCloseFile(NVRamKV_t *nvr, uint64_t id)
+NVRError_t NVRGetView(NVRamKV_t *nvr, const uint8_t **data, uint32_t *size)
 {
-    if (nvr->NotReady) return NVR_ERROR_INIT;
-    nvr->TryToOpen = nvr->FileFound = 0;
+    if ((nvr->NotReady) || (nvr->Base == 0)) return NVR_ERROR_INIT;
+    if ((nvr->FileFound == 0) || (nvr->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
+    
+    uint32_t raw;
+    NVRError_t ret = NVRFoundRaw(nvr, &raw);
+    if (ret != NVR_ERROR_NONE) return ret;
+    if ((data == 0) || (size == 0) || (raw)) return NVR_ERROR_ARGUMENT;
+    if ((NVRWriteBackHit(nvr, nvr->FoundFileAddr + MEM_START(nvr), nvr->FoundFileSize)) && (0 != (ret = NVRSync(nvr)))) return ret;   // the view is on the flash
+    
+    const uint8_t *p = &nvr->Base[nvr->FoundFileAddr];     // a record never wraps around the end of memory
+    STATS_ADD(CRCBytes, nvr->FoundFileSize);
+    if (NVRCRC32(p, nvr->FoundFileSize) != nvr->CRC32Temp) return NVR_ERROR_CRC;
+    *data = p;
+    *size = nvr->FoundFileSize;
     return NVR_ERROR_NONE;
 }
 
 /**
-  * @brief
+  * @brief  Starts reading the opened file by chunks, the stream is independent of the further opens.
+  *         A compressed record is unpacked through the window of the work buff, 
+  *         the next NVRReadFile(Raw) of a compressed record breaks the stream.
   * @param
   * @retval
   */
-NVRError_t NVREraseAll(NVRamKV_t *nvr)
-{        
-    NVRError_t ret = NVR_ERROR_NONE;
-    uint32_t addr = nvr->MemoryStartAddr;
-    uint32_t endMem = nvr->MemoryStartAddr + nvr->MemorySize;
-       
-    for (; addr < endMem; addr += nvr->SectorSize) {
-        if (0 != (ret = nvr->NVREraseSectorLL(addr))) {
-            break;
-        }
-    }  
-    nvr->FileFound = nvr->FoundFileAddr = nvr->FoundFileSize = nvr->FoundFileId = 0;
-    return ret;
+NVRError_t NVRReadBegin(NVRamKV_t *nvr, NVRReadStream_t *rs)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if ((nvr->FileFound == 0) || (nvr->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
+    if (rs == 0) return NVR_ERROR_ARGUMENT;
+    
+    uint32_t raw;
+    NVRError_t ret = NVRFoundRaw(nvr, &raw);
+    if (ret != NVR_ERROR_NONE) return ret;
+    NVRLZBegin(nvr, rs, raw);
+    return NVR_ERROR_NONE;
 }
 
-/* ----------------------------------------- Private functions -------------------------------------------------*/    
-
 /**
-  * @brief
-  * @param
-  * @retval
+  * @brief  Reads the next chunk of the file, the CRC is checked when the last byte is read
+  * @param  read: bytes actually read, less than size at the end of the file
+  * @retval NVR_ERROR_CRC if the whole file is read and it is corrupted
   */
-static NVRError_t NVRCheckHeader(NVRamKV_t *nvr, uint32_t addr, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc)
+NVRError_t NVRReadChunk(NVRamKV_t *nvr, NVRReadStream_t *rs, uint8_t *data, uint32_t size, uint32_t *read)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if ((rs == 0) || (data == 0) || (read == 0)) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret;
+    *read = 0;
+    if (rs->Raw) {
+        if (size > rs->Raw - rs->Out) size = rs->Raw - rs->Out;
+        if (size == 0) return NVR_ERROR_NONE;
+        if (0 != (ret = NVRLZDecode(nvr, rs, data, size))) return ret;
+        *read = size;
+        return (rs->Out == rs->Raw) ? NVRReadFinish(nvr, rs) : NVR_ERROR_NONE;
+    }
+    if (size > rs->Size - rs->Pos) size = rs->Size - rs->Pos;
+    if (size == 0) return NVR_ERROR_NONE;
+    
+    if (0 != (ret = NVRRead(nvr, rs->Addr + rs->Pos + MEM_START(nvr), data, size))) return ret;
+    rs->CRC32 = NVRCRC32Update(rs->CRC32, data, size);
+    STATS_ADD(CRCBytes, size);
+    rs->Pos += size;
+    *read = size;
+    
+    if ((rs->Pos == rs->Size) && (NVRCRC32Final(rs->CRC32) != rs->CRC32Expected)) return NVR_ERROR_CRC;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief  Checks the CRC of the file, the rest which has not been read by chunks is read through the page buff
+  * @param
+  * @retval
+  */
+NVRError_t NVRReadFinish(NVRamKV_t *nvr, NVRReadStream_t *rs)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (rs == 0) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret;
+    while (rs->Pos < rs->Size) {
+        uint32_t chunkSize = (rs->Size - rs->Pos > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : rs->Size - rs->Pos;
+        if (0 != (ret = NVRRead(nvr, rs->Addr + rs->Pos + MEM_START(nvr), nvr->Page, chunkSize))) return ret;
+        rs->CRC32 = NVRCRC32Update(rs->CRC32, nvr->Page, chunkSize);
+        STATS_ADD(CRCBytes, chunkSize);
+        rs->Pos += chunkSize;
+    }
+    if (NVRCRC32Final(rs->CRC32) != rs->CRC32Expected) return NVR_ERROR_CRC;
+    return NVR_ERROR_NONE;
+}
+
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+NVRError_t NVRWriteFile(NVRamKV_t *nvr, uint64_t id, uint8_t *data, uint32_t size)
+{
+    NVRIOVec_t iov;
+    iov.Data = data;
+    iov.Size = size;
+    return NVRWriteFileV(nvr, id, &iov, 1);
+}
+
+/**
+  * @brief      Writes a file gathered from several fragments, e.g. a struct header and a body.
+  *             The fragments are programmed directly by NVRWriteDataVLL if it is set, 
+  *             otherwise only the pages made up of several fragments are copied to the page buff.
+  * @param      iovCnt: up to NVR_IOV_MAX - 1, one is taken by the header
+  * @retval
+  */
+NVRError_t NVRWriteFileV(NVRamKV_t *nvr, uint64_t id, const NVRIOVec_t *iov, uint32_t iovCnt)
+{
+    WRITE_LOCK();
+    STATS_START();
+    NVRError_t ret = NVRWriteFileVLocked(nvr, id, iov, iovCnt);
+    STATS_STOP(NVR_STATS_WRITE);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+
+/**
+  * @brief      Appends the records back to back assembling whole pages in the page buff,
+  *             so every page is programmed once. The prev chain is kept as NVRWriteFile does.
+  * @param      written: number of the records programmed completely, the rest are lost on an error
+  * @retval     NVR_ERROR_END_MEM if the memory wrapped around like NVRWriteFile does
+  */
+NVRError_t NVRWriteBatch(NVRamKV_t *nvr, const NVRRecord_t *recs, uint32_t count, uint32_t *written)
+{
+    WRITE_LOCK();
+    STATS_START();
+    NVRError_t ret = NVRWriteBatchLocked(nvr, recs, count, written);
+    STATS_STOP(NVR_STATS_WRITE);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Appends a tombstone, a header with no payload: the lookups, the index and the iterators 
+  *             take the id as absent until it is written again, the compaction doesnt keep it. 
+  *             A record of size 0 written any other way is a tombstone too. Without the RAM index 
+  *             NVR_OPEN_FLAGS_FIRST_MATCH may still open an older copy written before the tombstone.
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND if the RAM index has no such id, nothing is written
+  */
+NVRError_t NVRDeleteFile(NVRamKV_t *nvr, uint64_t id)
+{
+    NVRIOVec_t iov;
+    NVRError_t ret;
+    iov.Data = 0;
+    iov.Size = 0;
+    WRITE_LOCK();
+    STATS_START();
+    if ((nvr->NotReady == 0) && (nvr->Index) && (NVRDeleted(nvr, id, 1))) ret = NVR_ERROR_NOT_FOUND;
+    else ret = NVRWriteFileVLocked(nvr, id, &iov, 1);
+    STATS_STOP(NVR_STATS_WRITE);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Streams the live records as a snapshot: the header, then a frame and the payload as stored per record
+  *             in the write order, then the trailer. The memory is read along the ring in blocks of bufSize, 
+  *             the RAM index tells the latest version of an id, the stale records and the tombstones are left out.
+  *             The writers wait until it ends.
+  * @param      buf: read-ahead, at least PageSize bytes, not used if the store is memory mapped
+  * @param      count: number of the records streamed
+  * @retval     NVR_ERROR_INIT if there is no RAM index, NVR_ERROR_HW if the LL or write fails
+  */
+NVRError_t NVRExport(NVRamKV_t *nvr, NVRStreamWrite_t write, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRExportLocked(nvr, write, ctx, buf, bufSize, count);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Appends the records of a snapshot of NVRExport back to back, whole pages are programmed as NVRWriteBatch does.
+  *             The head has to be opened as for a write. A broken frame ends the import, the records before it are kept,
+  *             a record torn by the stream is padded and its id is deleted by a tombstone behind it.
+  * @param      buf: the payload is read through it in pieces of bufSize
+  * @param      count: number of the records imported
+  * @retval     NVR_ERROR_HEADER if the stream is not a snapshot or a frame is broken, NVR_ERROR_CRC if a payload is,
+  *             NVR_ERROR_HW if read fails, NVR_ERROR_END_MEM if the memory wrapped around
+  */
+NVRError_t NVRImport(NVRamKV_t *nvr, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRImportLocked(nvr, read, ctx, buf, bufSize, count);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+
+/**
+  * @brief      Sets the asynchronous driver. The async jobs dont wait for the flash, 
+  *             the sectors are erased ahead of the programs and up to depth requests are queued.
+  * @param      queue: caller's memory for depth requests
+  * @retval
+  */
+NVRError_t NVRAsyncInit(NVRamKV_t *nvr, const NVRAsyncLL_t *ll, NVRAsyncReq_t *queue, uint32_t depth)
+{
+    if ((ll == 0) || (ll->Submit == 0) || (queue == 0) || (depth == 0)) return NVR_ERROR_INIT;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    
+    memset(&nvr->Async, 0, sizeof(NVRAsync_t));
+    memset(queue, 0, depth * sizeof(NVRAsyncReq_t));
+    nvr->Async.LL = ll;
+    nvr->Async.Queue = queue;
+    nvr->Async.Depth = depth;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Starts writing a file like NVRWriteFile does, NVRAsyncPoll completes the job. 
+  *             The data and the page buff must be kept until then.
+  * @param
+  * @retval     NVR_ERROR_BUSY if a job is in progress
+  */
+NVRError_t NVRAsyncWriteFile(NVRamKV_t *nvr, uint64_t id, const uint8_t *data, uint32_t size)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRAsyncWriteFileLocked(nvr, id, data, size);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Starts reading the whole opened file, NVRAsyncPoll checks the CRC at the end.
+  *             A compressed record is not unpacked, NVRReadFile does it.
+  * @param
+  * @retval     NVR_ERROR_BUSY if a job is in progress, NVR_ERROR_ARGUMENT if the record is compressed
+  */
+NVRError_t NVRAsyncReadFile(NVRamKV_t *nvr, uint8_t *data)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRAsyncReadFileLocked(nvr, data);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Advances the current job: collects the finished requests and queues the next ones
+  * @param
+  * @retval     NVR_ERROR_BUSY while the job is in progress, then the result of the job once
+  */
+NVRError_t NVRAsyncPoll(NVRamKV_t *nvr)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRAsyncPollLocked(nvr);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Called by the driver when a request is finished, may be called from an interrupt
+  * @param      status: 0 if OK
+  * @retval
+  */
+void NVRAsyncComplete(NVRAsyncReq_t *req, int32_t status)
+{
+    req->Status = status;
+    req->Busy = 0;
+}
+
+/**
+  * @brief      Sets how many sectors NVRMaintenance erases ahead of the write head, so the writes
+  *             only program pages. The records in these sectors are lost earlier than they would be.
+  * @param      sectors: 0 - the sectors are erased by the writes as they are reached, a record that ends 
+  *             right before a sector has it erased as well
+  * @retval
+  */
+NVRError_t NVRSetEraseReserve(NVRamKV_t *nvr, uint32_t sectors)
+{
+    if (sectors + 1 >= MEM_SIZE(nvr) / SECTOR_SIZE(nvr)) return NVR_ERROR_ARGUMENT;   // the sector of the head is kept
+    nvr->EraseReserve = sectors;
+    if (nvr->ErasedCount > sectors) nvr->ErasedCount = sectors;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Idle hook: erases the sectors ahead of the write head up to the reserve.
+  *             The head is known after NVRMount, NVROpenFile with NVR_OPEN_FLAGS_MAX_ID or a write.
+  *             With NVR_FLAGS_COMPACT the live records of the next sector to erase are moved 
+  *             to the head first, also when the reserve is complete.
+  * @param      maxSectors: bounds the time of the call
+  * @retval     NVR_ERROR_BUSY if the reserve is not complete yet, NVR_ERROR_FULL if there is no room to move the live records
+  */
+NVRError_t NVRMaintenance(NVRamKV_t *nvr, uint32_t maxSectors)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRMaintenanceLocked(nvr, maxSectors);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Sets the area checkpoints are written to. A checkpoint holds the last written record 
+  *             and a copy of the index if it is not larger than half of the area. It is written
+  *             every interval sectors of records, so NVRMount scans only that much memory.
+  * @param      addr: absolute addr of the area, outside of the memory of the records
+  * @param      size: 2 sectors at least
+  * @retval
+  */
+NVRError_t NVRCheckpointInit(NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint32_t interval)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if ((addr % SECTOR_SIZE(nvr)) || (size % SECTOR_SIZE(nvr)) || (size < 2 * SECTOR_SIZE(nvr))) return NVR_ERROR_ARGUMENT;
+    if ((addr < MEM_START(nvr) + MEM_SIZE(nvr)) && (MEM_START(nvr) < addr + size)) return NVR_ERROR_ARGUMENT;
+    if ((interval == 0) || (interval * SECTOR_SIZE(nvr) > MEM_SIZE(nvr) / 2)) return NVR_ERROR_ARGUMENT;   // the head of the checkpoint must not be overwritten before the next one
+    
+    NVRCheckpoint_t c;
+    uint32_t pos;
+    nvr->CheckpointAddr = addr;
+    nvr->CheckpointSize = size;
+    nvr->CheckpointInterval = interval;
+    nvr->CheckpointHead = nvr->HeadEnd;
+    NVRCheckpointFind(nvr, &c, &pos);   // continues behind the newest one
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Writes a checkpoint now, e.g. before power off
+  * @param
+  * @retval
+  */
+NVRError_t NVRCheckpoint(NVRamKV_t *nvr)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRCheckpointLocked(nvr);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Sets the per sector summaries: min/max id and a Bloom filter of the ids whose header 
+  *             is in the sector. NVRMount builds them, the writes keep them up to date. An exact id
+  *             scan skips the sectors that cant hold the id, it matters without the index.
+  * @param      summary: caller's memory for a summary per sector
+  * @retval
+  */
+NVRError_t NVRSummaryInit(NVRamKV_t *nvr, NVRSummary_t *summary, uint32_t count)
+{
+    if ((summary) && (count < (MEM_SIZE(nvr) + SECTOR_SIZE(nvr) - 1) / SECTOR_SIZE(nvr))) return NVR_ERROR_ARGUMENT;
+    nvr->Summary = summary;
+    nvr->SummaryValid = nvr->SummaryLive = 0;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the cache of NVR_OPEN_FLAGS_PREVIOUS: the headers written or read backward in blocks 
+  *             are kept decoded, a step back along FileAddrPrev is served from there. The cursors dont use it.
+  * @param      ring: caller's memory for count headers, 0 - off
+  * @param      block: the flash is read backward by blockSize bytes, at least PageSize
+  * @retval
+  */
+NVRError_t NVRHeaderCacheInit(NVRamKV_t *nvr, NVRIndexEntry_t *ring, uint32_t count, uint8_t *block, uint32_t blockSize)
+{
+    memset(&nvr->HeaderCache, 0, sizeof(NVRHeaderCache_t));
+    if (ring == 0) return NVR_ERROR_NONE;
+    if ((count == 0) || (NVR_ERROR_NONE != NVRIterInit(nvr, &nvr->HeaderCache.Block, block, blockSize))) return NVR_ERROR_ARGUMENT;
+    memset(ring, 0, count * sizeof(NVRIndexEntry_t));
+    nvr->HeaderCache.Ring = ring;
+    nvr->HeaderCache.Count = count;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the compression of the records written by NVRWriteFile and NVRWriteFileV of one fragment:
+  *             a record is stored compressed if it gets smaller and fits in the work buff, DataSize is flagged then
+  *             and the CRC covers the stored bytes. NVROpenFile gives the unpacked size, NVRReadFile(Raw) 
+  *             and the streams unpack on the fly through the window, so one compressed stream at a time.
+  *             The batch and the async writes store the records as is. The cursors, the iterators and 
+  *             NVRAsyncReadFile return NVR_ERROR_ARGUMENT for a compressed record, a store without 
+  *             the work buff gives the stored bytes.
+  * @param      work: caller's memory of more than NVR_LZ_WORK_MIN bytes aligned to 4, 0 - off
+  * @retval
+  */
+NVRError_t NVRCompressInit(NVRamKV_t *nvr, uint8_t *work, uint32_t size)
+{
+    if ((work) && ((size <= NVR_LZ_WORK_MIN) || ((uintptr_t)work & 3))) return NVR_ERROR_ARGUMENT;
+    nvr->LZWork = work;
+    nvr->LZWorkSize = (work) ? size : 0;
+    nvr->FoundFileRawAddr = 0;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the write-back of NVRWriteFile(V): the records are put in the page buff and the page is programmed 
+  *             when it is full, by NVRSync or when the oldest record has waited timeout ticks. The reads and the scans 
+  *             see the records not programmed yet, the batch, the async jobs, the mount, the maintenance and 
+  *             the checkpoints program them first. They are lost on a power failure, a record over a page 
+  *             is programmed whole once its first page is.
+  * @param      buf: caller's memory of PageSize bytes, 0 - off, the buffered records are programmed
+  * @param      clock: 0 - no timeout
+  * @param      timeout: checked by the writes and NVRWriteBackPoll, 0 - none
+  * @retval
+  */
+NVRError_t NVRWriteBackInit(NVRamKV_t *nvr, uint8_t *buf, NVRClock_t clock, uint32_t timeout)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVRWriteBackSync(nvr);
+    if (ret == NVR_ERROR_NONE) {
+        memset(&nvr->WriteBack, 0, sizeof(NVRPageBuf_t));
+        nvr->WriteBack.Buf = buf;
+        nvr->WriteBack.EraseAhead = 1;      // the flash behind the buffered records reads erased
+        nvr->WriteBackClock = clock;
+        nvr->WriteBackTimeout = timeout;
+    }
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      The timeout hook, called from a timer or the idle loop: programs the buffered records 
+  *             if the oldest one has waited the timeout
+  * @param
+  * @retval
+  */
+NVRError_t NVRWriteBackPoll(NVRamKV_t *nvr)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (0 == NVRWriteBackDue(nvr)) return NVR_ERROR_NONE;
+    WRITE_LOCK();
+    NVRError_t ret = (NVRWriteBackDue(nvr)) ? NVRWriteBackSync(nvr) : NVR_ERROR_NONE;
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Programs the records held by the write-back
+  * @param
+  * @retval
+  */
+NVRError_t NVRSync(NVRamKV_t *nvr)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    WRITE_LOCK();
+    NVRError_t ret = NVRWriteBackSync(nvr);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/**
+  * @brief      Sets the read cache of count pages between the scans, the reads and NVRReadDataLL, 
+  *             the least recently used page is evicted. The writes and the erases of the store drop 
+  *             the pages they touch, a flash changed by others needs NVRPageCacheInit again. 
+  *             Not used with NVRInitLock as the readers would share the slots.
+  * @param      cache: caller's memory, Hits and Misses help to size it, 0 - off
+  * @param      slots: count slots
+  * @param      pages: count * PageSize bytes
+  * @retval
+  */
+NVRError_t NVRPageCacheInit(NVRamKV_t *nvr, NVRPageCache_t *cache, NVRCacheSlot_t *slots, uint8_t *pages, uint32_t count)
+{
+    uint32_t i;
+    if ((cache) && ((slots == 0) || (pages == 0) || (count == 0))) return NVR_ERROR_ARGUMENT;
+    nvr->Cache = cache;
+    if (cache == 0) return NVR_ERROR_NONE;
+    
+    memset(cache, 0, sizeof(NVRPageCache_t));
+    for (i = 0; i < count; i++) {
+        slots[i].Addr = NVR_CACHE_FREE;
+        slots[i].Used = 0;
+    }
+    cache->Slots = slots;
+    cache->Pages = pages;
+    cache->Count = count;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Sets the counters and the latency histograms, NVR_STATS must be defined.
+  *             With the cursors of several threads the counters are approximate.
+  * @param      stats: caller's memory, 0 - off
+  * @param      clock: ticks of the latencies, 0 - just the counters
+  * @retval     NVR_ERROR_INIT if compiled without NVR_STATS
+  */
+NVRError_t NVRStatsInit(NVRamKV_t *nvr, NVRStats_t *stats, NVRClock_t clock)
+{
+#ifdef NVR_STATS
+    if (stats) memset(stats, 0, sizeof(NVRStats_t));
+    nvr->Clock = clock;
+    nvr->Stats = stats;
+    return NVR_ERROR_NONE;
+#else
+    (void)nvr; (void)stats; (void)clock;
+    return NVR_ERROR_INIT;
+#endif
+}
+
+/**
+  * @brief      Copies the counters
+  * @param
+  * @retval
+  */
+NVRError_t NVRStatsGet(const NVRamKV_t *nvr, NVRStats_t *snapshot)
+{
+#ifdef NVR_STATS
+    if (nvr->Stats == 0) return NVR_ERROR_INIT;
+    if (snapshot == 0) return NVR_ERROR_ARGUMENT;
+    memcpy(snapshot, nvr->Stats, sizeof(NVRStats_t));
+    return NVR_ERROR_NONE;
+#else
+    (void)nvr; (void)snapshot;
+    return NVR_ERROR_INIT;
+#endif
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+NVRError_t NVRStatsReset(NVRamKV_t *nvr)
+{
+#ifdef NVR_STATS
+    if (nvr->Stats == 0) return NVR_ERROR_INIT;
+    memset(nvr->Stats, 0, sizeof(NVRStats_t));
+    return NVR_ERROR_NONE;
+#else
+    (void)nvr;
+    return NVR_ERROR_INIT;
+#endif
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+NVRError_t NVRCloseFile(NVRamKV_t *nvr, uint64_t id)
+{
+    (void)id;
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    nvr->TryToOpen = nvr->FileFound = 0;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+NVRError_t NVREraseAll(NVRamKV_t *nvr)
+{
+    WRITE_LOCK();
+    NVRError_t ret = NVREraseAllLocked(nvr);
+    WRITE_UNLOCK();
+    return ret;
+}
+
+/* ----------------------------------------- Private functions -------------------------------------------------*/    
+
+/**
+  * @brief      NVRMount with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRMountLocked(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (((index == 0) || (capacity == 0)) && ((index) || ((nvr->CheckpointSize == 0) && (nvr->Summary == 0)))) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret;
+    uint32_t start = MEM_START(nvr), end = MEM_START(nvr) + MEM_SIZE(nvr);
+    uint32_t addr, addrPrev, s, crc, count = 0;
+    uint32_t contiguous = 0, headFound = 0;
+    uint64_t fileId;
+    NVRIndexEntry_t head, e;
+    
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;
+    nvr->Index = 0;     // nothing is served from the index while it is being built
+    nvr->SummaryValid = nvr->SummaryLive = 0;
+    if ((nvr->CheckpointSize) && ((index) || (nvr->Summary == 0)) && (NVRCheckpointLoad(nvr, index, capacity) == NVR_ERROR_NONE)) {
+        if (nvr->Summary) {     // from the live records, the checkpoint has no more
+            NVRSummaryReset(nvr);
+            for (count = 0; count < nvr->IndexCount; count++) NVRSummaryAdd(nvr, &nvr->Index[count]);
+            nvr->SummaryValid = nvr->SummaryLive = 1;
+        }
+        return NVR_ERROR_NONE;
+    }
+    
+    NVRSummaryReset(nvr);
+    memset(&head, 0, sizeof(head));
+    if (index) {
+        nvr->IndexCapacity = capacity;
+        nvr->IndexCount = 0;
+    }
+    while (start < end) {
+        ret = NVRCheckHeader(nvr, nvr->Page, start, &addr, &addrPrev, &fileId, &s, &crc);
+        if (ret == NVR_ERROR_NONE) {
+            e.Id = fileId;
+            e.Addr = addr + HEADER_SIZE(nvr) - MEM_START(nvr);
+            e.Size = s - HEADER_SIZE(nvr);
+            e.CRC32 = crc;
+            e.AddrPrev = addrPrev;
+            NVRSummaryAdd(nvr, &e);
+            count++;
+            if ((headFound == 0) && (count > 1) && (contiguous) && ((addr != start) || (addrPrev != head.Addr))) {
+                headFound = 1;  // the header is not where the write behind the previous record puts it or the prev chain is broken: the previous record is the last written one
+            }
+            if (headFound == 0) head = e;
+            if ((index) && (NVR_ERROR_NONE != (ret = NVRIndexScanAdd(nvr, index, &e, (headFound) ? head.Addr : 0)))) return ret;
+            contiguous = 1;
+            start = addr + s;       // where NVRNextFileAddr puts the next record, a tombstone is followed right behind its header
+            uint32_t pageFilled = start % PAGE_SIZE(nvr);
+            if ((pageFilled && (nvr->Flags & NVR_FLAGS_PAGE_ALIGN)) || (PAGE_SIZE(nvr) - pageFilled < HEADER_SIZE(nvr))) start += PAGE_SIZE(nvr) - pageFilled;
+        } else if (ret == NVR_ERROR_EMPTY) {
+            if (count) headFound = 1;   // the free space behind the last written record
+            contiguous = 0;
+            start += SECTOR_SIZE(nvr) - (start % SECTOR_SIZE(nvr));   // sectors are filled sequentially, the rest of this one is empty
+        } else if (ret == NVR_ERROR_HEADER) {
+            if (contiguous) headFound = 1;      // no record behind the last one, the old data of the next sector follows
+            contiguous = 0;
+            start += PAGE_SIZE(nvr);
+        } else if (ret == NVR_ERROR_END_MEM) {
+            break;
+        } else {
+            return ret;
+        }
+    }
+    
+    if (index) {
+        nvr->Index = index;
+        NVRIndexPurge(nvr);
+    }
+    NVRMountHead(nvr, &head);
+    nvr->CheckpointHead = nvr->HeadEnd;
+    nvr->SummaryValid = (nvr->Summary != 0);
+    
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRWriteFileV with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRWriteFileVLocked(NVRamKV_t *nvr, uint64_t id, const NVRIOVec_t *iov, uint32_t iovCnt)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
+    if ((iov == 0) || (iovCnt == 0) || (iovCnt >= NVR_IOV_MAX)) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret = NVR_ERROR_NONE;
+    NVRIOVec_t v[NVR_IOV_MAX], packed;
+    NVRHeader_t h;
+    uint8_t hb[sizeof(NVRHeader_t)];
+    uint32_t i, owf, size = 0, raw = 0, crc = NVRCRC32Init();
+    if ((nvr->LZWork) && (iovCnt == 1) && (iov[0].Data) && (0 != (packed.Size = NVRLZCompress(nvr, iov[0].Data, iov[0].Size)))) {
+        packed.Data = LZ_OUT(nvr);      // the compressed record is stored instead
+        raw = iov[0].Size;
+        iov = &packed;
+    }
+    for (i = 0; i < iovCnt; i++) {
+        if ((iov[i].Data == 0) && (iov[i].Size)) return NVR_ERROR_ARGUMENT;
+        crc = NVRCRC32Update(crc, iov[i].Data, iov[i].Size);
+        STATS_ADD(CRCBytes, iov[i].Size);
+        size += iov[i].Size;
+        v[i + 1] = iov[i];
+    }
+    if (0 == HEADER_SIZE_FITS(nvr, size)) return NVR_ERROR_ARGUMENT;
+    if ((nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index) && (0 != (ret = NVRCompactFor(nvr, size)))) return ret;
+    
+    uint32_t addr = NVRNextFileAddr(nvr, size, &owf);
+    NVRIndexEntry_t e;
+    NVRMakeHeader(nvr, &h, &e, id, addr, size, NVRCRC32Final(crc));
+    if (raw) {
+        h.DataSize |= SIZE_LZ;
+        h.DataSizeInv = ~h.DataSize;
+        nvr->FoundFileRaw = raw;
+        nvr->FoundFileRawAddr = nvr->FoundFileAddr;
+    }
+    v[0].Data = hb;
+    v[0].Size = NVRHeaderPack(nvr, &h, hb);
+    
+    addr += MEM_START(nvr);       // make absolute addr        
+    if (nvr->Index) NVRIndexDrop(nvr, addr, HEADER_SIZE(nvr) + size);    // records in the sectors to be erased are lost
+    NVRSummaryDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    NVRHeaderCacheDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    
+    if (0 != (ret = NVREraseAhead(nvr, &e, 0))) return ret;
+    if (nvr->WriteBack.Buf) ret = NVRWriteBackPut(nvr, addr, v, iovCnt + 1);
+    else ret = NVRWrite(nvr, addr, v, iovCnt + 1);
+    if (ret == NVR_ERROR_NONE) {
+        if (nvr->Index) NVRIndexInsert(nvr, &e);
+        nvr->IndexHead = e;
+        NVRSummaryAdd(nvr, &e);
+        NVRHeaderCachePut(nvr, &e);
+        NVRCheckpointTick(nvr);
+    }
+    if (owf) return NVR_ERROR_END_MEM;
+    else return ret;
+}
+
+/**
+  * @brief      NVRWriteBatch with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRWriteBatchLocked(NVRamKV_t *nvr, const NVRRecord_t *recs, uint32_t count, uint32_t *written)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
+    if ((recs == 0) || (written == 0)) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret = NVR_ERROR_NONE;
+    NVRPageBuf_t pb;
+    NVRHeader_t h;
+    NVRIndexEntry_t e;
+    uint8_t hb[sizeof(NVRHeader_t)];
+    uint32_t i, owf, wrapped = 0;
+    
+    *written = 0;
+    for (i = 0; i < count; i++) {
+        if ((recs[i].Data == 0) && (recs[i].Size)) return NVR_ERROR_ARGUMENT;
+        if (0 == HEADER_SIZE_FITS(nvr, recs[i].Size)) return NVR_ERROR_ARGUMENT;
+    }
+    
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;     // the batch assembles its own pages
+    pb.Buf = nvr->Page;
+    pb.PageAddr = pb.Start = pb.Fill = 0;
+    pb.Complete = pb.Durable = 0;
+    pb.EraseAhead = 0;
+    for (i = 0; (i < count) && (ret == NVR_ERROR_NONE); i++) {
+        if ((nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index)) {
+            uint32_t sector;
+            if ((NVRLiveSector(nvr, NVRNextFileAddr(nvr, recs[i].Size, &owf), recs[i].Size, 1, &sector)) && 
+                ((0 != (ret = NVRPageFlush(nvr, &pb))) || (0 != (ret = NVRCompactFor(nvr, recs[i].Size))))) break;    // the relocations use the page buff too
+        }
+        uint32_t addr = NVRNextFileAddr(nvr, recs[i].Size, &owf);
+        NVRMakeHeader(nvr, &h, &e, recs[i].Id, addr, recs[i].Size, NVRCRC32(recs[i].Data, recs[i].Size));
+        STATS_ADD(CRCBytes, recs[i].Size);
+        wrapped |= owf;
+        addr += MEM_START(nvr);
+        if (nvr->Index) NVRIndexDrop(nvr, addr, HEADER_SIZE(nvr) + recs[i].Size);
+        NVRSummaryDrop(nvr, addr, HEADER_SIZE(nvr) + recs[i].Size);
+        NVRHeaderCacheDrop(nvr, addr, HEADER_SIZE(nvr) + recs[i].Size);
+        if ((0 == (ret = NVREraseAhead(nvr, &e, 0))) && (0 == (ret = NVRPageAppend(nvr, &pb, addr, hb, NVRHeaderPack(nvr, &h, hb), 0)))) {
+            ret = NVRPageAppend(nvr, &pb, addr + HEADER_SIZE(nvr), recs[i].Data, recs[i].Size, 0);
+        }
+        if (ret == NVR_ERROR_NONE) {
+            pb.Complete++;
+            if (nvr->Index) NVRIndexInsert(nvr, &e);
+            nvr->IndexHead = e;
+            NVRSummaryAdd(nvr, &e);     // a summary may hold a lost record, never miss a written one
+            NVRHeaderCachePut(nvr, &e);
+        }
+    }
+    if (ret == NVR_ERROR_NONE) ret = NVRPageFlush(nvr, &pb);
+    if ((ret != NVR_ERROR_NONE) && (pb.Durable < pb.Complete)) nvr->Index = 0;     // the index refers to the lost records
+    *written = pb.Durable;
+    if (ret == NVR_ERROR_NONE) NVRCheckpointTick(nvr);
+    
+    if ((ret == NVR_ERROR_NONE) && (wrapped)) return NVR_ERROR_END_MEM;
+    return ret;
+}
+
+/**
+  * @brief      NVRExport with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRExportLocked(NVRamKV_t *nvr, NVRStreamWrite_t write, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count)
+{
+    if (count) *count = 0;
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if ((write == 0) || (buf == 0) || (bufSize < PAGE_SIZE(nvr)) || (count == 0)) return NVR_ERROR_ARGUMENT;
+    if ((nvr->Index == 0) || (nvr->HeadKnown == 0)) return NVR_ERROR_INIT;     // the index tells the latest versions
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    
+    NVRError_t ret;
+    NVRIter_t it;
+    NVRSnapshotHeader_t sh;
+    NVRSnapshotFrame_t f;
+    uint32_t i, start, from = 0, first = MEM_SIZE(nvr);
+    
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;
+    memset(&it, 0, sizeof(NVRIter_t));
+    it.Buf = buf;
+    it.BufSize = bufSize - bufSize % PAGE_SIZE(nvr);
+    
+    sh.Magic = NVR_SNAPSHOT_MAGIC;
+    sh.Version = NVR_SNAPSHOT_VERSION;
+    sh.FrameSize = sizeof(NVRSnapshotFrame_t);
+    sh.CRC32 = NVRCRC32((const uint8_t *)&sh, sizeof(sh) - sizeof(sh.CRC32));
+    if (0 != write(ctx, (const uint8_t *)&sh, sizeof(sh))) return NVR_ERROR_HW;
+    
+    if (nvr->HeadEnd) from = ((nvr->HeadEnd - 1) / SECTOR_SIZE(nvr) + 1) * SECTOR_SIZE(nvr);     // the oldest sector follows the head one
+    if (from >= MEM_SIZE(nvr)) from = 0;
+    for (i = 0; i < nvr->IndexCount; i++) {     // the oldest live record, the blocks before it are not read
+        uint32_t k = (nvr->Index[i].Addr - HEADER_SIZE(nvr) + MEM_SIZE(nvr) - from) % MEM_SIZE(nvr);
+        if (k < first) first = k;
+    }
+    if (nvr->IndexCount) {
+        start = (from + first) % MEM_SIZE(nvr);
+        if ((from) && (start >= from)) {
+            if (0 != (ret = NVRExportRange(nvr, &it, start, MEM_SIZE(nvr), write, ctx, count))) return ret;
+            start = 0;
+        }
+        if (0 != (ret = NVRExportRange(nvr, &it, start, nvr->HeadEnd, write, ctx, count))) return ret;
+    }
+    
+    memset(&f, 0, sizeof(f));
+    f.Id = *count;
+    f.Size = NVR_SNAPSHOT_END;
+    f.CRC32 = NVRCRC32((const uint8_t *)&f, sizeof(f) - sizeof(f.CRC32));
+    if (0 != write(ctx, (const uint8_t *)&f, sizeof(f))) return NVR_ERROR_HW;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Streams the records in [start, end) the index has as the latest versions, the headers are looked for 
+  *             as NVRMount does. The payload is passed from the read-ahead.
+  * @param      start: relative addr
+  * @retval
+  */
+static NVRError_t NVRExportRange(NVRamKV_t *nvr, NVRIter_t *it, uint32_t start, uint32_t end, NVRStreamWrite_t write, void *ctx, uint32_t *count)
+{
+    NVRError_t ret;
+    NVRSnapshotFrame_t f;
+    NVRHeader_t h;
+    uint32_t addr, addrPrev, s, crc, i, pos, n;
+    uint64_t fileId;
+    
+    while ((start < end) && (*count < nvr->IndexCount)) {
+        uint32_t len = (MEM_SIZE(nvr) - start > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : MEM_SIZE(nvr) - start;
+        if (len < HEADER_SIZE(nvr)) break;
+        const uint8_t *b = NVRIterFetch(nvr, it, start, len, 0);
+        if (b == 0) return NVR_ERROR_HW;
+        ret = NVRFindHeader(nvr, b, start + MEM_START(nvr), len, &addr, &addrPrev, &fileId, &s, &crc);
+        if (ret == NVR_ERROR_EMPTY) {
+            start += SECTOR_SIZE(nvr) - (start % SECTOR_SIZE(nvr));     // the rest of the sector is empty
+            continue;
+        }
+        if (ret != NVR_ERROR_NONE) {
+            start += PAGE_SIZE(nvr);
+            continue;
+        }
+        addr -= MEM_START(nvr);
+        i = NVRIndexFind(nvr, fileId);
+        if ((i < nvr->IndexCount) && (nvr->Index[i].Id == fileId) && (nvr->Index[i].Addr == addr + HEADER_SIZE(nvr))) {
+            NVRHeaderParse(nvr, &b[addr - start], &h);
+            memset(&f, 0, sizeof(f));
+            f.Id = fileId;
+            f.Size = (h.DataSize & ~SIZE_LZ) | ((h.DataSize & SIZE_LZ) ? NVR_SNAPSHOT_LZ : 0);
+            f.DataCRC32 = crc;
+            f.CRC32 = NVRCRC32((const uint8_t *)&f, sizeof(f) - sizeof(f.CRC32));
+            if (0 != write(ctx, (const uint8_t *)&f, sizeof(f))) return NVR_ERROR_HW;
+            for (pos = 0; pos < s - HEADER_SIZE(nvr); pos += n) {
+                uint32_t from = addr + HEADER_SIZE(nvr) + pos, left = it->BufSize - from % PAGE_SIZE(nvr);
+                if ((it->BufLen) && (from >= it->BufAddr) && (from < it->BufAddr + it->BufLen)) left = it->BufAddr + it->BufLen - from;     // the rest of the block first, every page is read once
+                n = s - HEADER_SIZE(nvr) - pos;
+                if (n > left) n = left;
+                if (0 == (b = NVRIterFetch(nvr, it, from, n, 0))) return NVR_ERROR_HW;
+                if (0 != write(ctx, b, n)) return NVR_ERROR_HW;
+            }
+            (*count)++;
+        }
+        start = addr + s;
+        if (nvr->Flags & NVR_FLAGS_PAGE_ALIGN) {
+            uint32_t pageFilled = start % PAGE_SIZE(nvr);
+            if (pageFilled) start += PAGE_SIZE(nvr) - pageFilled;
+        }
+    }
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRImport with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRImportLocked(NVRamKV_t *nvr, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count)
+{
+    if (count) *count = 0;
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
+    if ((read == 0) || (buf == 0) || (bufSize == 0) || (count == 0)) return NVR_ERROR_ARGUMENT;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    
+    NVRError_t ret = NVR_ERROR_NONE, fail = NVR_ERROR_NONE;
+    NVRSnapshotHeader_t sh;
+    NVRSnapshotFrame_t f;
+    NVRPageBuf_t pb;
+    uint32_t wrapped = 0;
+    
+    if (0 != read(ctx, (uint8_t *)&sh, sizeof(sh))) return NVR_ERROR_HW;
+    if ((sh.Magic != NVR_SNAPSHOT_MAGIC) || (sh.CRC32 != NVRCRC32((const uint8_t *)&sh, sizeof(sh) - sizeof(sh.CRC32))) ||
+        (sh.Version != NVR_SNAPSHOT_VERSION) || (sh.FrameSize != sizeof(NVRSnapshotFrame_t))) return NVR_ERROR_HEADER;
+    
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;     // the import assembles its own pages
+    pb.Buf = nvr->Page;
+    pb.PageAddr = pb.Start = pb.Fill = 0;
+    pb.Complete = pb.Durable = 0;
+    pb.EraseAhead = 0;
+    while ((ret == NVR_ERROR_NONE) && (fail == NVR_ERROR_NONE)) {
+        if (0 != read(ctx, (uint8_t *)&f, sizeof(f))) {
+            fail = NVR_ERROR_HW;
+        } else if (f.CRC32 != NVRCRC32((const uint8_t *)&f, sizeof(f) - sizeof(f.CRC32))) {
+            fail = NVR_ERROR_HEADER;
+        } else if (f.Size == NVR_SNAPSHOT_END) {
+            if (f.Id != *count) fail = NVR_ERROR_HEADER;     // frames are missing
+            break;
+        } else if ((0 == (ret = NVRImportRecord(nvr, &pb, read, ctx, buf, bufSize, &f, &fail, &wrapped))) && (fail == NVR_ERROR_NONE)) {
+            (*count)++;
+        }
+    }
+    if (ret == NVR_ERROR_NONE) ret = NVRPageFlush(nvr, &pb);    // the records before a broken frame are kept
+    if ((ret != NVR_ERROR_NONE) && (pb.Durable < pb.Complete)) {
+        nvr->Index = 0;     // the index refers to the lost records
+        if (*count > pb.Durable) *count = pb.Durable;
+    }
+    if ((ret == NVR_ERROR_NONE) && (pb.Complete)) NVRCheckpointTick(nvr);
+    
+    if (ret == NVR_ERROR_NONE) ret = fail;
+    if ((ret == NVR_ERROR_NONE) && (wrapped)) return NVR_ERROR_END_MEM;
+    return ret;
+}
+
+/**
+  * @brief      Appends the record of the frame, the payload is read through buf. If the stream fails or the payload 
+  *             doesnt match its CRC the record is completed with 0xFF and a tombstone of the id follows it.
+  * @param      fail: the error of the stream, the import ends
+  * @retval     the error of the flash
+  */
+static NVRError_t NVRImportRecord(NVRamKV_t *nvr, NVRPageBuf_t *pb, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, const NVRSnapshotFrame_t *f, NVRError_t *fail, uint32_t *wrapped)
+{
+    NVRError_t ret;
+    NVRHeader_t h;
+    NVRIndexEntry_t e;
+    uint8_t hb[sizeof(NVRHeader_t)];
+    uint32_t addr, owf, sector, pos, n, crc = NVRCRC32Init();
+    uint32_t size = f->Size & ~NVR_SNAPSHOT_LZ;
+    
+    if (0 == HEADER_SIZE_FITS(nvr, size)) {
+        *fail = NVR_ERROR_ARGUMENT;
+        return NVR_ERROR_NONE;
+    }
+    if ((nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index) && (NVRLiveSector(nvr, NVRNextFileAddr(nvr, size, &owf), size, 1, &sector)) && 
+        ((0 != (ret = NVRPageFlush(nvr, pb))) || (0 != (ret = NVRCompactFor(nvr, size))))) return ret;    // the relocations use the page buff too
+    addr = NVRNextFileAddr(nvr, size, &owf);
+    NVRMakeHeader(nvr, &h, &e, f->Id, addr, size, f->DataCRC32);
+    if (f->Size & NVR_SNAPSHOT_LZ) {
+        h.DataSize |= SIZE_LZ;
+        h.DataSizeInv = ~h.DataSize;
+    }
+    *wrapped |= owf;
+    addr += MEM_START(nvr);
+    if (nvr->Index) NVRIndexDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    NVRSummaryDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    NVRHeaderCacheDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    if (0 != (ret = NVREraseAhead(nvr, &e, 0))) return ret;
+    if (0 != (ret = NVRPageAppend(nvr, pb, addr, hb, NVRHeaderPack(nvr, &h, hb), 0))) return ret;
+    for (pos = 0; pos < size; pos += n) {
+        n = (size - pos < bufSize) ? size - pos : bufSize;
+        if ((*fail == NVR_ERROR_NONE) && (0 != read(ctx, buf, n))) *fail = NVR_ERROR_HW;
+        if (*fail == NVR_ERROR_NONE) crc = NVRCRC32Update(crc, buf, n);
+        else memset(buf, 0xFF, n);      // programmed still: the sectors ahead are erased as the record goes on
+        if (0 != (ret = NVRPageAppend(nvr, pb, addr + HEADER_SIZE(nvr) + pos, buf, n, 0))) return ret;
+    }
+    STATS_ADD(CRCBytes, size);
+    if ((*fail == NVR_ERROR_NONE) && (NVRCRC32Final(crc) != f->DataCRC32)) *fail = NVR_ERROR_CRC;
+    if (*fail != NVR_ERROR_NONE) {
+        addr = NVRNextFileAddr(nvr, 0, &owf);
+        NVRMakeHeader(nvr, &h, &e, f->Id, addr, 0, NVRCRC32(buf, 0));
+        *wrapped |= owf;
+        addr += MEM_START(nvr);
+        if (nvr->Index) NVRIndexDrop(nvr, addr, HEADER_SIZE(nvr));
+        NVRSummaryDrop(nvr, addr, HEADER_SIZE(nvr));
+        NVRHeaderCacheDrop(nvr, addr, HEADER_SIZE(nvr));
+        if (0 != (ret = NVREraseAhead(nvr, &e, 0))) return ret;
+        if (0 != (ret = NVRPageAppend(nvr, pb, addr, hb, NVRHeaderPack(nvr, &h, hb), 0))) return ret;
+    }
+    pb->Complete++;
+    if (nvr->Index) NVRIndexInsert(nvr, &e);
+    nvr->IndexHead = e;
+    NVRSummaryAdd(nvr, &e);
+    NVRHeaderCachePut(nvr, &e);
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRAsyncWriteFile with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRAsyncWriteFileLocked(NVRamKV_t *nvr, uint64_t id, const uint8_t *data, uint32_t size)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->Async.LL == 0) return NVR_ERROR_INIT;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
+    if ((data == 0) || (0 == HEADER_SIZE_FITS(nvr, size))) return NVR_ERROR_ARGUMENT;
+    
+    NVRAsync_t *a = &nvr->Async;
+    NVRHeader_t h;
+    uint32_t owf;
+    NVRError_t ret;
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;     // the job takes the page buff
+    if ((nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index) && (0 != (ret = NVRCompactFor(nvr, size)))) return ret;     // the relocations are synchronous
+    uint32_t addr = NVRNextFileAddr(nvr, size, &owf);
+    NVRMakeHeader(nvr, &h, &a->Entry, id, addr, size, NVRCRC32(data, size));
+    STATS_ADD(CRCBytes, size);
+    
+    addr += MEM_START(nvr);       // make absolute addr
+    if (nvr->Index) NVRIndexDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    NVRSummaryDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    NVRHeaderCacheDrop(nvr, addr, HEADER_SIZE(nvr) + size);
+    if (0 != (ret = NVREraseAhead(nvr, &a->Entry, 0))) return ret;     // synchronous, the queue takes the sectors of the record from the reserve
+    
+    a->Addr = a->Next = addr;
+    a->End = addr + HEADER_SIZE(nvr) + size;
+    a->FirstPageEnd = addr - (addr % PAGE_SIZE(nvr)) + PAGE_SIZE(nvr);
+    if (a->FirstPageEnd > a->End) a->FirstPageEnd = a->End;
+    NVRHeaderPack(nvr, &h, nvr->Page);       // the only page made of the header and the data
+    memcpy(&nvr->Page[HEADER_SIZE(nvr)], data, a->FirstPageEnd - addr - HEADER_SIZE(nvr));
+    a->ErasedUpTo = a->EraseNext = (addr % SECTOR_SIZE(nvr)) ? addr - (addr % SECTOR_SIZE(nvr)) + SECTOR_SIZE(nvr) : addr;    // NVRWrite doesnt erase the sector it starts in the middle of
+    a->Data = data;
+    a->Wrapped = owf;
+    a->Result = NVR_ERROR_NONE;
+    a->Job = ASYNC_JOB_WRITE;
+    
+    NVRAsyncSubmit(nvr);
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRAsyncReadFile with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRAsyncReadFileLocked(NVRamKV_t *nvr, uint8_t *data)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->Async.LL == 0) return NVR_ERROR_INIT;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    if ((nvr->FileFound == 0) || (nvr->TryToOpen == 0)) return NVR_ERROR_NOT_FOUND;
+    if (data == 0) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret;
+    uint32_t raw;
+    NVRAsync_t *a = &nvr->Async;
+    if ((NVRWriteBackHit(nvr, nvr->FoundFileAddr + MEM_START(nvr), nvr->FoundFileSize)) && (0 != (ret = NVRWriteBackSync(nvr)))) return ret;   // the driver reads the flash
+    if (0 != (ret = NVRFoundRaw(nvr, &raw))) return ret;
+    if (raw) return NVR_ERROR_ARGUMENT;
+    a->Addr = a->Next = nvr->FoundFileAddr + MEM_START(nvr);
+    a->End = a->Addr + nvr->FoundFileSize;
+    a->ReadData = data;
+    a->Entry.CRC32 = nvr->CRC32Temp;
+    a->Result = NVR_ERROR_NONE;
+    a->Job = ASYNC_JOB_READ;
+    
+    NVRAsyncSubmit(nvr);
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRAsyncPoll with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRAsyncPollLocked(NVRamKV_t *nvr)
+{
+    NVRAsync_t *a = &nvr->Async;
+    if (a->Job == ASYNC_JOB_NONE) return NVR_ERROR_NONE;
+    
+    if (a->LL->Poll) a->LL->Poll(a->LL->Ctx);
+    for (uint32_t i = 0; i < a->Depth; i++) {
+        NVRAsyncReq_t *req = &a->Queue[i];
+        if ((req->Pending == 0) || (req->Busy)) continue;
+        req->Pending = 0;
+        a->InFlight--;
+        if (req->Status != 0) a->Result = NVR_ERROR_HW;
+        if (req->Op != NVR_ASYNC_OP_READ) NVRCacheDrop(nvr, req->Addr, req->Size);     // a page read meanwhile may be stale
+        if (req->Op == NVR_ASYNC_OP_ERASE) {
+            a->EraseInFlight = 0;
+            a->ErasedUpTo = req->Addr + SECTOR_SIZE(nvr);
+        }
+    }
+    NVRAsyncSubmit(nvr);
+    if ((a->InFlight) || ((a->Next < a->End) && (a->Result == NVR_ERROR_NONE))) return NVR_ERROR_BUSY;
+    
+    NVRError_t ret = a->Result;
+    if (a->Job == ASYNC_JOB_WRITE) {
+        if (ret == NVR_ERROR_NONE) {
+            if (nvr->Index) NVRIndexInsert(nvr, &a->Entry);
+            nvr->IndexHead = a->Entry;
+            NVRSummaryAdd(nvr, &a->Entry);
+            NVRHeaderCachePut(nvr, &a->Entry);
+        }
+        if ((ret == NVR_ERROR_NONE) && (a->Wrapped)) ret = NVR_ERROR_END_MEM;
+    } else {
+        if ((ret == NVR_ERROR_NONE) && (NVRCRC32(a->ReadData, a->End - a->Addr) != a->Entry.CRC32)) ret = NVR_ERROR_CRC;
+        STATS_ADD(CRCBytes, a->End - a->Addr);
+    }
+    a->Job = ASYNC_JOB_NONE;
+    if ((ret == NVR_ERROR_NONE) || (ret == NVR_ERROR_END_MEM)) NVRCheckpointTick(nvr);
+    return ret;
+}
+
+/**
+  * @brief      NVRMaintenance with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRMaintenanceLocked(NVRamKV_t *nvr, uint32_t maxSectors)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->HeadKnown == 0) return NVR_ERROR_NOT_FOUND;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    
+    NVRError_t ret = NVRWriteBackSync(nvr);
+    if (ret != NVR_ERROR_NONE) return ret;
+    uint32_t first = nvr->HeadEnd;      // the sector the next write erases first
+    if (first % SECTOR_SIZE(nvr)) first += SECTOR_SIZE(nvr) - (first % SECTOR_SIZE(nvr));
+    if (first >= MEM_SIZE(nvr)) first = 0;
+    if (first != nvr->ErasedAddr) {     // the head has moved some other way than by the writes
+        nvr->ErasedAddr = first;
+        nvr->ErasedCount = 0;
+    }
+    
+    uint8_t compact = ((nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index)) ? 1 : 0;
+    uint8_t atHead = (nvr->FoundFileAddr == nvr->IndexHead.Addr);
+    NVRIndexEntry_t cursor;
+    uint8_t fileFound = nvr->FileFound;
+    cursor.Id = nvr->FoundFileId;
+    cursor.Addr = nvr->FoundFileAddr;
+    cursor.Size = nvr->FoundFileSize;
+    cursor.CRC32 = nvr->CRC32Temp;
+    cursor.AddrPrev = nvr->FileAddrPrev;
+    if (compact) NVRMoveToHead(nvr);    // the relocations go behind the last written record
+    
+    while (maxSectors) {
+        uint32_t addr = nvr->ErasedAddr + nvr->ErasedCount * SECTOR_SIZE(nvr);
+        if (addr >= MEM_SIZE(nvr)) addr -= MEM_SIZE(nvr);
+        if ((compact) && (0 != (ret = NVRCompactSector(nvr, addr)))) break;    // the relocations take the pre-erased sectors, addr stays the next one to erase
+        if (nvr->ErasedCount >= nvr->EraseReserve) break;
+        addr += MEM_START(nvr);
+        if (nvr->Index) NVRIndexDrop(nvr, addr, SECTOR_SIZE(nvr));
+        NVRSummaryDrop(nvr, addr, SECTOR_SIZE(nvr));
+        NVRHeaderCacheDrop(nvr, addr, SECTOR_SIZE(nvr));
+        if (0 != NVREraseLL(nvr, addr)) {
+            ret = NVR_ERROR_HW;
+            break;
+        }
+        nvr->ErasedCount++;
+        maxSectors--;
+    }
+    
+    if ((compact) && (atHead == 0)) {   // keep the record the caller has opened
+        nvr->FileFound = fileFound;
+        nvr->FoundFileId = cursor.Id;
+        nvr->FoundFileAddr = cursor.Addr;
+        nvr->FoundFileSize = cursor.Size;
+        nvr->CRC32Temp = cursor.CRC32;
+        nvr->FileAddrPrev = cursor.AddrPrev;
+    }
+    if (ret != NVR_ERROR_NONE) return ret;
+    return (nvr->ErasedCount < nvr->EraseReserve) ? NVR_ERROR_BUSY : NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVRCheckpoint with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVRCheckpointLocked(NVRamKV_t *nvr)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->CheckpointSize == 0) return NVR_ERROR_INIT;
+    if (nvr->HeadKnown == 0) return NVR_ERROR_NOT_FOUND;
+    if (nvr->Async.Job != ASYNC_JOB_NONE) return NVR_ERROR_BUSY;
+    
+    NVRCheckpoint_t c;
+    NVRIOVec_t v[2];
+    uint32_t size, half = (nvr->CheckpointSize / SECTOR_SIZE(nvr) / 2) * SECTOR_SIZE(nvr);
+    
+    if (NVR_ERROR_NONE != NVRWriteBackSync(nvr)) return NVR_ERROR_HW;      // the head must be on the flash
+    memset(&c, 0, sizeof(c));
+    c.Preamble = CHECKPOINT_PREAMBLE;
+    c.Seq = nvr->CheckpointSeq;
+    c.Count = CHECKPOINT_NO_INDEX;
+    if ((nvr->Index) && (sizeof(c) + nvr->IndexCount * sizeof(NVRIndexEntry_t) <= half)) c.Count = nvr->IndexCount;
+    c.Head = nvr->IndexHead;
+    v[0].Data = (const uint8_t *)&c;
+    v[0].Size = sizeof(c);
+    v[1].Data = (const uint8_t *)nvr->Index;
+    v[1].Size = (c.Count == CHECKPOINT_NO_INDEX) ? 0 : c.Count * sizeof(NVRIndexEntry_t);
+    size = v[0].Size + v[1].Size;
+    c.CRC32 = NVRCRC32Final(NVRCRC32Update(NVRCRC32Update(NVRCRC32Init(), (const uint8_t *)&c.Seq, sizeof(c) - 8), v[1].Data, v[1].Size));
+    
+    uint32_t pos = nvr->CheckpointNext;
+    uint32_t sectorFilled = pos % SECTOR_SIZE(nvr);
+    if ((sectorFilled) && (sectorFilled + size > SECTOR_SIZE(nvr))) pos += SECTOR_SIZE(nvr) - sectorFilled;   // the previous ones stay in the sector behind
+    if (pos + size > nvr->CheckpointSize) pos = 0;
+    
+    uint32_t addr = nvr->CheckpointAddr + pos, remain = size, iovIdx = 0, iovOffset = 0;
+    while (remain) {
+        uint32_t chunkSize = PAGE_SIZE(nvr) - (addr % PAGE_SIZE(nvr));
+        if (chunkSize > remain) chunkSize = remain;
+        if (((addr % SECTOR_SIZE(nvr)) == 0) && (0 != NVREraseLL(nvr, addr))) return NVR_ERROR_HW;
+        if (0 != NVRWritePage(nvr, addr, v, &iovIdx, &iovOffset, chunkSize)) return NVR_ERROR_HW;
+        addr += chunkSize;
+        remain -= chunkSize;
+    }
+    nvr->CheckpointNext = pos + size;
+    nvr->CheckpointSeq++;
+    nvr->CheckpointHead = nvr->HeadEnd;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      NVREraseAll with the write lock held
+  * @param
+  * @retval
+  */
+static NVRError_t NVREraseAllLocked(NVRamKV_t *nvr)
+{        
+    NVRError_t ret = NVR_ERROR_NONE;
+    uint32_t addr = MEM_START(nvr);
+    uint32_t endMem = MEM_START(nvr) + MEM_SIZE(nvr);
+       
+    for (; addr < endMem; addr += SECTOR_SIZE(nvr)) {
+        if (0 != (ret = NVREraseLL(nvr, addr))) {
+            break;
+        }
+    }  
+    nvr->FileFound = nvr->FoundFileAddr = nvr->FoundFileSize = nvr->FoundFileId = 0;
+    nvr->WriteBack.PageAddr = nvr->WriteBack.Start = nvr->WriteBack.Fill = 0;     // the records not programmed are gone too
+    nvr->IndexCount = 0;
+    memset(&nvr->IndexHead, 0, sizeof(NVRIndexEntry_t));
+    nvr->HeadEnd = nvr->ErasedAddr = nvr->ErasedCount = 0;
+    nvr->HeadKnown = 1;
+    NVRSummaryReset(nvr);
+    NVRHeaderCacheDrop(nvr, MEM_START(nvr), MEM_SIZE(nvr));
+    nvr->SummaryValid = (nvr->Summary) && (ret == NVR_ERROR_NONE);
+    nvr->SummaryLive = 0;
+    if ((ret == NVR_ERROR_NONE) && (nvr->CheckpointSize)) ret = NVRCheckpointLocked(nvr);     // the old ones refer to the erased records
+    return ret;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static NVRError_t NVRCheckHeader(const NVRamKV_t *nvr, uint8_t *buf, uint32_t addr, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc)
 {    
+    uint32_t endMem = MEM_START(nvr) + MEM_SIZE(nvr);
+    if ((addr + HEADER_SIZE(nvr)) > endMem) return NVR_ERROR_END_MEM;
+    
+    uint32_t bytesToRead = (endMem - addr > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : endMem - addr;
+    
+    const uint8_t *b = buf;
+    if ((nvr->Base) && (0 == NVRWriteBackHit(nvr, addr, bytesToRead))) b = &nvr->Base[addr - MEM_START(nvr)];     // parsed in place
+    else if (nvr->Base) memcpy(buf, &nvr->Base[addr - MEM_START(nvr)], bytesToRead);
+    else if (0 != NVRCacheRead(nvr, addr, buf, bytesToRead, 1)) {
+        return NVR_ERROR_HW;
+    }
+    if (b == buf) NVRWriteBackOverlay(nvr, addr, buf, bytesToRead);
+    return NVRFindHeader(nvr, b, addr, bytesToRead, currAddr, prevAddr, currId, currSize, crc);
+}
+
+/**
+  * @brief      The first valid header in the bytes read at addr, the stale bytes of a torn record are skipped
+  * @param      b: bytesToRead bytes of the memory at addr
+  * @retval     NVR_ERROR_EMPTY if the bytes are erased, NVR_ERROR_HEADER if there is no header
+  */
+static NVRError_t NVRFindHeader(const NVRamKV_t *nvr, const uint8_t *b, uint32_t addr, uint32_t bytesToRead, uint32_t *currAddr, uint32_t *prevAddr, uint64_t *currId, uint32_t *currSize, uint32_t *crc)
+{
+    uint32_t offset = 0;
+    while ((offset = NVRFindPreamble(b, offset, bytesToRead - HEADER_SIZE(nvr), HEADER_PREAMBLE(nvr))) <= bytesToRead - HEADER_SIZE(nvr)) {
+        NVRHeader_t h;
+        if (NVRHeaderParse(nvr, &b[offset], &h)) {      // the write procedure doesnt split the header into two pages
+            STATS_ADD(HeadersParsed, 1);
+            STATS_ADD(ResyncBytes, offset);
+            *currAddr = addr + offset;
+            *currId = h.FileId;                                    
+            *currSize = HEADER_SIZE(nvr) + (h.DataSize & ~SIZE_LZ); 
+            *crc = h.DataCRC32; 
+            *prevAddr = h.FileAddrPrev;
+            return NVR_ERROR_NONE;                
+        }
+        offset++;
+    }
+    uint8_t empty = (bytesToRead > HEADER_SIZE(nvr)) ? NVRIsErased(b, bytesToRead - 1) : 1;
+    if (empty) {
+        STATS_ADD(EmptyPages, 1);
+        return NVR_ERROR_EMPTY;
+    }
+    STATS_ADD(HeaderErrors, 1);
+    STATS_ADD(ResyncBytes, bytesToRead);
+    return NVR_ERROR_HEADER;
+}
+
+/**
+  * @brief      The fields are consistent with their inverted copies, a tombstone has no payload
+  * @param
+  * @retval
+  */
+static uint8_t NVRHeaderValid(const NVRHeader_t *h)
+{
+    return (h->FileId == ~h->FileIdInv) && (h->DataSize != SIZE_LZ) && (h->DataSize == ~h->DataSizeInv) && (h->FileAddrPrev == ~h->FileAddrPrevInv);
+}
+
+/**
+  * @brief      Decodes the stored header of the store format, the v2 one gets the inverted copies filled in
+  * @param      b: HEADER_SIZE bytes, may be unaligned
+  * @retval     1 if the header is valid
+  */
+static uint8_t NVRHeaderParse(const NVRamKV_t *nvr, const uint8_t *b, NVRHeader_t *h)
+{
+    if (HEADER_V2(nvr) == 0) {
+        memcpy(h, b, sizeof(NVRHeader_t));
+        return (h->Preamble == PREAMBLE) && NVRHeaderValid(h);
+    }
+    uint16_t size, crc;
+    memcpy(&h->Preamble, &b[0], 4);
+    memcpy(&h->DataCRC32, &b[4], 4);
+    memcpy(&h->FileId, &b[8], 8);
+    memcpy(&h->FileAddrPrev, &b[16], 4);
+    memcpy(&size, &b[20], 2);
+    memcpy(&crc, &b[23], 2);
+    h->DataSize = size | ((b[22] & HEADER_V2_LZ) ? SIZE_LZ : 0);
+    h->FileIdInv = ~h->FileId;
+    h->DataSizeInv = ~h->DataSize;
+    h->FileAddrPrevInv = ~h->FileAddrPrev;
+    return (h->Preamble == PREAMBLE_V2) && ((b[22] & ~HEADER_V2_LZ) == HEADER_V2_VERSION) && (crc == NVRHeaderCRC16(b)) && (h->DataSize != SIZE_LZ);
+}
+
+/**
+  * @brief      Encodes the header in the store format
+  * @param      b: at least sizeof(NVRHeader_t) bytes
+  * @retval     HEADER_SIZE
+  */
+static uint32_t NVRHeaderPack(const NVRamKV_t *nvr, const NVRHeader_t *h, uint8_t *b)
+{
+    if (HEADER_V2(nvr) == 0) {
+        memcpy(b, h, sizeof(NVRHeader_t));
+        return sizeof(NVRHeader_t);
+    }
+    uint32_t preamble = PREAMBLE_V2;
+    uint16_t size = (uint16_t)(h->DataSize & ~SIZE_LZ);     // the writers checked HEADER_SIZE_FITS
+    uint16_t crc;
+    memcpy(&b[0], &preamble, 4);
+    memcpy(&b[4], &h->DataCRC32, 4);
+    memcpy(&b[8], &h->FileId, 8);
+    memcpy(&b[16], &h->FileAddrPrev, 4);
+    memcpy(&b[20], &size, 2);
+    b[22] = HEADER_V2_VERSION | ((h->DataSize & SIZE_LZ) ? HEADER_V2_LZ : 0);
+    crc = NVRHeaderCRC16(b);
+    memcpy(&b[23], &crc, 2);
+    return HEADER_V2_SIZE;
+}
+
+/**
+  * @brief      Tells a compressed record by its stored header
+  * @param      b: HEADER_SIZE bytes, may be unaligned
+  * @retval     1 if the header is valid and flagged
+  */
+static uint8_t NVRHeaderPacked(const NVRamKV_t *nvr, const uint8_t *b)
+{
+    NVRHeader_t h;
+    return (NVRHeaderParse(nvr, b, &h)) && (h.DataSize & SIZE_LZ);
+}
+
+/**
+  * @brief      Check of the v2 header: CRC-16/CCITT-FALSE of the header bytes before it
+  * @param
+  * @retval
+  */
+static uint16_t NVRHeaderCRC16(const uint8_t *b)
+{
+    uint16_t crc = 0xFFFF;
+    uint32_t i, bit;
+    for (i = 0; i < HEADER_V2_SIZE - 2; i++) {
+        crc ^= (uint16_t)b[i] << 8;
+        for (bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+/**
+  * @brief      Looks for the preamble bytes comparing a vector or a word at once
+  * @param      end: the last offset the preamble may start at
+  * @retval     offset of the preamble, > end if there is none
+  */
+static uint32_t NVRFindPreamble(const uint8_t *buf, uint32_t offset, uint32_t end, uint32_t preamble)
+{
+    const uint8_t *p = (const uint8_t *)&preamble;     // memory order of the preamble bytes
+    
+#if defined(NVR_SCAN_AVX2)
+    const __m256i p0 = _mm256_set1_epi8((char)p[0]), p1 = _mm256_set1_epi8((char)p[1]);
+    const __m256i p2 = _mm256_set1_epi8((char)p[2]), p3 = _mm256_set1_epi8((char)p[3]);
+    for (; offset + 32 <= end + 1; offset += 32) {     // the header behind end keeps the loads in the buffer
+        const uint8_t *b = &buf[offset];
+        __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)b), p0), 
+                                     _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(b + 1)), p1));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(b + 2)), p2));
+        m = _mm256_and_si256(m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(b + 3)), p3));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(m);
+        if (mask) return offset + __builtin_ctz(mask);
+    }
+#elif defined(NVR_SCAN_SSE2)
+    const __m128i p0 = _mm_set1_epi8((char)p[0]), p1 = _mm_set1_epi8((char)p[1]);
+    const __m128i p2 = _mm_set1_epi8((char)p[2]), p3 = _mm_set1_epi8((char)p[3]);
+    for (; offset + 16 <= end + 1; offset += 16) {
+        const uint8_t *b = &buf[offset];
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)b), p0), 
+                                  _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(b + 1)), p1));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(b + 2)), p2));
+        m = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(b + 3)), p3));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(m);
+        if (mask) return offset + __builtin_ctz(mask);
+    }
+#else
+    const uintptr_t ones = (uintptr_t)-1 / 0xFF, highs = ones * 0x80, pattern = ones * p[0];
+    for (; offset + sizeof(uintptr_t) <= end + 1; offset += sizeof(uintptr_t)) {
+        uintptr_t w;
+        memcpy(&w, &buf[offset], sizeof(w));
+        w ^= pattern;   // bytes equal to the first preamble byte become zero
+        if (((w - ones) & ~w & highs) == 0) continue;
+        uint32_t i;
+        for (i = 0; i < sizeof(uintptr_t); i++) {
+            if (0 == memcmp(&buf[offset + i], p, sizeof(preamble))) return offset + i;
+        }
+    }
+#endif
+    for (; offset <= end; offset++) {
+        if ((buf[offset] == p[0]) && (0 == memcmp(&buf[offset], p, sizeof(preamble)))) break;
+    }
+    return offset;
+}
+
+/**
+  * @brief      
+  * @param
+  * @retval     1 if all the bytes are 0xFF
+  */
+static uint8_t NVRIsErased(const uint8_t *buf, uint32_t size)
+{
     uint32_t offset = 0;
-    uint32_t endMem = nvr->MemoryStartAddr + nvr->MemorySize;
-    if ((addr + NVRHeaderSize) > endMem) return NVR_ERROR_END_MEM;
     
-    uint32_t bytesToRead = (endMem - addr > nvr->PageSize) ? nvr->PageSize : endMem - addr;
+#if defined(NVR_SCAN_AVX2)
+    __m256i acc = _mm256_set1_epi8((char)0xFF);
+    for (; offset + 32 <= size; offset += 32) acc = _mm256_and_si256(acc, _mm256_loadu_si256((const __m256i *)&buf[offset]));
+    if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(acc, _mm256_set1_epi8((char)0xFF))) != 0xFFFFFFFF) return 0;
+#elif defined(NVR_SCAN_SSE2)
+    __m128i acc = _mm_set1_epi8((char)0xFF);
+    for (; offset + 16 <= size; offset += 16) acc = _mm_and_si128(acc, _mm_loadu_si128((const __m128i *)&buf[offset]));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_set1_epi8((char)0xFF))) != 0xFFFF) return 0;
+#else
+    uintptr_t acc = (uintptr_t)-1;
+    for (; offset + sizeof(uintptr_t) <= size; offset += sizeof(uintptr_t)) {
+        uintptr_t w;
+        memcpy(&w, &buf[offset], sizeof(w));
+        acc &= w;
+    }
+    if (acc != (uintptr_t)-1) return 0;
+#endif
+    for (; offset < size; offset++) {
+        if (buf[offset] != 0xFF) return 0;
+    }
+    return 1;
+}
+
+/**
+  * @brief      Where the next file goes: behind the opened one, at the start of the next page
+  *             if the header doesnt fit or the page alignment is on, at the start of memory if the file doesnt fit
+  * @param      owf: set if the memory wraps around
+  * @retval     relative addr of the header
+  */
+static uint32_t NVRNextFileAddr(const NVRamKV_t *nvr, uint32_t size, uint32_t *owf)
+{
+    uint32_t addr = (nvr->FoundFileAddr == 0) ? 0 : nvr->FoundFileAddr + nvr->FoundFileSize;
+    uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+    uint32_t pageRemain = PAGE_SIZE(nvr) - pageFilled;
+    
+    *owf = 0;
+    if ((pageFilled && (nvr->Flags & NVR_FLAGS_PAGE_ALIGN)) || (pageRemain < HEADER_SIZE(nvr))) {     // align to the nearest start of the page if the flag is set or there is no place for the whole header
+        addr += pageRemain;
+    }       
+    if ((addr + HEADER_SIZE(nvr) + size) > MEM_SIZE(nvr)) {
+        addr = 0;
+        *owf = 1;        
+    }
+    return addr;
+}
+
+/**
+  * @brief      Fills the header and the index entry of the file to be written at addr, 
+  *             the cursor moves to the file to allow instant access to it after writing
+  * @param      addr: relative addr of the header
+  * @retval
+  */
+static void NVRMakeHeader(NVRamKV_t *nvr, NVRHeader_t *h, NVRIndexEntry_t *e, uint64_t id, uint32_t addr, uint32_t size, uint32_t crc)
+{
+    nvr->FileAddrPrev = nvr->FoundFileAddr;     // update addr
+    nvr->FoundFileAddr = addr + HEADER_SIZE(nvr);
+    nvr->FoundFileSize = size;
+    nvr->FoundFileId = id;
+    nvr->HeadEnd = nvr->FoundFileAddr + size;
+    nvr->HeadKnown = 1;
+    nvr->FoundFileRawAddr = 0;      // the writer flags a compressed record
+    
+    memset(h, 0, sizeof(NVRHeader_t));
+    h->Preamble = PREAMBLE;
+    h->FileId = id;
+    h->FileIdInv = ~id;
+    h->DataSize = size;  
+    h->DataSizeInv = ~size; 
+    h->FileAddrPrev = nvr->FileAddrPrev;
+    h->FileAddrPrevInv = ~nvr->FileAddrPrev;
+    h->DataCRC32 = crc;
+    
+    e->Id = id;
+    e->Addr = nvr->FoundFileAddr;
+    e->Size = size;
+    e->CRC32 = crc;
+    e->AddrPrev = nvr->FileAddrPrev;
+}
+
+/**
+  * @brief      Places data at addr in the assembled page, the page is programmed when it is full.
+  *             Whole pages of data are programmed directly. A gap in the page is padded with 0xFF,
+  *             an addr in another page flushes the current one first.
+  * @param      addr: absolute addr, not below the assembled data
+  * @param      src: absolute addr the data is read from if data is 0
+  * @retval
+  */
+static NVRError_t NVRPageAppend(NVRamKV_t *nvr, NVRPageBuf_t *pb, uint32_t addr, const uint8_t *data, uint32_t size, uint32_t src)
+{
+    NVRError_t ret;
+    uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+    
+    if ((addr - pageFilled != pb->PageAddr) || (pb->Fill == pb->Start)) {
+        if (0 != (ret = NVRPageFlush(nvr, pb))) return ret;
+        pb->PageAddr = addr - pageFilled;
+        pb->Start = pb->Fill = pageFilled;
+    } else if (pageFilled > pb->Fill) {
+        memset(&pb->Buf[pb->Fill], 0xFF, pageFilled - pb->Fill);    // programming 0xFF keeps the cells erased
+        pb->Fill = pageFilled;
+    }
+    while (size) {
+        if ((pb->EraseAhead) && (pb->Fill == 0) && ((pb->PageAddr % SECTOR_SIZE(nvr)) == 0) && (0 == NVRTakeErased(nvr, pb->PageAddr))) {
+            NVREraseLL(nvr, pb->PageAddr);
+        }
+        if ((pb->Fill == 0) && (size >= PAGE_SIZE(nvr)) && (data)) {
+            pb->Fill = PAGE_SIZE(nvr);
+            if (0 != (ret = NVRPageProgram(nvr, pb, data))) return ret;
+            data += PAGE_SIZE(nvr);
+            size -= PAGE_SIZE(nvr);
+        } else {
+            uint32_t s = PAGE_SIZE(nvr) - pb->Fill;
+            if (s > size) s = size;
+            if (data) {
+                memcpy(&pb->Buf[pb->Fill], data, s);
+                data += s;
+            } else {
+                if (0 != (ret = NVRRead(nvr, src, &pb->Buf[pb->Fill], s))) return ret;
+                src += s;
+            }
+            pb->Fill += s;
+            size -= s;
+            if ((pb->Fill == PAGE_SIZE(nvr)) && (0 != (ret = NVRPageFlush(nvr, pb)))) return ret;
+        }
+    }
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Programs the assembled part of the page and moves to the next page if it is full
+  * @param
+  * @retval
+  */
+static NVRError_t NVRPageFlush(NVRamKV_t *nvr, NVRPageBuf_t *pb)
+{
+    if (pb->Fill == pb->Start) return NVR_ERROR_NONE;
+    return NVRPageProgram(nvr, pb, &pb->Buf[pb->Start]);
+}
+
+/**
+  * @brief      Programs [Start, Fill) of the page from data, the sector is erased before its first page
+  *             like NVRWrite does unless the page buff has erased it ahead
+  * @param
+  * @retval
+  */
+static NVRError_t NVRPageProgram(NVRamKV_t *nvr, NVRPageBuf_t *pb, const uint8_t *data)
+{
+    uint32_t addr = pb->PageAddr + pb->Start;
+    if ((pb->EraseAhead == 0) && ((addr % SECTOR_SIZE(nvr)) == 0) && (0 == NVRTakeErased(nvr, addr))) NVREraseLL(nvr, addr);
+    if (0 != NVRWriteLL(nvr, addr, (uint8_t *)data, pb->Fill - pb->Start)) return NVR_ERROR_HW;
+    pb->Durable = pb->Complete;     // all the completed records are on the flash now
+    if (pb->Fill == PAGE_SIZE(nvr)) {
+        pb->PageAddr += PAGE_SIZE(nvr);
+        pb->Fill = 0;
+    }
+    pb->Start = pb->Fill;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Queues the requests of the current job while there are free slots. The next sector
+  *             is erased while the pages of the current one are programmed, a page is programmed
+  *             only when its sector is erased.
+  * @param
+  * @retval
+  */
+static void NVRAsyncSubmit(NVRamKV_t *nvr)
+{
+    NVRAsync_t *a = &nvr->Async;
+    uint32_t i = 0;
+    
+    while ((a->Result == NVR_ERROR_NONE) && (a->InFlight < a->Depth)) {
+        NVRAsyncReq_t *req;
+        for (; a->Queue[i].Pending; i++);   // there is a free one as InFlight < Depth
+        req = &a->Queue[i];
+        
+        if ((a->Job == ASYNC_JOB_WRITE) && (a->EraseInFlight == 0) && (a->EraseNext < a->End) && (NVRTakeErased(nvr, a->EraseNext))) {
+            a->EraseNext += SECTOR_SIZE(nvr);
+            a->ErasedUpTo = a->EraseNext;
+            continue;
+        }
+        if ((a->Job == ASYNC_JOB_WRITE) && (a->EraseInFlight == 0) && (a->EraseNext < a->End)) {
+            req->Op = NVR_ASYNC_OP_ERASE;
+            req->Addr = a->EraseNext;
+            req->Data = 0;
+            req->Size = SECTOR_SIZE(nvr);
+        } else if ((a->Next < a->End) && ((a->Job == ASYNC_JOB_READ) || (a->Next < a->ErasedUpTo))) {
+            uint32_t chunkSize = PAGE_SIZE(nvr) - (a->Next % PAGE_SIZE(nvr));
+            if (chunkSize > a->End - a->Next) chunkSize = a->End - a->Next;
+            req->Addr = a->Next;
+            req->Size = chunkSize;
+            if (a->Job == ASYNC_JOB_READ) {
+                req->Op = NVR_ASYNC_OP_READ;
+                req->Data = &a->ReadData[a->Next - a->Addr];
+            } else {
+                req->Op = NVR_ASYNC_OP_WRITE;
+                if (a->Next < a->FirstPageEnd) req->Data = &nvr->Page[a->Next - a->Addr];
+                else req->Data = (uint8_t *)&a->Data[a->Next - a->Addr - HEADER_SIZE(nvr)];
+            }
+        } else {
+            break;
+        }
+        
+        req->Status = 0;
+        req->Busy = 1;
+        req->Pending = 1;
+        int32_t ret = a->LL->Submit(a->LL->Ctx, req);
+        if (ret != 0) {
+            req->Busy = req->Pending = 0;
+            if (ret != NVR_ERROR_BUSY) a->Result = NVR_ERROR_HW;
+            break;      // retry the next poll if the driver queue is full
+        }
+        a->InFlight++;
+        if (req->Op == NVR_ASYNC_OP_ERASE) {
+            a->EraseInFlight = 1;
+            a->EraseNext += SECTOR_SIZE(nvr);
+        } else {
+            a->Next += req->Size;
+        }
+    }
+}
+
+/**
+  * @brief      Reads by pages
+  * @param      addr: absolute addr
+  * @retval
+  */
+static NVRError_t NVRRead(NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size)
+{
+    uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+    uint32_t remain = size, offset = 0;
+    
+    if ((nvr->Base) && (addr >= MEM_START(nvr)) && (addr - MEM_START(nvr) + size <= MEM_SIZE(nvr))) {     // the checkpoint area may lie outside
+        memcpy(data, &nvr->Base[addr - MEM_START(nvr)], size);
+        NVRWriteBackOverlay(nvr, addr, data, size);
+        return NVR_ERROR_NONE;
+    }
+    if ((pageFilled) && ((pageFilled + size) > PAGE_SIZE(nvr))) {
+        uint32_t s = PAGE_SIZE(nvr) - pageFilled;
+        if (0 != NVRCacheRead(nvr, addr, data, s, 0)) return NVR_ERROR_HW;
+        offset += s;
+        remain -= s;
+    }
+    while (remain) {
+        uint32_t chunkSize = (remain > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : remain;
+        if (0 != NVRCacheRead(nvr, addr + offset, &data[offset], chunkSize, 0)) return NVR_ERROR_HW;
+        offset += chunkSize;
+        remain -= chunkSize;
+    }
+    NVRWriteBackOverlay(nvr, addr, data, size);     // the records not programmed yet
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static NVRError_t NVRWrite(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt)
+{
+    if (nvr->NotReady) return NVR_ERROR_INIT;
+    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
+    if (iov == 0) return NVR_ERROR_ARGUMENT;
+    
+    NVRError_t ret = NVR_ERROR_NONE;
+    uint32_t sectorChunkSize;
+    uint32_t remain = 0, iovIdx = 0, iovOffset = 0;
+    uint32_t stop = 0;
+    uint32_t finishSector = (addr % SECTOR_SIZE(nvr)) ? 1 : 0;
+    uint32_t sectorRemain = SECTOR_SIZE(nvr) - (addr % SECTOR_SIZE(nvr));
+    uint32_t pageRemain = PAGE_SIZE(nvr) - (addr % PAGE_SIZE(nvr));
+    uint32_t endMem = MEM_START(nvr) + MEM_SIZE(nvr);
+    
+    for (uint32_t i = 0; i < iovCnt; i++) remain += iov[i].Size;
+       
+    do {
+        if (addr == endMem) addr = MEM_START(nvr);
+        if (remain > sectorRemain) {
+            sectorChunkSize = sectorRemain;
+            remain -= sectorRemain;
+            sectorRemain = SECTOR_SIZE(nvr);
+        } else {
+            sectorChunkSize = remain;
+            stop = 1;
+        }
+        if (finishSector) {
+            finishSector = 0;
+        } else if (0 == NVRTakeErased(nvr, addr)) {
+            NVREraseLL(nvr, addr);            
+        }
+        
+        uint32_t stopS = 0;
+        do {
+            uint32_t chunkSize;
+            if (sectorChunkSize > pageRemain) {
+                chunkSize = pageRemain;
+                sectorChunkSize -= pageRemain;
+            } else {
+                chunkSize = sectorChunkSize;
+                stopS = 1;
+            }  
+            pageRemain -= chunkSize;
+            if (pageRemain == 0) pageRemain = PAGE_SIZE(nvr);
+            if (0 == NVRWritePage(nvr, addr, iov, &iovIdx, &iovOffset, chunkSize)) {
+                addr += chunkSize;
+            } else {
+                ret = NVR_ERROR_HW;
+                stop = stopS = 1;
+            }
+        } while (stopS == 0);        
+    } while (stop == 0);    
+    
+    return ret;
+}
+
+/**
+  * @brief      Programs the next size bytes of the fragments, which must not cross a page
+  * @param      iovIdx, iovOffset: position in the fragments, moved forward
+  * @retval     LL result
+  */
+static int32_t NVRWritePage(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t *iovIdx, uint32_t *iovOffset, uint32_t size)
+{
+    NVRIOVec_t sub[NVR_IOV_MAX];
+    uint32_t n = 0, done = 0;
+    
+    while (iov[*iovIdx].Size == *iovOffset) {   // skip the fragments written already and the empty ones
+        (*iovIdx)++;
+        *iovOffset = 0;
+    }
+    if (iov[*iovIdx].Size - *iovOffset >= size) {      // the page is inside one fragment
+        const uint8_t *data = &iov[*iovIdx].Data[*iovOffset];
+        *iovOffset += size;
+        return NVRWriteLL(nvr, addr, (uint8_t *)data, size);
+    }
+    while (done < size) {
+        while (iov[*iovIdx].Size == *iovOffset) {
+            (*iovIdx)++;
+            *iovOffset = 0;
+        }
+        uint32_t s = iov[*iovIdx].Size - *iovOffset;
+        if (s > size - done) s = size - done;
+        if (nvr->NVRWriteDataVLL) {
+            sub[n].Data = &iov[*iovIdx].Data[*iovOffset];
+            sub[n++].Size = s;
+        } else {
+            memcpy(&nvr->Page[done], &iov[*iovIdx].Data[*iovOffset], s);
+        }
+        *iovOffset += s;
+        done += s;
+    }
+    if (nvr->NVRWriteDataVLL) return NVRWriteVLL(nvr, addr, sub, n);
+    else return NVRWriteLL(nvr, addr, nvr->Page, size);
+}
+
+/**
+  * @brief      Writes a checkpoint if the head has moved interval sectors since the last one
+  * @param
+  * @retval
+  */
+static void NVRCheckpointTick(NVRamKV_t *nvr)
+{
+    if (nvr->CheckpointSize == 0) return;
+    uint32_t moved = (nvr->HeadEnd >= nvr->CheckpointHead) ? nvr->HeadEnd - nvr->CheckpointHead : nvr->HeadEnd + MEM_SIZE(nvr) - nvr->CheckpointHead;
+    if (moved >= nvr->CheckpointInterval * SECTOR_SIZE(nvr)) NVRCheckpointLocked(nvr);    // tried again after the next write if it fails
+}
+
+/**
+  * @brief      Looks through the area for the newest valid checkpoint, the next one goes behind it
+  *             or to the next sector if the rest of the sector is not clean
+  * @param      pos: relative addr of the checkpoint in the area
+  * @retval     1 if found
+  */
+static uint8_t NVRCheckpointFind(NVRamKV_t *nvr, NVRCheckpoint_t *c, uint32_t *pos)
+{
+    NVRCheckpoint_t t;
+    uint32_t addr = 0, size, end = 0;
+    uint8_t found = 0;
+    
+    while (addr + sizeof(t) <= nvr->CheckpointSize) {
+        if (NVR_ERROR_NONE != NVRRead(nvr, nvr->CheckpointAddr + addr, (uint8_t *)&t, sizeof(t))) break;
+        size = sizeof(t);
+        if ((t.Count != CHECKPOINT_NO_INDEX) && (t.Count <= (nvr->CheckpointSize - addr - sizeof(t)) / sizeof(NVRIndexEntry_t))) {
+            size += t.Count * sizeof(NVRIndexEntry_t);
+        }
+        if ((t.Preamble == CHECKPOINT_PREAMBLE) && (t.CRC32 == NVRCheckpointCRC(nvr, &t, addr + sizeof(t), size - sizeof(t)))) {
+            if ((found == 0) || ((int32_t)(t.Seq - c->Seq) > 0)) {
+                *c = t;
+                *pos = addr;
+                end = addr + size;
+                found = 1;
+            }
+            addr += size;
+        } else {
+            addr += SECTOR_SIZE(nvr) - (addr % SECTOR_SIZE(nvr));     // the rest of the sector is clean or torn
+        }
+    }
+    
+    nvr->CheckpointSeq = found ? c->Seq + 1 : 0;
+    nvr->CheckpointNext = end;
+    for (addr = end; addr % SECTOR_SIZE(nvr); ) {
+        size = PAGE_SIZE(nvr) - (addr % PAGE_SIZE(nvr));
+        if ((NVR_ERROR_NONE != NVRRead(nvr, nvr->CheckpointAddr + addr, nvr->Page, size)) || (0 == NVRIsErased(nvr->Page, size))) {
+            nvr->CheckpointNext = addr - (addr % SECTOR_SIZE(nvr)) + SECTOR_SIZE(nvr);
+            break;
+        }
+        addr += size;
+    }
+    if (nvr->CheckpointNext >= nvr->CheckpointSize) nvr->CheckpointNext = 0;
+    return found;
+}
+
+/**
+  * @brief      CRC of the checkpoint header behind the CRC field and of the index copy in the area
+  * @param      addr: relative addr of the index copy
+  * @retval
+  */
+static uint32_t NVRCheckpointCRC(NVRamKV_t *nvr, const NVRCheckpoint_t *c, uint32_t addr, uint32_t size)
+{
+    uint32_t crc = NVRCRC32Update(NVRCRC32Init(), (const uint8_t *)&c->Seq, sizeof(NVRCheckpoint_t) - 8);
+    while (size) {
+        uint32_t chunkSize = (size > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : size;
+        if (NVR_ERROR_NONE != NVRRead(nvr, nvr->CheckpointAddr + addr, nvr->Page, chunkSize)) return ~c->CRC32;
+        crc = NVRCRC32Update(crc, nvr->Page, chunkSize);
+        STATS_ADD(CRCBytes, chunkSize);
+        addr += chunkSize;
+        size -= chunkSize;
+    }
+    return NVRCRC32Final(crc);
+}
+
+/**
+  * @brief      Takes the index and the head from the newest checkpoint and follows the prev chain 
+  *             of the records written after it. A record at the start of memory may link to the head by 
+  *             chance: a chain that wraps around past the checkpoint head is left to the scan
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND if the memory has to be scanned
+  */
+static NVRError_t NVRCheckpointLoad(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity)
+{
+    NVRCheckpoint_t c;
+    NVRIndexEntry_t head, e;
+    uint32_t pos, addr, addrPrev, s, crc, i, steps, bound, wraps = 0;
+    uint64_t fileId;
+    
+    if (0 == NVRCheckpointFind(nvr, &c, &pos)) return NVR_ERROR_NOT_FOUND;
+    if (index) {
+        if ((c.Count == CHECKPOINT_NO_INDEX) || (c.Count > capacity)) return NVR_ERROR_NOT_FOUND;
+        if (NVR_ERROR_NONE != NVRRead(nvr, nvr->CheckpointAddr + pos + sizeof(c), (uint8_t *)index, c.Count * sizeof(NVRIndexEntry_t))) return NVR_ERROR_NOT_FOUND;
+        nvr->Index = index;
+        nvr->IndexCapacity = capacity;
+        nvr->IndexCount = c.Count;
+    }
+    head = c.Head;
+    nvr->CheckpointHead = head.Addr ? head.Addr + head.Size : 0;
+    bound = head.Addr ? head.Addr - HEADER_SIZE(nvr) : MEM_SIZE(nvr);
+    
+    for (steps = MEM_SIZE(nvr) / HEADER_SIZE(nvr); steps; steps--) {
+        uint32_t next = head.Addr ? head.Addr + head.Size : 0;      // where NVRNextFileAddr puts the next record
+        uint32_t pageFilled = next % PAGE_SIZE(nvr);
+        if ((pageFilled && (nvr->Flags & NVR_FLAGS_PAGE_ALIGN)) || (PAGE_SIZE(nvr) - pageFilled < HEADER_SIZE(nvr))) next += PAGE_SIZE(nvr) - pageFilled;
+        
+        for (i = 0; i < 2; i++, next = 0) {     // behind the head or at the start if the record didnt fit
+            if ((next + HEADER_SIZE(nvr) <= MEM_SIZE(nvr)) && 
+                (NVR_ERROR_NONE == NVRCheckHeader(nvr, nvr->Page, next + MEM_START(nvr), &addr, &addrPrev, &fileId, &s, &crc)) && 
+                (addr == next + MEM_START(nvr)) && (addrPrev == head.Addr)) break;
+            if (next == 0) i = 1;
+        }
+        if (i == 2) break;      // the chain ends: head is the last written record
+        
+        e.Id = fileId;
+        e.Addr = addr + HEADER_SIZE(nvr) - MEM_START(nvr);
+        e.Size = s - HEADER_SIZE(nvr);
+        e.CRC32 = crc;
+        e.AddrPrev = addrPrev;
+        if (e.Addr < head.Addr) wraps++;
+        if ((wraps > 1) || ((wraps) && (e.Addr + e.Size > bound))) {     // a record of the pass the head belongs to, the memory is scanned
+            nvr->Index = 0;
+            return NVR_ERROR_NOT_FOUND;
+        }
+        if (nvr->Index) {
+            NVRIndexDrop(nvr, addr, s);     // as the write has done
+            if (NVRAheadSector(nvr, &e, &i)) NVRIndexDrop(nvr, i + MEM_START(nvr), SECTOR_SIZE(nvr));
+            NVRIndexInsert(nvr, &e);
+            if (nvr->Index == 0) return NVR_ERROR_NOT_FOUND;
+        }
+        head = e;
+    }
+    
+    NVRMountHead(nvr, &head);
+    if (nvr->Index) {   // the sectors NVRMaintenance may have erased ahead of the head since the checkpoint
+        uint32_t first = nvr->HeadEnd, end;
+        if (first % SECTOR_SIZE(nvr)) first += SECTOR_SIZE(nvr) - (first % SECTOR_SIZE(nvr));
+        end = first + nvr->EraseReserve * SECTOR_SIZE(nvr);
+        for (i = 0; i < nvr->IndexCount; ) {
+            const NVRIndexEntry_t *x = &nvr->Index[i];
+            uint32_t lo = x->Addr - HEADER_SIZE(nvr), hi = x->Addr + x->Size;
+            uint8_t ahead = ((hi > first) && (lo < end)) || ((end > MEM_SIZE(nvr)) && (lo < end - MEM_SIZE(nvr)));
+            if ((ahead) && (0 == NVRRecordIntact(nvr, x))) {
+                memmove(&nvr->Index[i], &nvr->Index[i + 1], (nvr->IndexCount - i - 1) * sizeof(NVRIndexEntry_t));
+                nvr->IndexCount--;
+            } else {
+                i++;
+            }
+        }
+    }
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Makes the record the head of the log, with no index it is opened as well
+  * @param
+  * @retval
+  */
+static void NVRMountHead(NVRamKV_t *nvr, const NVRIndexEntry_t *head)
+{
+    nvr->IndexHead = *head;
+    nvr->HeadEnd = head->Addr ? head->Addr + head->Size : 0;
+    nvr->HeadKnown = 1;
+    nvr->ErasedCount = 0;
+    if (nvr->Index == 0) {
+        nvr->TryToOpen = 1;
+        NVRMoveToHead(nvr);
+    }
+}
+
+/**
+  * @brief      Opens the last written record
+  * @param
+  * @retval
+  */
+static void NVRMoveToHead(NVRamKV_t *nvr)
+{
+    nvr->FileFound = nvr->IndexHead.Addr ? 1 : 0;
+    nvr->FoundFileId = nvr->IndexHead.Id;
+    nvr->FoundFileAddr = nvr->IndexHead.Addr;
+    nvr->FoundFileSize = nvr->IndexHead.Size;
+    nvr->CRC32Temp = nvr->IndexHead.CRC32;
+    nvr->FileAddrPrev = nvr->IndexHead.AddrPrev;
+}
+
+/**
+  * @brief      Looks for live records in the sectors erased by writing a record at addr
+  * @param      addr: relative addr of the header
+  * @param      margin: the sector erased ahead of the next record and the sector behind them are checked as well
+  * @param      sector: relative addr of the first such sector
+  * @retval     1 if found
+  */
+static uint8_t NVRLiveSector(const NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint8_t margin, uint32_t *sector)
+{
+    uint32_t sectorFilled = addr % SECTOR_SIZE(nvr);
+    uint32_t eraseStart = sectorFilled ? addr + SECTOR_SIZE(nvr) - sectorFilled : addr;
+    uint32_t eraseEnd = addr + HEADER_SIZE(nvr) + size;
+    uint32_t rank = 0, ahead;
+    uint8_t found = 0;
+    NVRIndexEntry_t r;
+    if (eraseEnd % SECTOR_SIZE(nvr)) eraseEnd += SECTOR_SIZE(nvr) - (eraseEnd % SECTOR_SIZE(nvr));
+    r.Addr = addr + HEADER_SIZE(nvr);
+    r.Size = size;
+    if ((margin) && (NVRAheadSector(nvr, &r, &ahead))) eraseEnd = ahead + SECTOR_SIZE(nvr);
+    if (eraseStart >= eraseEnd) return 0;
+    if (margin) eraseEnd += SECTOR_SIZE(nvr);
+    
+    for (uint32_t i = 0; i < nvr->IndexCount; i++) {
+        const NVRIndexEntry_t *e = &nvr->Index[i];
+        uint32_t lo = e->Addr - HEADER_SIZE(nvr), hi = e->Addr + e->Size, r;
+        if ((hi > eraseStart) && (lo < eraseEnd)) {
+            r = (lo > eraseStart) ? lo : eraseStart;
+        } else if ((eraseEnd > MEM_SIZE(nvr)) && (lo < eraseEnd - MEM_SIZE(nvr))) {
+            r = lo + MEM_SIZE(nvr);   // the sectors at the start of memory come after the end
+        } else {
+            continue;
+        }
+        if ((found == 0) || (r < rank)) rank = r;
+        found = 1;
+    }
+    if (found) *sector = (rank % MEM_SIZE(nvr)) - (rank % MEM_SIZE(nvr)) % SECTOR_SIZE(nvr);
+    return found;
+}
+
+/**
+  * @brief      Moves the live records out of the sectors the next record of size bytes erases and
+  *             out of the sector behind them, so the memory can wrap around to a clean sector
+  * @param
+  * @retval     NVR_ERROR_FULL if there is no room for them
+  */
+static NVRError_t NVRCompactFor(NVRamKV_t *nvr, uint32_t size)
+{
+    NVRError_t ret;
+    uint32_t owf, sector, n;
+    for (n = MEM_SIZE(nvr) / SECTOR_SIZE(nvr); n; n--) {
+        if (0 == NVRLiveSector(nvr, NVRNextFileAddr(nvr, size, &owf), size, 1, &sector)) return NVR_ERROR_NONE;
+        if (0 != (ret = NVRCompactSector(nvr, sector))) return ret;
+    }
+    return NVR_ERROR_FULL;
+}
+
+/**
+  * @brief      Moves the live records of the sector to the write position
+  * @param      sector: relative addr
+  * @retval     NVR_ERROR_FULL if there is no room for them before the sector
+  */
+static NVRError_t NVRCompactSector(NVRamKV_t *nvr, uint32_t sector)
+{
+    NVRError_t ret;
+    uint32_t i = 0;
+    while (i < nvr->IndexCount) {
+        const NVRIndexEntry_t *e = &nvr->Index[i];
+        if ((e->Addr + e->Size <= sector) || (e->Addr - HEADER_SIZE(nvr) >= sector + SECTOR_SIZE(nvr))) {
+            i++;
+            continue;
+        }
+        if (0 != (ret = NVRRelocate(nvr, *e))) return ret;     // the entry is replaced by the moved record in place
+        if (nvr->Index == 0) return NVR_ERROR_HW;
+    }
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Copies the record to the write position page by page
+  * @param      x: copy of the index entry
+  * @retval     NVR_ERROR_FULL if the copy would erase live records
+  */
+static NVRError_t NVRRelocate(NVRamKV_t *nvr, NVRIndexEntry_t x)
+{
+    NVRError_t ret;
+    NVRPageBuf_t pb;
+    NVRHeader_t h;
+    NVRIndexEntry_t e;
+    uint8_t hb[sizeof(NVRHeader_t)];
+    uint32_t owf, sector;
+    uint32_t addr = NVRNextFileAddr(nvr, x.Size, &owf);
+    
+    if (NVRLiveSector(nvr, addr, x.Size, 0, &sector)) return NVR_ERROR_FULL;   // the source sector at least
+    if (0 != (ret = NVRWriteBackSync(nvr))) return ret;
+    if (0 != (ret = NVRRead(nvr, x.Addr - HEADER_SIZE(nvr) + MEM_START(nvr), hb, HEADER_SIZE(nvr)))) return ret;
+    NVRHeaderParse(nvr, hb, &h);
+    uint32_t lz = h.DataSize & SIZE_LZ;     // the payload is copied as stored
+    NVRMakeHeader(nvr, &h, &e, x.Id, addr, x.Size, x.CRC32);
+    h.DataSize |= lz;
+    h.DataSizeInv = ~h.DataSize;
+    addr += MEM_START(nvr);
+    
+    pb.Buf = nvr->Page;
+    pb.PageAddr = pb.Start = pb.Fill = 0;
+    pb.Complete = pb.Durable = 0;
+    pb.EraseAhead = 0;
+    if ((0 != (ret = NVRPageAppend(nvr, &pb, addr, hb, NVRHeaderPack(nvr, &h, hb), 0))) ||
+        (0 != (ret = NVRPageAppend(nvr, &pb, addr + HEADER_SIZE(nvr), 0, x.Size, x.Addr + MEM_START(nvr)))) ||
+        (0 != (ret = NVRPageFlush(nvr, &pb)))) {
+        nvr->Index = 0;     // the cursor is behind a broken record, let the next mount sort it out
+        return ret;
+    }
+    NVRIndexInsert(nvr, &e);
+    nvr->IndexHead = e;
+    NVRSummaryAdd(nvr, &e);
+    NVRHeaderCachePut(nvr, &e);
+    return NVREraseAhead(nvr, &e, 1);      // behind the copy: the source may lie in the sector
+}
+
+/**
+  * @brief      
+  * @param
+  * @retval     1 if the payload matches its CRC
+  */
+static uint8_t NVRRecordIntact(NVRamKV_t *nvr, const NVRIndexEntry_t *e)
+{
+    uint32_t crc = NVRCRC32Init(), pos = 0;
+    while (pos < e->Size) {
+        uint32_t chunkSize = (e->Size - pos > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : e->Size - pos;
+        if (NVR_ERROR_NONE != NVRRead(nvr, e->Addr + pos + MEM_START(nvr), nvr->Page, chunkSize)) return 0;
+        crc = NVRCRC32Update(crc, nvr->Page, chunkSize);
+        STATS_ADD(CRCBytes, chunkSize);
+        pos += chunkSize;
+    }
+    return NVRCRC32Final(crc) == e->CRC32;
+}
+
+/**
+  * @brief      Takes the sector from the pre-erased ones if it is the next of them,
+  *             otherwise the writes have left the reserve and it is forgotten
+  * @param      addr: absolute addr of the sector
+  * @retval     1 if the sector is erased already
+  */
+static uint8_t NVRTakeErased(NVRamKV_t *nvr, uint32_t addr)
+{
+    if ((nvr->ErasedCount) && (addr - MEM_START(nvr) == nvr->ErasedAddr)) {
+        nvr->ErasedCount--;
+        nvr->ErasedAddr += SECTOR_SIZE(nvr);
+        if (nvr->ErasedAddr >= MEM_SIZE(nvr)) nvr->ErasedAddr = 0;
+        return 1;
+    }
+    nvr->ErasedCount = 0;
+    return 0;
+}
+
+/**
+  * @brief      The sector the record following e starts unless the memory wraps around
+  * @param      e: relative addrs
+  * @param      sector: relative addr
+  * @retval     1 if e ends right before a sector
+  */
+static uint8_t NVRAheadSector(const NVRamKV_t *nvr, const NVRIndexEntry_t *e, uint32_t *sector)
+{
+    uint32_t next = NVRIterNextAddr(nvr, e);
+    if ((next % SECTOR_SIZE(nvr)) || (next + HEADER_SIZE(nvr) > MEM_SIZE(nvr))) return 0;
+    *sector = next;
+    return 1;
+}
+
+/**
+  * @brief      Erases the sector the record following e starts before e is programmed. The old header at 
+  *             the start of the sector may link to e by chance, the mount would take it for a newer record.
+  *             The sectors e enters are erased on the way, the writes take all of them as the reserve
+  * @param      e: the record to be written, relative addrs
+  * @param      written: e is programmed already, only the sector behind it is erased
+  * @retval     NVR_ERROR_FULL if the sector holds live records
+  */
+static NVRError_t NVREraseAhead(NVRamKV_t *nvr, const NVRIndexEntry_t *e, uint8_t written)
+{
+    uint32_t ahead, sector, have, i;
+    if (0 == NVRAheadSector(nvr, e, &ahead)) return NVR_ERROR_NONE;   // the next record goes behind e in its sector or to the start
+    
+    uint32_t first = e->Addr - HEADER_SIZE(nvr);    // the sector the write of e erases first
+    if (first % SECTOR_SIZE(nvr)) first += SECTOR_SIZE(nvr) - (first % SECTOR_SIZE(nvr));
+    if (written) first = ahead;
+    have = (first + MEM_SIZE(nvr) - nvr->ErasedAddr) % MEM_SIZE(nvr);
+    if ((nvr->ErasedCount == 0) || (have > nvr->ErasedCount * SECTOR_SIZE(nvr))) {     // the reserve doesnt reach the sector
+        nvr->ErasedAddr = first;
+        nvr->ErasedCount = 0;
+        have = 0;
+    }
+    for (sector = first + nvr->ErasedCount * SECTOR_SIZE(nvr) - have; sector <= ahead; sector += SECTOR_SIZE(nvr)) {
+        for (i = 0; (nvr->Flags & NVR_FLAGS_COMPACT) && (nvr->Index) && (i < nvr->IndexCount); i++) {
+            const NVRIndexEntry_t *x = &nvr->Index[i];
+            if ((x->Addr + x->Size > sector) && (x->Addr - HEADER_SIZE(nvr) < sector + SECTOR_SIZE(nvr))) return NVR_ERROR_FULL;
+        }
+        if (nvr->Index) NVRIndexDrop(nvr, sector + MEM_START(nvr), SECTOR_SIZE(nvr));
+        NVRSummaryDrop(nvr, sector + MEM_START(nvr), SECTOR_SIZE(nvr));
+        NVRHeaderCacheDrop(nvr, sector + MEM_START(nvr), SECTOR_SIZE(nvr));
+        if (0 != NVREraseLL(nvr, sector + MEM_START(nvr))) return NVR_ERROR_HW;
+        nvr->ErasedCount++;
+    }
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Scans the memory for the record moving the cursor, the index is used if there is one
+  * @param
+  * @retval
+  */
+static NVRError_t NVRScan(NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags, uint32_t emptyPagesLim)
+{
+    NVRError_t ret = NVR_ERROR_NONE;
+    
+    uint32_t start, end, half = 0, exit = 0;   
+    
+    *size = 0;
+    
+    if ((nvr->Index) && ((flags & (NVR_OPEN_FLAGS_FROM_CURRENT_POS | NVR_OPEN_FLAGS_ANY_ID)) == 0)) {
+        return NVRIndexOpen(nvr, cur, id, size, flags);
+    }
+    
+    if (((flags & NVR_OPEN_FLAGS_FROM_CURRENT_POS) == 0) || (cur->FoundFileAddr == 0)) {
+        if (flags & NVR_OPEN_FLAGS_BINARY_SEARCH) {
+            half = MEM_SIZE(nvr) / 2; 
+            start = MEM_START(nvr) + half;         
+        } else {
+            start = MEM_START(nvr);          
+        }
+    } else {
+        if ((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) {
+            int32_t a = cur->FileAddrPrev ? (cur->FileAddrPrev - HEADER_SIZE(nvr)) : (uint32_t)-1;
+            if (a >= 0) start = a + MEM_START(nvr);
+            else exit = 1;  // exit
+        } else {
+            if ((flags & NVR_OPEN_FLAGS_NEXT) == NVR_OPEN_FLAGS_NEXT) {
+                start = NVRCursorNextAddr(nvr, cur) + MEM_START(nvr);
+            } else {
+                start = ((cur->FoundFileAddr > HEADER_SIZE(nvr)) ? cur->FoundFileAddr - HEADER_SIZE(nvr) : 0) + MEM_START(nvr);
+            }
+        }
+    }
+    end = MEM_START(nvr) + MEM_SIZE(nvr); 
+    
+    uint64_t fileId = 0, fileIdPrev = 0, fileIdMax = 0;
+    uint32_t addr, addrPrev, s, crc, emptyPages = 0;   // we need crc holded separatly  
+    uint32_t deleted, links = MEM_SIZE(nvr) / HEADER_SIZE(nvr);     // a prev chain of deleted records ends too
+    uint32_t headSector = (nvr->HeadEnd % MEM_SIZE(nvr)) / SECTOR_SIZE(nvr);     // never skipped: the scan ends in its free space
+    uint8_t skip = (nvr->SummaryValid) && (nvr->HeadKnown) && 
+                   ((flags & (NVR_OPEN_FLAGS_ANY_ID | NVR_OPEN_FLAGS_NEAREST | NVR_OPEN_FLAGS_MAX_ID | NVR_OPEN_FLAGS_BINARY_SEARCH)) == 0) &&
+                   (((flags & NVR_OPEN_FLAGS_FIRST_MATCH) == 0) || (nvr->SummaryLive == 0));
+    cur->TryToOpen = 1;
+    cur->FileFound = cur->FoundFileAddr = cur->FoundFileSize = cur->FoundFileId = 0;
+    while ((start < end) && (exit == 0)) {
+        if (skip) {
+            uint32_t rel = start - MEM_START(nvr);
+            if ((rel / SECTOR_SIZE(nvr) != headSector) && (NVRSummaryMiss(nvr, rel, id))) {
+                start += SECTOR_SIZE(nvr) - (rel % SECTOR_SIZE(nvr));
+                STATS_ADD(SectorsSkipped, 1);
+                continue;
+            }
+        }
+        switch (ret = NVRCheckHeader(nvr, cur->Page, start, &addr, &addrPrev, &fileId, &s, &crc)) {
+            case NVR_ERROR_NONE:
+                start = addr + s;  // next addr to scan
+                if (nvr->Flags & NVR_FLAGS_PAGE_ALIGN) {
+                    uint32_t pageFilled = start % PAGE_SIZE(nvr);
+                    if (pageFilled) start += PAGE_SIZE(nvr) - pageFilled;    // else if 0 then addr is page aligned already
+                }                             
+                deleted = ((flags & NVR_OPEN_FLAGS_MAX_ID) == 0) && (NVRDeleted(nvr, fileId, s - HEADER_SIZE(nvr)));
+                if (deleted) {
+                    if (id == fileId) FILE_DELETED();       // until the id is written again
+                    if ((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) {
+                        if ((addrPrev >= HEADER_SIZE(nvr)) && (links--)) start = addrPrev - HEADER_SIZE(nvr) + MEM_START(nvr);
+                        else exit = 1;
+                    }
+                } else if ((flags & NVR_OPEN_FLAGS_MAX_ID) && (s == HEADER_SIZE(nvr))) {
+                    if ((cur->FileFound == 0) || (addrPrev == cur->FoundFileAddr)) FILE_FOUND();    // a tombstone keeps the id it deletes, the link tells the head
+                    else exit = 1;
+                } else if ((id == fileId) || (flags & NVR_OPEN_FLAGS_ANY_ID)) {                    
+                    FILE_FOUND();
+                    exit = flags & NVR_OPEN_FLAGS_FIRST_MATCH;
+                } else {
+                    if (flags & NVR_OPEN_FLAGS_NEAREST) {
+                        if ((id > fileIdPrev) && (id < fileId)) {
+                            FILE_FOUND();
+                            exit = 1;
+                        }
+                    } else {
+                        if (flags & NVR_OPEN_FLAGS_MAX_ID) {
+                            if (fileId >= fileIdMax) {
+                                fileIdMax = fileId;
+                                FILE_FOUND();
+                            } else {                                
+                                exit = 1;
+                            }
+                        }
+                    }
+                }
+                if ((deleted == 0) || ((flags & NVR_OPEN_FLAGS_NEAREST) == 0)) fileIdPrev = fileId;     // the nearest one is present
+            break;
+            case NVR_ERROR_EMPTY:
+                if (emptyPages < emptyPagesLim) emptyPages++;
+                else exit = 1;
+                if (fileIdPrev == 0) {
+                    if (flags & NVR_OPEN_FLAGS_BINARY_SEARCH) {
+                        if (half >= PAGE_SIZE(nvr) * 2) {
+                            half /= 2;
+                        }                        
+                        if (start >= MEM_START(nvr) + half) start -= half;
+                        else { 
+                            if (start == MEM_START(nvr)) return NVR_ERROR_EMPTY;
+                            else start = MEM_START(nvr);
+                        }
+                    } else {
+                        start += PAGE_SIZE(nvr);
+                    }
+                } else {
+                    exit = 1;
+                }
+                if (cur->FileFound) exit = 1;   // a file was found in a prev cycle
+            break;
+            case NVR_ERROR_HEADER:  // whether corrupted page or random place in a long (more than 1 page) entry
+                if ((flags & NVR_OPEN_FLAGS_PREVIOUS) == NVR_OPEN_FLAGS_PREVIOUS) {
+                    if (start >= PAGE_SIZE(nvr)) start -= PAGE_SIZE(nvr);
+                    else exit = 1;
+                } else {
+                    start += PAGE_SIZE(nvr);
+                }
+            break; 
+            default:
+                return ret;
+            break;
+        }
+    }
+    if (cur->FileFound) {
+        *size = cur->FoundFileSize;
+        ret = NVR_ERROR_OPENED;
+    } else {   
+        ret = NVR_ERROR_NOT_FOUND;
+    }
+    return ret;
+}
+
+    
+
+/**
+  * @brief      NVRGetNextAddr of the cursor
+  * @param
+  * @retval
+  */
+static uint32_t NVRCursorNextAddr(const NVRamKV_t *nvr, const NVRCursor_t *cur)
+{
+    uint32_t addr = 0;
+    if (cur->FoundFileAddr > 0) {
+        addr = cur->FoundFileAddr + cur->FoundFileSize;
+        if (nvr->Flags & NVR_FLAGS_PAGE_ALIGN) {            
+            uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+            if (pageFilled) addr += PAGE_SIZE(nvr) - pageFilled;
+        } 
+    }     
+    return addr;
+}
+
+/**
+  * @brief      The store's own cursor as a cursor
+  * @param
+  * @retval
+  */
+static void NVRCursorLoad(const NVRamKV_t *nvr, NVRCursor_t *cur)
+{
+    cur->FoundFileId = nvr->FoundFileId;
+    cur->FoundFileAddr = nvr->FoundFileAddr;
+    cur->FoundFileSize = nvr->FoundFileSize;
+    cur->FileAddrPrev = nvr->FileAddrPrev;
+    cur->CRC32Temp = nvr->CRC32Temp;
+    cur->FileFound = nvr->FileFound;
+    cur->TryToOpen = nvr->TryToOpen;
+    cur->Page = nvr->Page;
+    cur->Generation = nvr->Generation;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static void NVRCursorStore(NVRamKV_t *nvr, const NVRCursor_t *cur)
+{
+    nvr->FoundFileId = cur->FoundFileId;
+    nvr->FoundFileAddr = cur->FoundFileAddr;
+    nvr->FoundFileSize = cur->FoundFileSize;
+    nvr->FileAddrPrev = cur->FileAddrPrev;
+    nvr->CRC32Temp = cur->CRC32Temp;
+    nvr->FileFound = cur->FileFound;
+    nvr->TryToOpen = cur->TryToOpen;
+}
+
+/**
+  * @brief      Opens a file using the RAM index instead of scanning the memory
+  * @param
+  * @retval
+  */
+static NVRError_t NVRIndexOpen(const NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags)
+{
+    const NVRIndexEntry_t *e = 0;
+    
+    cur->TryToOpen = 1;
+    cur->FileFound = cur->FoundFileAddr = cur->FoundFileSize = cur->FoundFileId = 0;
+    if (flags & NVR_OPEN_FLAGS_MAX_ID) {
+        if (nvr->IndexHead.Addr) e = &nvr->IndexHead;      // the scan stops at the last written record as well
+    } else {
+        uint32_t i = NVRIndexFind(nvr, id);
+        if ((i < nvr->IndexCount) && ((nvr->Index[i].Id == id) || (flags & NVR_OPEN_FLAGS_NEAREST))) {
+            e = &nvr->Index[i];
+        }
+    }
+    if (e == 0) return NVR_ERROR_NOT_FOUND;
+    
+    cur->FileFound = 1;
+    cur->FoundFileId = e->Id;
+    cur->FoundFileAddr = e->Addr;
+    cur->FoundFileSize = e->Size;
+    cur->CRC32Temp = e->CRC32;
+    cur->FileAddrPrev = e->AddrPrev;
+    *size = e->Size;
+    return NVR_ERROR_OPENED;
+}
+
+/**
+  * @brief      
+  * @param
+  * @retval     position of the first entry with Id >= id
+  */
+static uint32_t NVRIndexFind(const NVRamKV_t *nvr, uint64_t id)
+{
+    uint32_t lo = 0, hi = nvr->IndexCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (nvr->Index[mid].Id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/**
+  * @brief      A tombstone or, if there is the RAM index, a record of an id deleted since
+  * @param      size: payload size of the record
+  * @retval     1 if the record is not to be opened
+  */
+static uint8_t NVRDeleted(const NVRamKV_t *nvr, uint64_t id, uint32_t size)
+{
+    if (size == 0) return 1;
+    if (nvr->Index == 0) return 0;
+    uint32_t i = NVRIndexFind(nvr, id);
+    return (i == nvr->IndexCount) || (nvr->Index[i].Id != id);
+}
+
+/**
+  * @brief      Bytes of the store from the read-ahead, the buffer is refilled if they are not in there
+  * @param      addr: relative addr
+  * @param      end: 0 to read ahead of addr, else the read-ahead ends at end (backward)
+  * @retval     0 if the bytes dont fit in the buffer or the LL fails
+  */
+static const uint8_t *NVRIterFetch(NVRamKV_t *nvr, NVRIter_t *it, uint32_t addr, uint32_t size, uint32_t end)
+{
+    if ((nvr->Base) && (0 == NVRWriteBackHit(nvr, addr + MEM_START(nvr), size))) return &nvr->Base[addr];
+    if ((it->BufLen) && (addr >= it->BufAddr) && (addr + size <= it->BufAddr + it->BufLen)) return &it->Buf[addr - it->BufAddr];
+    if (size > it->BufSize) return 0;
+    
+    uint32_t start = addr - addr % PAGE_SIZE(nvr), len = it->BufSize;
+    if (end) {
+        uint32_t from = (end > it->BufSize) ? end - it->BufSize : 0;
+        if ((from <= addr) && (end - addr <= PAGE_SIZE(nvr)) && ((nvr->Flags & NVR_FLAGS_PAGE_ALIGN) == 0)) start = from - from % PAGE_SIZE(nvr);
+        else len = PAGE_SIZE(nvr);                   // a record over a page or a page per record: the block would hold few headers, the header is read alone
+    }
+    if (addr + size > start + len) {
+        start = addr;
+        len = it->BufSize;
+    }
+    if (len > MEM_SIZE(nvr) - start) len = MEM_SIZE(nvr) - start;
+    it->BufLen = 0;
+    if (NVR_ERROR_NONE != NVRRead(nvr, start + MEM_START(nvr), it->Buf, len)) return 0;
+    it->BufAddr = start;
+    it->BufLen = len;
+    return &it->Buf[addr - start];
+}
+
+/**
+  * @brief      Parses the header that has to be at addr
+  * @param      addr: relative addr of the header
+  * @retval     1 if there is a valid one
+  */
+static uint8_t NVRIterHeader(NVRamKV_t *nvr, NVRIter_t *it, uint32_t addr, uint32_t end, NVRIndexEntry_t *e)
+{
+    NVRHeader_t h;
+    if (addr + HEADER_SIZE(nvr) > MEM_SIZE(nvr)) return 0;
+    const uint8_t *b = NVRIterFetch(nvr, it, addr, HEADER_SIZE(nvr), end);
+    if (b == 0) return 0;
+    if (0 == NVRHeaderParse(nvr, b, &h)) return 0;
+    h.DataSize &= ~SIZE_LZ;     // the stored size
+    if (addr + HEADER_SIZE(nvr) + h.DataSize > MEM_SIZE(nvr)) return 0;
+    STATS_ADD(HeadersParsed, 1);
+    e->Id = h.FileId;
+    e->Addr = addr + HEADER_SIZE(nvr);
+    e->Size = h.DataSize;
+    e->CRC32 = h.DataCRC32;
+    e->AddrPrev = h.FileAddrPrev;
+    return 1;
+}
+
+/**
+  * @brief      Where the record following e has been written unless the memory wrapped around, as NVRNextFileAddr
+  * @param
+  * @retval     relative addr of the header
+  */
+static uint32_t NVRIterNextAddr(const NVRamKV_t *nvr, const NVRIndexEntry_t *e)
+{
+    uint32_t addr = e->Addr + e->Size;
+    uint32_t pageFilled = addr % PAGE_SIZE(nvr);
+    uint32_t pageRemain = PAGE_SIZE(nvr) - pageFilled;
+    if ((pageFilled && (nvr->Flags & NVR_FLAGS_PAGE_ALIGN)) || (pageRemain < HEADER_SIZE(nvr))) addr += pageRemain;
+    return addr;
+}
+
+/**
+  * @brief      The neighbour of cur in the write order. The stale records left by the older passes are told 
+  *             by the link to the previous record and by the id going down. The tombstones and, if there is
+  *             the RAM index, the records of the deleted ids are stepped over.
+  * @param
+  * @retval     1 if there is one
+  */
+static uint8_t NVRIterStep(NVRamKV_t *nvr, NVRIter_t *it, const NVRIndexEntry_t *cur, NVRIndexEntry_t *e, uint8_t backward)
+{
+    NVRIndexEntry_t c = *cur;
+    uint64_t id = (cur->Size) ? cur->Id : ((backward) ? UINT64_MAX : 0);
+    uint32_t steps;
+    for (steps = MEM_SIZE(nvr) / HEADER_SIZE(nvr); steps; steps--, c = *e) {
+        if (backward) {
+            if ((0 == NVRIterPrev(nvr, it, &c, e)) || ((e->Size) && (e->Id > id))) return 0;
+        } else {
+            if (c.Addr == nvr->IndexHead.Addr) return 0;         // the newest one
+            uint32_t next = NVRIterNextAddr(nvr, &c);
+            if (((0 == NVRIterHeader(nvr, it, next, 0, e)) || (e->AddrPrev != c.Addr) || ((e->Size) && (e->Id < id))) && 
+                ((next == 0) || (0 == NVRIterHeader(nvr, it, 0, 0, e)) || (e->AddrPrev != c.Addr) || ((e->Size) && (e->Id < id)))) return 0;     // the memory wrapped around
+        }
+        if (0 == NVRDeleted(nvr, e->Id, e->Size)) return 1;     // a tombstone keeps the id it deletes, out of the order
+    }
+    return 0;
+}
+
+/**
+  * @brief      The record cur links back to, the read-ahead goes backward from cur
+  * @param
+  * @retval     1 if it is still there
+  */
+static uint8_t NVRIterPrev(NVRamKV_t *nvr, NVRIter_t *it, const NVRIndexEntry_t *cur, NVRIndexEntry_t *e)
+{
+    uint32_t hdr = cur->Addr - HEADER_SIZE(nvr);
+    if (cur->AddrPrev < HEADER_SIZE(nvr)) return 0;            // the first record ever
+    if (0 == NVRIterHeader(nvr, it, cur->AddrPrev - HEADER_SIZE(nvr), (hdr) ? hdr : MEM_SIZE(nvr), e)) return 0;
+    if ((nvr->HeadKnown) && (e->Addr == nvr->IndexHead.Addr)) return 0;     // round the ring: cur is the oldest one
+    return (hdr == 0) || (NVRIterNextAddr(nvr, e) == hdr);  // else it has been overwritten by a newer one
+}
+
+/**
+  * @brief      The first header at or behind the sector k of the ring, not a tombstone
+  * @param      k: sectors behind the head sector, 0 is the oldest one
+  * @retval     1 if there is one
+  */
+static uint8_t NVRIterProbe(NVRamKV_t *nvr, NVRIter_t *it, const NVRRing_t *r, uint32_t k, NVRIndexEntry_t *e)
+{
+    it->BufLen = 0;                                 // the buffer is the page of NVRCheckHeader
+    for (; k < r->Sectors; k++) {
+        uint32_t sector = (r->HeadSector + 1 + k) % r->Sectors;
+        uint32_t addr = sector * SECTOR_SIZE(nvr);
+        uint32_t end = (addr + SECTOR_SIZE(nvr) < MEM_SIZE(nvr)) ? addr + SECTOR_SIZE(nvr) : MEM_SIZE(nvr);
+        if ((sector > r->HeadSector) && (addr >= r->DeadFrom)) continue;
+        while (addr < end) {
+            uint32_t a, prev, size, crc;
+            uint64_t id;
+            NVRError_t ret = NVRCheckHeader(nvr, it->Buf, addr + MEM_START(nvr), &a, &prev, &id, &size, &crc);
+            if ((ret == NVR_ERROR_NONE) && (size == HEADER_SIZE(nvr))) {
+                addr = a - MEM_START(nvr) + size;   // a tombstone, the header behind it
+                continue;
+            }
+            if (ret == NVR_ERROR_NONE) {
+                e->Id = id;
+                e->Addr = a - MEM_START(nvr) + HEADER_SIZE(nvr);
+                e->Size = size - HEADER_SIZE(nvr);
+                e->CRC32 = crc;
+                e->AddrPrev = prev;
+                return 1;
+            }
+            if (ret != NVR_ERROR_HEADER) break;     // erased, the next sector
+            addr += PAGE_SIZE(nvr) - (addr % PAGE_SIZE(nvr));
+        }
+    }
+    return 0;
+}
+
+/**
+  * @brief      Where a seek starts to read the headers one by one: the last record with id < key 
+  *             found by the binary search, the oldest record if there is none
+  * @param
+  * @retval     1 if there is a record
+  */
+static uint8_t NVRIterStart(NVRamKV_t *nvr, NVRIter_t *it, uint64_t key, NVRIndexEntry_t *e)
+{
+    if (nvr->Index) {
+        if (nvr->IndexCount == 0) return 0;
+        uint32_t i = NVRIndexFind(nvr, key);
+        *e = nvr->Index[(i) ? i - 1 : 0];
+        return 1;
+    }
+    
+    NVRRing_t r;
+    NVRIndexEntry_t m;
+    r.Sectors = (MEM_SIZE(nvr) + SECTOR_SIZE(nvr) - 1) / SECTOR_SIZE(nvr);
+    r.HeadSector = (nvr->HeadEnd - 1) / SECTOR_SIZE(nvr);
+    r.DeadFrom = MEM_SIZE(nvr);
+    if ((NVRIterHeader(nvr, it, 0, 0, &m)) && (m.AddrPrev)) r.DeadFrom = m.AddrPrev;   // the record before the last wrap around ends the live data
+    
+    if (0 == NVRIterProbe(nvr, it, &r, 0, e)) return 0;
+    uint32_t lo = 0, hi = r.Sectors;                // probe(lo) < key, probe(hi) >= key
+    if (e->Id >= key) return 1;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((NVRIterProbe(nvr, it, &r, mid, &m)) && (m.Id < key)) {
+            lo = mid;
+            *e = m;
+        } else {
+            hi = mid;
+        }
+    }
+    return 1;
+}
+
+/**
+  * @brief      If the memory has been written since the last call the read-ahead is dropped 
+  *             and the header is checked again, the record may have been erased
+  * @param
+  * @retval     1 if the record is still there
+  */
+static uint8_t NVRIterCheck(NVRamKV_t *nvr, NVRIter_t *it)
+{
+    NVRIndexEntry_t e;
+    if (it->Generation == nvr->Generation) return 1;
+    it->BufLen = 0;
+    it->Generation = nvr->Generation;
+    return (NVRIterHeader(nvr, it, it->Rec.Addr - HEADER_SIZE(nvr), 0, &e)) && (e.Id == it->Rec.Id) && 
+           (e.Size == it->Rec.Size) && (e.CRC32 == it->Rec.CRC32);
+}
+
+/**
+  * @brief      Inserts or replaces an entry, a tombstone removes it. Drops the index if there is no room
+  * @param
+  * @retval
+  */
+static void NVRIndexInsert(NVRamKV_t *nvr, const NVRIndexEntry_t *e)
+{
+    uint32_t i = NVRIndexFind(nvr, e->Id);
+    if ((i < nvr->IndexCount) && (nvr->Index[i].Id == e->Id)) {
+        if (e->Size) {
+            nvr->Index[i] = *e;
+        } else {        // a tombstone: the id is gone
+            memmove(&nvr->Index[i], &nvr->Index[i + 1], (nvr->IndexCount - i - 1) * sizeof(NVRIndexEntry_t));
+            nvr->IndexCount--;
+        }
+        return;
+    }
+    if (e->Size == 0) return;
+    if (nvr->IndexCount == nvr->IndexCapacity) {
+        nvr->Index = 0;
+        return;
+    }
+    memmove(&nvr->Index[i + 1], &nvr->Index[i], (nvr->IndexCount - i) * sizeof(NVRIndexEntry_t));
+    nvr->Index[i] = *e;
+    nvr->IndexCount++;
+}
+
+/**
+  * @brief      Adds a record found by the mount scan. Of equal ids the newer record is kept,
+  *             tombstones too as older records of the id may follow
+  * @param      index: the index being built, nvr->Index is not set yet
+  * @param      headAddr: the last written record if the scan is behind it, else 0
+  * @retval     NVR_ERROR_FULL if there is no room for a new id
+  */
+static NVRError_t NVRIndexScanAdd(NVRamKV_t *nvr, NVRIndexEntry_t *index, const NVRIndexEntry_t *e, uint32_t headAddr)
+{
+    uint32_t lo = 0, hi = nvr->IndexCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (index[mid].Id < e->Id) lo = mid + 1;
+        else hi = mid;
+    }
+    if ((lo < nvr->IndexCount) && (index[lo].Id == e->Id)) {
+        if (index[lo].Addr > headAddr) index[lo] = *e;     // else the entry is of the newest pass over the memory
+        return NVR_ERROR_NONE;
+    }
+    if (nvr->IndexCount == nvr->IndexCapacity) return NVR_ERROR_FULL;
+    memmove(&index[lo + 1], &index[lo], (nvr->IndexCount - lo) * sizeof(NVRIndexEntry_t));
+    index[lo] = *e;
+    nvr->IndexCount++;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Removes the entries of the deleted ids when the scan is over
+  * @param
+  * @retval
+  */
+static void NVRIndexPurge(NVRamKV_t *nvr)
+{
+    uint32_t i, n = 0;
+    for (i = 0; i < nvr->IndexCount; i++) {
+        if (nvr->Index[i].Size == 0) continue;
+        if (n != i) nvr->Index[n] = nvr->Index[i];
+        n++;
+    }
+    nvr->IndexCount = n;
+}
+
+/**
+  * @brief      Removes the entries of the records in the sectors which are erased writing [addr, addr + size)
+  * @param      addr: absolute addr
+  * @retval
+  */
+static void NVRIndexDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size)
+{
+    uint32_t eraseStart, eraseEnd;
+    if (0 == NVREraseRange(nvr, addr, size, &eraseStart, &eraseEnd)) return;
+    
+    uint32_t i, n = 0;
+    for (i = 0; i < nvr->IndexCount; i++) {
+        const NVRIndexEntry_t *e = &nvr->Index[i];
+        if ((e->Addr + e->Size > eraseStart) && (e->Addr - HEADER_SIZE(nvr) < eraseEnd)) continue;
+        if (n != i) nvr->Index[n] = *e;
+        n++;
+    }
+    nvr->IndexCount = n;
+}
+
+/**
+  * @brief      The sectors a write of size bytes at addr erases
+  * @param      addr: absolute addr
+  * @param      start, end: relative addrs of the sectors
+  * @retval     0 if none
+  */
+static uint8_t NVREraseRange(const NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint32_t *start, uint32_t *end)
+{
+    uint32_t sectorFilled = addr % SECTOR_SIZE(nvr);
+    uint32_t eraseStart = sectorFilled ? addr + SECTOR_SIZE(nvr) - sectorFilled : addr;   // NVRWrite doesnt erase the sector it starts in the middle of
+    uint32_t eraseEnd = addr + size;
+    if (eraseStart >= eraseEnd) return 0;
+    if (eraseEnd % SECTOR_SIZE(nvr)) eraseEnd += SECTOR_SIZE(nvr) - (eraseEnd % SECTOR_SIZE(nvr));
+    *start = eraseStart - MEM_START(nvr);     // make relative addr
+    *end = eraseEnd - MEM_START(nvr);
+    return 1;
+}
+
+/**
+  * @brief      Empties all the summaries
+  * @param
+  * @retval
+  */
+static void NVRSummaryReset(NVRamKV_t *nvr)
+{
+    uint32_t i, n = (MEM_SIZE(nvr) + SECTOR_SIZE(nvr) - 1) / SECTOR_SIZE(nvr);
+    if (nvr->Summary == 0) return;
+    for (i = 0; i < n; i++) {
+        memset(&nvr->Summary[i], 0, sizeof(NVRSummary_t));
+        nvr->Summary[i].MinId = (uint64_t)-1;
+    }
+}
+
+/**
+  * @brief      Adds the id to the summary of the sector holding the header
+  * @param
+  * @retval
+  */
+static void NVRSummaryAdd(NVRamKV_t *nvr, const NVRIndexEntry_t *e)
+{
+    if (nvr->Summary == 0) return;
+    NVRSummary_t *sum = &nvr->Summary[(e->Addr - HEADER_SIZE(nvr)) / SECTOR_SIZE(nvr)];
+    uint64_t h = NVRSummaryHash(e->Id);
+    uint32_t k;
     
-    if (0 != nvr->NVRReadDataLL(addr, nvr->Page, bytesToRead)) {
-        return NVR_ERROR_HW;
+    if (e->Id < sum->MinId) sum->MinId = e->Id;
+    if (e->Id > sum->MaxId) sum->MaxId = e->Id;
+    for (k = 0; k < 3; k++, h >>= 16) {     // 3 probes out of the hash
+        uint32_t bit = (uint32_t)(h % NVR_SUMMARY_BLOOM_BITS);
+        sum->Bloom[bit / 8] |= (uint8_t)(1 << (bit % 8));
     }
-    uint8_t empty = 1;
-    while (offset < bytesToRead - NVRHeaderSize) {        
-        const NVRHeader_t *h = (NVRHeader_t *)&nvr->Page[offset];         
-        if ((h->Preamble == PREAMBLE) && (h->FileId == ~h->FileIdInv) && (h->DataSize != 0) && (h->DataSize == ~h->DataSizeInv) && (h->FileAddrPrev == ~h->FileAddrPrevInv)) {      // the write procedure doesnt split the header into two pages
-            *currAddr = addr + offset;
-            *currId = h->FileId;                                    
-            *currSize = NVRHeaderSize + h->DataSize; 
-            *crc = h->DataCRC32; 
-            *prevAddr = h->FileAddrPrev;
-            return NVR_ERROR_NONE;                
-        } else {
-            if (0 != memcmp(h, &EmptyNVRHeader, NVRHeaderSize)) {
-                empty = 0;
-            }
-            offset++;
-        }        
+}
+
+/**
+  * @brief      Empties the summaries of the sectors a write at addr erases, as NVRIndexDrop
+  * @param      addr: absolute addr
+  * @retval
+  */
+static void NVRSummaryDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size)
+{
+    uint32_t start, end;
+    if ((nvr->Summary == 0) || (0 == NVREraseRange(nvr, addr, size, &start, &end))) return;
+    for (; (start < end) && (start < MEM_SIZE(nvr)); start += SECTOR_SIZE(nvr)) {
+        NVRSummary_t *sum = &nvr->Summary[start / SECTOR_SIZE(nvr)];
+        memset(sum, 0, sizeof(NVRSummary_t));
+        sum->MinId = (uint64_t)-1;
     }
-    if (empty) return NVR_ERROR_EMPTY;
-    else return NVR_ERROR_HEADER;
 }
 
 /**
-  * @brief
+  * @brief      Keeps the header decoded, the oldest one is replaced if the ring is full
   * @param
   * @retval
   */
-static NVRError_t NVRWrite(NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size, uint32_t flags)
+static void NVRHeaderCachePut(NVRamKV_t *nvr, const NVRIndexEntry_t *e)
 {
-    if (nvr->NotReady) return NVR_ERROR_INIT;
-    if (nvr->TryToOpen == 0) return NVR_ERROR_NOT_FOUND;
-    if (data == 0) return NVR_ERROR_ARGUMENT;
+    NVRHeaderCache_t *c = &nvr->HeaderCache;
+    uint32_t i;
+    if (c->Count == 0) return;
+    for (i = 0; i < c->Count; i++) {
+        if (c->Ring[i].Addr == e->Addr) {
+            c->Ring[i] = *e;
+            return;
+        }
+    }
+    c->Ring[c->Next] = *e;
+    c->Next = (c->Next + 1) % c->Count;
+}
+
+/**
+  * @brief      Forgets the headers of the sectors a write at addr erases, as NVRIndexDrop. 
+  *             The block read before is dropped on any write.
+  * @param      addr: absolute addr
+  * @retval
+  */
+static void NVRHeaderCacheDrop(NVRamKV_t *nvr, uint32_t addr, uint32_t size)
+{
+    NVRHeaderCache_t *c = &nvr->HeaderCache;
+    uint32_t i, start, end;
+    c->Block.BufLen = 0;
+    if ((c->Count == 0) || (0 == NVREraseRange(nvr, addr, size, &start, &end))) return;
+    for (i = 0; i < c->Count; i++) {
+        const NVRIndexEntry_t *e = &c->Ring[i];
+        if ((e->Addr) && (e->Addr + e->Size > start) && (e->Addr - HEADER_SIZE(nvr) < end)) c->Ring[i].Addr = 0;
+    }
+}
+
+/**
+  * @brief      NVR_OPEN_FLAGS_PREVIOUS served by the cache. On a miss a block ending at the cursor 
+  *             is read and the headers linked back in there are decoded at once. The links are 
+  *             followed past the deleted records as the scan does.
+  * @param
+  * @retval     1 if the cursor is moved, else the scan does it
+  */
+static uint8_t NVRHeaderCachePrev(NVRamKV_t *nvr, NVRCursor_t *cur)
+{
+    NVRHeaderCache_t *c = &nvr->HeaderCache;
+    NVRIndexEntry_t x, e;
+    uint32_t links = MEM_SIZE(nvr) / HEADER_SIZE(nvr);
+    if ((c->Count == 0) || (cur->FoundFileAddr == 0) || (cur->FileAddrPrev < HEADER_SIZE(nvr))) return 0;
     
-    NVRError_t ret = NVR_ERROR_NONE;
-    uint32_t sectorChunkSize;
-    uint32_t remain = size, offset = 0;
-    uint32_t stop = 0;
-    uint32_t finishSector = (addr % nvr->SectorSize) ? 1 : 0;
-    uint32_t sectorRemain = nvr->SectorSize - (addr % nvr->SectorSize);
-    uint32_t pageRemain = nvr->PageSize - (addr % nvr->PageSize);
-    uint32_t endMem = nvr->MemoryStartAddr + nvr->MemorySize;
-       
+    x.Id = cur->FoundFileId;
+    x.Addr = cur->FoundFileAddr;
+    x.Size = cur->FoundFileSize;
+    x.CRC32 = cur->CRC32Temp;
+    x.AddrPrev = cur->FileAddrPrev;
     do {
-        if (addr == endMem) addr = nvr->MemoryStartAddr;
-        if (remain > sectorRemain) {
-            sectorChunkSize = sectorRemain;
-            remain -= sectorRemain;
-            sectorRemain = nvr->SectorSize;
+        if ((links-- == 0) || (0 == NVRHeaderCacheStep(nvr, &x, &e))) return 0;
+        x = e;
+    } while (NVRDeleted(nvr, e.Id, e.Size));
+    cur->TryToOpen = cur->FileFound = 1;
+    cur->FoundFileId = e.Id;
+    cur->FoundFileAddr = e.Addr;
+    cur->FoundFileSize = e.Size;
+    cur->CRC32Temp = e.CRC32;
+    cur->FileAddrPrev = e.AddrPrev;
+    return 1;
+}
+
+/**
+  * @brief      The record linked before x from the ring or from the block
+  * @param
+  * @retval     1 if it is there
+  */
+static uint8_t NVRHeaderCacheStep(NVRamKV_t *nvr, const NVRIndexEntry_t *x, NVRIndexEntry_t *e)
+{
+    NVRHeaderCache_t *c = &nvr->HeaderCache;
+    NVRIndexEntry_t p, q;
+    uint32_t i;
+    if (x->AddrPrev < HEADER_SIZE(nvr)) return 0;
+    
+    for (i = 0; (i < c->Count) && (c->Ring[i].Addr != x->AddrPrev); i++);
+    if (i < c->Count) {
+        *e = c->Ring[i];
+        return 1;
+    }
+    if (0 == NVRIterPrev(nvr, &c->Block, x, e)) return 0;
+    NVRHeaderCachePut(nvr, e);
+    for (p = *e, i = 1; i < c->Count; i++) {     // the rest of the chain in the block
+        if ((p.AddrPrev < HEADER_SIZE(nvr)) || (p.AddrPrev - HEADER_SIZE(nvr) < c->Block.BufAddr) || 
+            (p.AddrPrev > c->Block.BufAddr + c->Block.BufLen)) break;
+        if (0 == NVRIterPrev(nvr, &c->Block, &p, &q)) break;
+        NVRHeaderCachePut(nvr, &q);
+        p = q;
+    }
+    return 1;
+}
+
+/**
+  * @brief      Packs the record into the work buff: the unpacked size in 4 bytes, then the tokens.
+  *             Greedy matching, the table keeps the last position of every hashed 3 bytes.
+  * @param
+  * @retval     size of the packed record, 0 if it doesnt fit or doesnt get smaller
+  */
+static uint32_t NVRLZCompress(NVRamKV_t *nvr, const uint8_t *data, uint32_t size)
+{
+    uint32_t *table = LZ_TABLE(nvr);
+    uint8_t *out = LZ_OUT(nvr);
+    uint32_t cap = nvr->LZWorkSize - NVR_LZ_WORK_MIN, o = 4, i = 0, lit = 0;
+    
+    if (size <= o + LZ_MATCH_MIN) return 0;
+    if (cap >= size) cap = size - 1;    // it must get smaller
+    memset(table, 0xFF, sizeof(uint32_t) << NVR_LZ_HASH_BITS);
+    out[0] = (uint8_t)size;
+    out[1] = (uint8_t)(size >> 8);
+    out[2] = (uint8_t)(size >> 16);
+    out[3] = (uint8_t)(size >> 24);
+    
+    while (1) {
+        uint32_t len = 0, cand = LZ_NONE;
+        if (i + LZ_MATCH_MIN <= size) {
+            uint32_t k = ((data[i] | ((uint32_t)data[i + 1] << 8) | ((uint32_t)data[i + 2] << 16)) * 2654435761u) >> (32 - NVR_LZ_HASH_BITS);
+            cand = table[k];
+            table[k] = i;
+            if ((cand != LZ_NONE) && (i - cand <= NVR_LZ_WINDOW)) {
+                while ((len < LZ_MATCH_MAX) && (i + len < size) && (data[cand + len] == data[i + len])) len++;
+            }
+            if (len < LZ_MATCH_MIN) {
+                i++;
+                continue;
+            }
         } else {
-            sectorChunkSize = remain;
-            stop = 1;
+            i = size;       // the tail goes as literals
         }
-        if (finishSector) {
-            finishSector = 0;
-        } else {
-            nvr->NVREraseSectorLL(addr);            
+        while (lit < i) {
+            uint32_t n = (i - lit > LZ_LITERALS_MAX) ? LZ_LITERALS_MAX : i - lit;
+            if (o + 1 + n > cap) return 0;
+            out[o++] = (uint8_t)(n - 1);
+            memcpy(&out[o], &data[lit], n);
+            o += n;
+            lit += n;
+        }
+        if (i == size) break;
+        if (o + 3 > cap) return 0;
+        out[o++] = (uint8_t)(LZ_LITERALS_MAX | (len - LZ_MATCH_MIN));
+        out[o++] = (uint8_t)(i - cand);
+        out[o++] = (uint8_t)((i - cand) >> 8);
+        for (lit = i + len, i++; (i < lit) && (i + LZ_MATCH_MIN <= size); i++) {     // the positions inside the match are hashed too
+            table[((data[i] | ((uint32_t)data[i + 1] << 8) | ((uint32_t)data[i + 2] << 16)) * 2654435761u) >> (32 - NVR_LZ_HASH_BITS)] = i;
+        }
+        i = lit;
+    }
+    return o;
+}
+
+/**
+  * @brief      Unpacks the next size bytes of the stream. The stored bytes are read through the page buff 
+  *             and taken into the CRC, the window keeps the last NVR_LZ_WINDOW bytes unpacked for the matches.
+  * @param      data: 0 - the bytes are skipped
+  * @retval     NVR_ERROR_CRC if the tokens are broken
+  */
+static NVRError_t NVRLZDecode(NVRamKV_t *nvr, NVRReadStream_t *rs, uint8_t *data, uint32_t size)
+{
+    NVRError_t ret = NVR_ERROR_NONE;
+    uint8_t *win = nvr->LZWork;
+    uint32_t n = 0, in = 0, inLen = 0;
+    
+    while ((n < size) && (ret == NVR_ERROR_NONE)) {
+        uint8_t b;
+        if (rs->State == LZ_STATE_MATCH) {
+            b = win[(rs->Out - rs->Offset) & (NVR_LZ_WINDOW - 1)];
+            win[rs->Out++ & (NVR_LZ_WINDOW - 1)] = b;
+            if (data) data[n] = b;
+            n++;
+            if (--rs->Copy == 0) rs->State = LZ_STATE_TOKEN;
+            continue;
+        }
+        if (in == inLen) {      // the next stored chunk, the consumed one goes to the CRC
+            rs->CRC32 = NVRCRC32Update(rs->CRC32, nvr->Page, in);
+            STATS_ADD(CRCBytes, in);
+            rs->Pos += in;
+            in = 0;
+            inLen = (rs->Size - rs->Pos > PAGE_SIZE(nvr)) ? PAGE_SIZE(nvr) : rs->Size - rs->Pos;
+            if (inLen == 0) return NVR_ERROR_CRC;       // the tokens run over the record
+            if (0 != (ret = NVRRead(nvr, rs->Addr + rs->Pos + MEM_START(nvr), nvr->Page, inLen))) return ret;
+        }
+        b = nvr->Page[in++];
+        switch (rs->State) {
+        case LZ_STATE_SIZE:
+            if (--rs->Copy == 0) rs->State = LZ_STATE_TOKEN;
+            break;
+        case LZ_STATE_TOKEN:
+            rs->Copy = (b < LZ_LITERALS_MAX) ? b + 1 : (b & (LZ_LITERALS_MAX - 1)) + LZ_MATCH_MIN;
+            rs->State = (b < LZ_LITERALS_MAX) ? LZ_STATE_LITERALS : LZ_STATE_OFFSET_LO;
+            break;
+        case LZ_STATE_LITERALS:
+            win[rs->Out++ & (NVR_LZ_WINDOW - 1)] = b;
+            if (data) data[n] = b;
+            n++;
+            if (--rs->Copy == 0) rs->State = LZ_STATE_TOKEN;
+            break;
+        case LZ_STATE_OFFSET_LO:
+            rs->Offset = b;
+            rs->State = LZ_STATE_OFFSET_HI;
+            break;
+        default:
+            rs->Offset |= (uint16_t)(b << 8);
+            if ((rs->Offset == 0) || (rs->Offset > NVR_LZ_WINDOW) || (rs->Offset > rs->Out)) ret = NVR_ERROR_CRC;
+            rs->State = LZ_STATE_MATCH;
+            break;
+        }
+    }
+    rs->CRC32 = NVRCRC32Update(rs->CRC32, nvr->Page, in);
+    STATS_ADD(CRCBytes, in);
+    rs->Pos += in;
+    return ret;
+}
+
+/**
+  * @brief      Sets the stream at the start of the found record
+  * @param      raw: unpacked size, 0 if the record is stored as is
+  * @retval
+  */
+static void NVRLZBegin(NVRamKV_t *nvr, NVRReadStream_t *rs, uint32_t raw)
+{
+    rs->Addr = nvr->FoundFileAddr;
+    rs->Size = nvr->FoundFileSize;
+    rs->Pos = 0;
+    rs->CRC32 = NVRCRC32Init();
+    rs->CRC32Expected = nvr->CRC32Temp;
+    rs->Raw = raw;
+    rs->Out = 0;
+    rs->Copy = 4;
+    rs->Offset = 0;
+    rs->State = LZ_STATE_SIZE;
+}
+
+/**
+  * @brief      Reads the header of the found record once to know if it is compressed
+  * @param      raw: unpacked size, 0 if the record is stored as is or the compression is off
+  * @retval
+  */
+static NVRError_t NVRFoundRaw(NVRamKV_t *nvr, uint32_t *raw)
+{
+    NVRError_t ret;
+    *raw = 0;
+    if (nvr->LZWork == 0) return NVR_ERROR_NONE;
+    if (nvr->FoundFileRawAddr != nvr->FoundFileAddr) {
+        uint8_t b[sizeof(NVRHeader_t) + 4];
+        NVRHeader_t h;
+        uint32_t n = HEADER_SIZE(nvr) + ((nvr->FoundFileSize < 4) ? nvr->FoundFileSize : 4);
+        if (0 != (ret = NVRRead(nvr, nvr->FoundFileAddr - HEADER_SIZE(nvr) + MEM_START(nvr), b, n))) return ret;
+        NVRHeaderParse(nvr, b, &h);
+        nvr->FoundFileRaw = 0;
+        if ((h.DataSize & SIZE_LZ) && (n == HEADER_SIZE(nvr) + 4)) {
+            nvr->FoundFileRaw = b[HEADER_SIZE(nvr)] | ((uint32_t)b[HEADER_SIZE(nvr) + 1] << 8) | ((uint32_t)b[HEADER_SIZE(nvr) + 2] << 16) | ((uint32_t)b[HEADER_SIZE(nvr) + 3] << 24);
         }
+        nvr->FoundFileRawAddr = nvr->FoundFileAddr;
+    }
+    *raw = nvr->FoundFileRaw;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Puts the record in the write-back page buff, the full pages are programmed on the way. 
+  *             A record begun on a programmed page is programmed to its end, a power loss doesnt tear it.
+  * @param      addr: absolute addr
+  * @retval
+  */
+static NVRError_t NVRWriteBackPut(NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt)
+{
+    NVRPageBuf_t *wb = &nvr->WriteBack;
+    NVRError_t ret = NVR_ERROR_NONE;
+    uint32_t i, page = wb->PageAddr, start = addr;
+    uint8_t dirty = (wb->Fill != wb->Start);
+    
+    for (i = 0; (i < iovCnt) && (ret == NVR_ERROR_NONE); i++) {
+        if (iov[i].Size) ret = NVRPageAppend(nvr, wb, addr, iov[i].Data, iov[i].Size, 0);
+        addr += iov[i].Size;
+    }
+    if (ret != NVR_ERROR_NONE) return ret;
+    wb->Complete++;
+    if ((wb->Fill != wb->Start) && (start < wb->PageAddr + wb->Start)) return NVRPageFlush(nvr, wb);     // the header is on the flash, the tail goes too
+    if ((wb->Fill != wb->Start) && ((dirty == 0) || (wb->PageAddr != page))) {     // the older ones are programmed
+        nvr->WriteBackSince = (nvr->WriteBackClock) ? nvr->WriteBackClock() : 0;
+    }
+    return (NVRWriteBackDue(nvr)) ? NVRWriteBackSync(nvr) : NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Programs the buffered part of the write-back page
+  * @param
+  * @retval
+  */
+static NVRError_t NVRWriteBackSync(NVRamKV_t *nvr)
+{
+    if (nvr->WriteBack.Buf == 0) return NVR_ERROR_NONE;
+    return NVRPageFlush(nvr, &nvr->WriteBack);
+}
+
+/**
+  * @brief      
+  * @param
+  * @retval     1 if the oldest buffered record has waited the timeout
+  */
+static uint8_t NVRWriteBackDue(const NVRamKV_t *nvr)
+{
+    const NVRPageBuf_t *wb = &nvr->WriteBack;
+    if ((wb->Buf == 0) || (wb->Fill == wb->Start) || (nvr->WriteBackClock == 0) || (nvr->WriteBackTimeout == 0)) return 0;
+    return (uint32_t)(nvr->WriteBackClock() - nvr->WriteBackSince) >= nvr->WriteBackTimeout;
+}
+
+/**
+  * @brief      
+  * @param      addr: absolute addr
+  * @retval     1 if the range holds bytes not programmed yet
+  */
+static uint8_t NVRWriteBackHit(const NVRamKV_t *nvr, uint32_t addr, uint32_t size)
+{
+    const NVRPageBuf_t *wb = &nvr->WriteBack;
+    return (wb->Buf) && (wb->Fill != wb->Start) && (addr < wb->PageAddr + wb->Fill) && (addr + size > wb->PageAddr + wb->Start);
+}
+
+/**
+  * @brief      Copies the bytes not programmed yet over the bytes read from the flash
+  * @param      addr: absolute addr data was read from
+  * @retval
+  */
+static void NVRWriteBackOverlay(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size)
+{
+    const NVRPageBuf_t *wb = &nvr->WriteBack;
+    if (0 == NVRWriteBackHit(nvr, addr, size)) return;
+    uint32_t from = (addr > wb->PageAddr + wb->Start) ? addr : wb->PageAddr + wb->Start;
+    uint32_t to = (addr + size < wb->PageAddr + wb->Fill) ? addr + size : wb->PageAddr + wb->Fill;
+    memcpy(&data[from - addr], &wb->Buf[from - wb->PageAddr], to - from);
+}
+
+/**
+  * @brief      Reads through the page cache. A missed page is loaded into the least recently used slot,
+  *             a whole page of a payload only if it is there already, so a long record doesnt evict the headers.
+  * @param      addr: absolute addr
+  * @param      keep: 1 - the whole pages are loaded too
+  * @retval     LL result
+  */
+static int32_t NVRCacheRead(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size, uint8_t keep)
+{
+    NVRPageCache_t *c = nvr->Cache;
+    uint32_t endMem = MEM_START(nvr) + MEM_SIZE(nvr);
+    if ((c == 0) || (nvr->Lock)) return NVRReadLL(nvr, addr, data, size);
+    
+    while (size) {
+        uint32_t offset = addr % PAGE_SIZE(nvr), page = addr - offset, i, victim = 0;
+        uint32_t s = (PAGE_SIZE(nvr) - offset < size) ? PAGE_SIZE(nvr) - offset : size;
         
-        uint32_t stopS = 0;
-        do {
-            uint32_t chunkSize;
-            if (sectorChunkSize > pageRemain) {
-                chunkSize = pageRemain;
-                sectorChunkSize -= pageRemain;
-                pageRemain = nvr->PageSize;
-            } else {
-                chunkSize = sectorChunkSize;
-                stopS = 1;
-            }  
-            if (0 == nvr->NVRWriteDataLL(addr, &data[offset], chunkSize)) {
-                offset += chunkSize;
-                addr += chunkSize;
+        for (i = 0; (i < c->Count) && (c->Slots[i].Addr != page); i++) {
+            if ((c->Slots[victim].Addr != NVR_CACHE_FREE) && 
+                ((c->Slots[i].Addr == NVR_CACHE_FREE) || (c->Tick - c->Slots[i].Used > c->Tick - c->Slots[victim].Used))) victim = i;
+        }
+        if (i < c->Count) {
+            c->Hits++;
+            victim = i;
+        } else {
+            c->Misses++;
+            if (((s == PAGE_SIZE(nvr)) && (keep == 0)) || (page < MEM_START(nvr)) || (page + PAGE_SIZE(nvr) > endMem)) {
+                int32_t ret = NVRReadLL(nvr, addr, data, s);   // the checkpoints and the pages cut by the end are read past
+                if (ret != 0) return ret;
+                victim = NVR_CACHE_FREE;
             } else {
-                ret = NVR_ERROR_HW;
-                stop = stopS = 1;
+                int32_t ret = NVRReadLL(nvr, page, &c->Pages[victim * PAGE_SIZE(nvr)], PAGE_SIZE(nvr));
+                c->Slots[victim].Addr = (ret == 0) ? page : NVR_CACHE_FREE;
+                if (ret != 0) return ret;
             }
-        } while (stopS == 0);        
-    } while (stop == 0);    
+        }
+        if (victim != NVR_CACHE_FREE) {
+            c->Slots[victim].Used = ++c->Tick;
+            memcpy(data, &c->Pages[victim * PAGE_SIZE(nvr) + offset], s);
+        }
+        addr += s;
+        data += s;
+        size -= s;
+    }
+    return 0;
+}
+
+/**
+  * @brief      Frees the cached pages the range touches, called ahead of the writes and the erases
+  * @param      addr: absolute addr
+  * @retval
+  */
+static void NVRCacheDrop(const NVRamKV_t *nvr, uint32_t addr, uint32_t size)
+{
+    NVRPageCache_t *c = nvr->Cache;
+    uint32_t i;
+    if (c == 0) return;
+    for (i = 0; i < c->Count; i++) {
+        if ((c->Slots[i].Addr != NVR_CACHE_FREE) && (c->Slots[i].Addr < addr + size) && (c->Slots[i].Addr + PAGE_SIZE(nvr) > addr)) {
+            c->Slots[i].Addr = NVR_CACHE_FREE;
+        }
+    }
+}
+
+/**
+  * @brief      
+  * @param      addr: relative addr in the sector
+  * @retval     1 if no header of the id is in the sector
+  */
+static uint8_t NVRSummaryMiss(const NVRamKV_t *nvr, uint32_t addr, uint64_t id)
+{
+    const NVRSummary_t *sum = &nvr->Summary[addr / SECTOR_SIZE(nvr)];
+    uint64_t h = NVRSummaryHash(id);
+    uint32_t k;
     
+    if ((id < sum->MinId) || (id > sum->MaxId)) return 1;
+    for (k = 0; k < 3; k++, h >>= 16) {
+        uint32_t bit = (uint32_t)(h % NVR_SUMMARY_BLOOM_BITS);
+        if ((sum->Bloom[bit / 8] & (1 << (bit % 8))) == 0) return 1;
+    }
+    return 0;
+}
+
+/**
+  * @brief      64 bit mix of the id, the sequential ids spread over the filter
+  * @param
+  * @retval
+  */
+static uint64_t NVRSummaryHash(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xFF51AFD7ED558CCDULL;
+    id ^= id >> 33;
+    id *= 0xC4CEB9FE1A85EC53ULL;
+    id ^= id >> 33;
+    return id;
+}
+
+#ifdef NVR_STATS
+/**
+  * @brief      LL read counted
+  * @param
+  * @retval
+  */
+static int32_t NVRReadLL(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size)
+{
+    STATS_ADD(LLReads, 1);
+    STATS_ADD(BytesRead, size);
+    return nvr->NVRReadDataLL(addr, data, size);
+}
+
+/**
+  * @brief      LL write counted
+  * @param
+  * @retval
+  */
+static int32_t NVRWriteLL(const NVRamKV_t *nvr, uint32_t addr, uint8_t *data, uint32_t size)
+{
+    STATS_ADD(LLWrites, 1);
+    STATS_ADD(BytesWritten, size);
+    NVRCacheDrop(nvr, addr, size);
+    return nvr->NVRWriteDataLL(addr, data, size);
+}
+
+/**
+  * @brief      LL gathering write counted
+  * @param
+  * @retval
+  */
+static int32_t NVRWriteVLL(const NVRamKV_t *nvr, uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt)
+{
+    uint32_t i;
+    STATS_ADD(LLWrites, 1);
+    for (i = 0; i < iovCnt; i++) STATS_ADD(BytesWritten, iov[i].Size);
+    NVRCacheDrop(nvr, addr, 1);     // the fragments dont cross a page
+    return nvr->NVRWriteDataVLL(addr, iov, iovCnt);
+}
+
+/**
+  * @brief      LL erase counted and timed
+  * @param
+  * @retval
+  */
+static int32_t NVREraseLL(const NVRamKV_t *nvr, uint32_t addr)
+{
+    STATS_START();
+    STATS_ADD(LLErases, 1);
+    NVRCacheDrop(nvr, addr, SECTOR_SIZE(nvr));
+    int32_t ret = nvr->NVREraseSectorLL(addr);
+    STATS_STOP(NVR_STATS_ERASE);
     return ret;
 }
+
+/**
+  * @brief      Puts the latency of the op into its log2 bin
+  * @param      start: ticks at the start of the op
+  * @retval
+  */
+static void NVRStatsHist(const NVRamKV_t *nvr, uint32_t op, uint32_t start)
+{
+    if ((nvr->Stats == 0) || (nvr->Clock == 0)) return;
     
+    NVRHist_t *h = &nvr->Stats->Latency[op];
+    uint32_t ticks = nvr->Clock() - start, bin = 0, t = ticks;
+    while ((t) && (bin < NVR_STATS_BINS - 1)) {
+        t >>= 1;
+        bin++;
+    }
+    h->Count++;
+    h->Sum += ticks;
+    if (ticks > h->Max) h->Max = ticks;
+    h->Bins[bin]++;
+}
+#endif
 
 //------------------------------------------------------------------------------
 // END
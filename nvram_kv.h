@@ -18,16 +18,74 @@ extern "C" {
    
 
 
+//#define NVR_STATS                                       // counters and latency histograms, see NVRStatsInit
+
+// the geometry fixed at compile time: the divisions and the remainders of the hot paths become constants,
+// shifts and masks for the powers of 2. NVRInit returns NVR_ERROR_INIT if its args differ.
+//#define NVR_PAGE_SIZE                                   256
+//#define NVR_SECTOR_SIZE                                 4096
+//#define NVR_MEMORY_START                                0
+//#define NVR_MEMORY_SIZE                                 (1024 * 1024)
+
+
 #define NVR_FLAGS_PAGE_ALIGN                            (1 << 0) 
+#define NVR_FLAGS_COMPACT                               (1 << 1)        // live records are moved to the head before their sector is erased, needs the index
+#define NVR_FLAGS_HEADER_V2                             (1 << 2)        // compact 25 byte headers, the records up to 65535 bytes as stored, the store is read with the same flag
+
+
+#define NVR_ASYNC_OP_READ                               0
+#define NVR_ASYNC_OP_WRITE                              1
+#define NVR_ASYNC_OP_ERASE                              2
+
+
+#define NVR_STATS_OPEN                                  0       // NVROpenFile, NVRCursorOpen, NVRIterSeek/Next
+#define NVR_STATS_READ                                  1       // NVRReadFile, NVRCursorRead, NVRIterRead
+#define NVR_STATS_WRITE                                 2       // NVRWriteFile(V), NVRWriteBatch, NVRDeleteFile
+#define NVR_STATS_ERASE                                 3       // sector erase by the LL
+#define NVR_STATS_OPS                                   4
+
+#ifndef NVR_STATS_BINS
+#define NVR_STATS_BINS                                  24      // bin 0: 0 ticks, bin n: 2^(n-1) .. 2^n - 1 ticks, the last one takes the rest
+#endif
+
+
+#ifndef NVR_SUMMARY_BLOOM_BITS
+#define NVR_SUMMARY_BLOOM_BITS                          128     // Bloom filter of the ids per sector, a multiple of 8
+#endif
+
+
+#ifndef NVR_IOV_MAX
+#define NVR_IOV_MAX                                     8       // fragments of NVRWriteFileV + the header
+#endif
+
+
+#ifndef NVR_LZ_WINDOW
+#define NVR_LZ_WINDOW                                   1024    // max distance of a match, a power of 2 up to 32768
+#endif
+
+#ifndef NVR_LZ_HASH_BITS
+#define NVR_LZ_HASH_BITS                                8       // the match finder table of 2^bits positions
+#endif
+
+#define NVR_LZ_WORK_MIN                                 (NVR_LZ_WINDOW + (4 << NVR_LZ_HASH_BITS))      // NVRCompressInit takes more, the rest holds the compressed record
     
 
+#define NVR_CACHE_FREE                                  0xFFFFFFFF
+
+
+#define NVR_SNAPSHOT_MAGIC                              0x50414E53      // "SNAP"
+#define NVR_SNAPSHOT_VERSION                            1
+#define NVR_SNAPSHOT_LZ                                 0x80000000      // the payload of the frame is compressed as stored
+#define NVR_SNAPSHOT_END                                0xFFFFFFFF      // Size of the trailer frame
+
+
 #define NVR_OPEN_FLAGS_FROM_CURRENT_POS                 (1 << 0) 
 #define NVR_OPEN_FLAGS_BINARY_SEARCH                    (1 << 1)     
 #define NVR_OPEN_FLAGS_FIRST_MATCH                      (1 << 2)     
 #define NVR_OPEN_FLAGS_NEAREST                          (1 << 3)         
 #define NVR_OPEN_FLAGS_BACKWARD                         (1 << 4) 
 #define NVR_OPEN_FLAGS_ANY_ID                           (1 << 5)
-#define NVR_OPEN_FLAGS_MAX_ID                           (1 << 6)
+#define NVR_OPEN_FLAGS_MAX_ID                           (1 << 6)     // the last written record, a tombstone has size 0
 #define NVR_OPEN_FLAGS_PREVIOUS                         ((1 << 7) | NVR_OPEN_FLAGS_FROM_CURRENT_POS | NVR_OPEN_FLAGS_ANY_ID | NVR_OPEN_FLAGS_FIRST_MATCH)
 #define NVR_OPEN_FLAGS_NEXT                             ((1 << 8) | NVR_OPEN_FLAGS_FROM_CURRENT_POS | NVR_OPEN_FLAGS_ANY_ID | NVR_OPEN_FLAGS_FIRST_MATCH)
 #define NVR_OPEN_FLAGS_SCAN_FILES                       (NVR_OPEN_FLAGS_FROM_CURRENT_POS | NVR_OPEN_FLAGS_ANY_ID | NVR_OPEN_FLAGS_FIRST_MATCH)    
@@ -47,6 +105,7 @@ typedef enum {
     NVR_ERROR_NOT_FOUND = -7,
     NVR_ERROR_ARGUMENT = -8,
     NVR_ERROR_CRC = -9,        
+    NVR_ERROR_FULL = -10,
     NVR_ERROR_OPENED = 1,
 } NVRError_t;
 
@@ -56,6 +115,208 @@ typedef int32_t (*NVRWriteData_t)(uint32_t addr, uint8_t *data, uint32_t size);
 typedef int32_t (*NVREraseSector_t)(uint32_t addr); 
 
 
+typedef uint32_t (*NVRClock_t)(void);               // free running ticks, e.g. us, may wrap around
+
+
+typedef struct {
+    const uint8_t               *Data;
+    uint32_t                    Size;
+} NVRIOVec_t;
+
+typedef int32_t (*NVRWriteDataV_t)(uint32_t addr, const NVRIOVec_t *iov, uint32_t iovCnt);    // programs the fragments one after another, never crosses a page
+
+
+typedef int32_t (*NVRStreamWrite_t)(void *ctx, const uint8_t *data, uint32_t size);     // takes the next bytes of the snapshot, 0 if ok
+typedef int32_t (*NVRStreamRead_t)(void *ctx, uint8_t *data, uint32_t size);            // gives exactly size next bytes of the snapshot, 0 if ok
+
+
+typedef struct {
+    uint8_t                     Op;                 // NVR_ASYNC_OP_xxx
+    uint32_t                    Addr;               // absolute addr
+    uint8_t                     *Data;
+    uint32_t                    Size;
+    volatile int32_t            Status;             // set by NVRAsyncComplete
+    volatile uint8_t            Busy;               // cleared by NVRAsyncComplete
+    uint8_t                     Pending;            // the core waits for the request
+} NVRAsyncReq_t;
+
+typedef struct {
+    int32_t                     (*Submit)(void *ctx, NVRAsyncReq_t *req);     // queues the request: 0, NVR_ERROR_BUSY if the queue is full
+    void                        (*Poll)(void *ctx);                            // optional: reports the finished requests by NVRAsyncComplete in the caller's context
+    void                        *Ctx;
+} NVRAsyncLL_t;
+
+
+// NVRMount needs an entry per distinct id on the memory, the deleted ids whose tombstones are still there included
+typedef struct {
+    uint64_t                    Id;
+    uint32_t                    Addr;               // relative addr of the payload, as FoundFileAddr
+    uint32_t                    Size;               // just payload without headerSize
+    uint32_t                    CRC32;
+    uint32_t                    AddrPrev;           // relative addr, as FileAddrPrev
+} NVRIndexEntry_t;
+
+
+typedef struct {
+    uint64_t                    Id;
+    const uint8_t               *Data;
+    uint32_t                    Size;               // 0 deletes the id, a tombstone as NVRDeleteFile writes
+} NVRRecord_t;
+
+
+typedef struct {
+    uint32_t                    Magic;              // NVR_SNAPSHOT_MAGIC
+    uint32_t                    Version;            // NVR_SNAPSHOT_VERSION
+    uint32_t                    FrameSize;          // sizeof(NVRSnapshotFrame_t)
+    uint32_t                    CRC32;              // of the fields above
+} NVRSnapshotHeader_t;
+
+typedef struct {                                    // followed by Size bytes of the payload
+    uint64_t                    Id;                 // number of the records in the trailer
+    uint32_t                    Size;               // payload as stored | NVR_SNAPSHOT_LZ, NVR_SNAPSHOT_END in the trailer
+    uint32_t                    DataCRC32;          // of the payload as stored
+    uint32_t                    Reserved;
+    uint32_t                    CRC32;              // of the fields above
+} NVRSnapshotFrame_t;
+
+
+typedef struct {
+    uint64_t                    MinId;              // > MaxId if no header is in the sector
+    uint64_t                    MaxId;
+    uint8_t                     Bloom[NVR_SUMMARY_BLOOM_BITS / 8];
+} NVRSummary_t;
+
+
+typedef struct {
+    uint32_t                    Addr;               // relative addr of the payload
+    uint32_t                    Size;
+    uint32_t                    Pos;                // bytes read so far
+    uint32_t                    CRC32;              // running CRC
+    uint32_t                    CRC32Expected;
+    uint32_t                    Raw;                // size of the compressed record unpacked, 0 if it is stored as is
+    uint32_t                    Out;                // bytes unpacked so far
+    uint32_t                    Copy;               // bytes left of the token being unpacked
+    uint16_t                    Offset;             // of the match
+    uint8_t                     State;
+} NVRReadStream_t;
+
+
+typedef struct {
+    uint64_t                    FoundFileId;
+    uint32_t                    FoundFileAddr;      // relative addr
+    uint32_t                    FoundFileSize;
+    uint32_t                    FileAddrPrev;
+    uint32_t                    CRC32Temp;
+    uint8_t                     FileFound;
+    uint8_t                     TryToOpen;
+    uint8_t                     *Page;              // scratch of the cursor, PageSize bytes
+    uint32_t                    Generation;         // of the store when the record was checked
+} NVRCursor_t;
+
+
+typedef struct {
+    NVRIndexEntry_t             Rec;                // the current record
+    uint64_t                    IdFrom;             // the range, both ends included
+    uint64_t                    IdTo;
+    uint32_t                    Flags;              // NVR_OPEN_FLAGS_BACKWARD
+    uint8_t                     Valid;
+    uint8_t                     *Buf;               // read-ahead, a multiple of PageSize
+    uint32_t                    BufSize;
+    uint32_t                    BufAddr;            // relative addr of Buf[0]
+    uint32_t                    BufLen;             // 0 if nothing is buffered
+    uint32_t                    Generation;         // of the store when the record was checked
+} NVRIter_t;
+
+
+typedef struct {
+    NVRIndexEntry_t             *Ring;              // decoded headers, Addr == 0 if the slot is free
+    uint32_t                    Count;
+    uint32_t                    Next;               // slot to be taken
+    NVRIter_t                   Block;              // the flash read backward
+} NVRHeaderCache_t;
+
+
+typedef struct {
+    uint32_t                    Addr;               // absolute addr of the page held, NVR_CACHE_FREE if none
+    uint32_t                    Used;               // Tick of the last access, the least one is evicted
+} NVRCacheSlot_t;
+
+
+typedef struct {
+    NVRCacheSlot_t              *Slots;
+    uint8_t                     *Pages;             // Count pages, the one of Slots[i] at i * PageSize
+    uint32_t                    Count;
+    uint32_t                    Tick;
+    uint32_t                    Hits;               // pages read from RAM
+    uint32_t                    Misses;             // pages read by NVRReadDataLL
+} NVRPageCache_t;
+
+
+typedef struct {
+    void                        (*ReadLock)(void *ctx);         // shared: cursors
+    void                        (*ReadUnlock)(void *ctx);
+    void                        (*WriteLock)(void *ctx);        // exclusive: writes, maintenance, mount
+    void                        (*WriteUnlock)(void *ctx);
+    void                        *Ctx;
+} NVRLock_t;
+
+
+typedef struct {
+    uint32_t                    Count;
+    uint32_t                    Max;                // ticks
+    uint64_t                    Sum;
+    uint32_t                    Bins[NVR_STATS_BINS];
+} NVRHist_t;
+
+
+typedef struct {
+    uint32_t                    LLReads;
+    uint32_t                    LLWrites;
+    uint32_t                    LLErases;
+    uint64_t                    BytesRead;
+    uint64_t                    BytesWritten;
+    uint32_t                    HeadersParsed;
+    uint32_t                    HeaderErrors;       // pages without a header that arent erased: resync steps of the scan
+    uint32_t                    EmptyPages;         // erased pages probed
+    uint64_t                    ResyncBytes;        // skipped looking for a header
+    uint64_t                    CRCBytes;
+    uint32_t                    SectorsSkipped;     // by the summaries
+    NVRHist_t                   Latency[NVR_STATS_OPS];
+} NVRStats_t;
+
+
+typedef struct {
+    const NVRAsyncLL_t          *LL;
+    NVRAsyncReq_t               *Queue;
+    uint32_t                    Depth;
+    uint8_t                     Job;                // what is being done, 0 - nothing
+    uint8_t                     EraseInFlight;
+    uint8_t                     Wrapped;
+    NVRError_t                  Result;
+    uint32_t                    Addr;               // absolute addr range of the job
+    uint32_t                    End;
+    uint32_t                    Next;               // the next addr to submit
+    uint32_t                    EraseNext;          // the next sector to erase
+    uint32_t                    ErasedUpTo;         // the pages below may be programmed
+    uint32_t                    FirstPageEnd;       // the header page is gathered in nvr->Page
+    uint32_t                    InFlight;
+    const uint8_t               *Data;
+    uint8_t                     *ReadData;
+    NVRIndexEntry_t             Entry;
+} NVRAsync_t;
+
+
+typedef struct {
+    uint8_t                     *Buf;               // PageSize bytes
+    uint32_t                    PageAddr;           // absolute addr of the page assembled in Buf
+    uint32_t                    Start;              // the bytes before are programmed already
+    uint32_t                    Fill;
+    uint32_t                    Complete;           // records put in the page buff completely
+    uint32_t                    Durable;            // records programmed completely
+    uint8_t                     EraseAhead;         // a sector is erased when the first bytes are put in, not when they are programmed
+} NVRPageBuf_t;
+
+
 typedef struct NVRamKV {
     uint32_t                    PageSize;
     uint32_t                    SectorSize;  
@@ -66,17 +327,66 @@ typedef struct NVRamKV {
     NVRReadData_t               NVRReadDataLL;
     NVRWriteData_t              NVRWriteDataLL;
     NVREraseSector_t            NVREraseSectorLL;
+    NVRWriteDataV_t             NVRWriteDataVLL;    // optional
+    const uint8_t               *Base;              // optional: the memory mapped store, Base[0] is at MemoryStartAddr
         
     uint64_t                    FoundFileId;
-    uint32_t                    FoundFileAddr;      // relative addr 
-    uint32_t                    FoundFileSize;      // just payload without headerSize
-    uint32_t                    FileAddrPrev;       // relative addr 
+    uint32_t                    FoundFileAddr;      // relative addr
+    uint32_t                    FoundFileSize;      // just payload without headerSize, as stored
+    uint32_t                    FileAddrPrev;       // relative addr
+    uint32_t                    FoundFileRaw;       // size of the found record unpacked, 0 if it is stored as is
+    uint32_t                    FoundFileRawAddr;   // FoundFileAddr FoundFileRaw belongs to
     uint32_t                    Flags;
+    uint32_t                    HeaderSize;         // NVRHeaderSize or the v2 one, by NVR_FLAGS_HEADER_V2
     uint32_t                    CRC32Temp;
     
     uint8_t                     FileFound;    
     uint8_t                     NotReady;
     uint8_t                     TryToOpen;
+
+    NVRIndexEntry_t             *Index;             // optional RAM index built by NVRMount, sorted by id
+    uint32_t                    IndexCapacity;
+    uint32_t                    IndexCount;
+    NVRIndexEntry_t             IndexHead;          // the last appended record, Addr == 0 if none
+    
+    NVRAsync_t                  Async;              // optional, set by NVRAsyncInit
+    
+    uint32_t                    EraseReserve;       // sectors NVRMaintenance keeps erased ahead of the write head
+    uint32_t                    ErasedAddr;         // relative addr of the first pre-erased sector
+    uint32_t                    ErasedCount;
+    uint32_t                    HeadEnd;            // relative addr behind the last written record
+    uint8_t                     HeadKnown;
+    
+    uint32_t                    CheckpointAddr;     // absolute addr of the checkpoint area, optional
+    uint32_t                    CheckpointSize;
+    uint32_t                    CheckpointInterval; // sectors of records between the checkpoints
+    uint32_t                    CheckpointNext;     // relative addr in the area
+    uint32_t                    CheckpointSeq;
+    uint32_t                    CheckpointHead;     // HeadEnd at the last checkpoint
+    
+    NVRSummary_t                *Summary;           // optional, set by NVRSummaryInit, a summary per sector
+    uint8_t                     SummaryValid;       // built by NVRMount
+    uint8_t                     SummaryLive;        // built from the index: the older versions of the ids are missing
+    
+    NVRHeaderCache_t            HeaderCache;        // optional, set by NVRHeaderCacheInit
+    
+    uint8_t                     *LZWork;            // optional, set by NVRCompressInit: window | match finder | compressed record
+    uint32_t                    LZWorkSize;
+    
+    NVRPageBuf_t                WriteBack;          // optional, set by NVRWriteBackInit: the page of the records not programmed yet, Buf == 0 if off
+    NVRClock_t                  WriteBackClock;
+    uint32_t                    WriteBackTimeout;   // ticks the records may stay in RAM, 0 - until the page fills or NVRSync
+    uint32_t                    WriteBackSince;     // tick the oldest record not programmed was put in
+    
+    NVRPageCache_t              *Cache;             // optional, set by NVRPageCacheInit
+    
+    const NVRLock_t             *Lock;              // optional, set by NVRInitLock
+    volatile uint32_t           Generation;         // counts the writes
+    
+#ifdef NVR_STATS
+    NVRStats_t                  *Stats;             // optional, set by NVRStatsInit
+    NVRClock_t                  Clock;
+#endif
 } NVRamKV_t;   
 
 
@@ -84,7 +394,18 @@ typedef struct NVRamKV {
 
 NVRError_t NVRInit(NVRamKV_t *nvr, uint32_t pageSize, uint32_t sectorSize, uint32_t startAddr, uint32_t memSize, uint8_t *page, uint32_t flags);
 NVRError_t NVRInitLL(NVRamKV_t *nvr, NVRReadData_t nvrRead, NVRWriteData_t nvrWrite, NVREraseSector_t nvrErase);
+NVRError_t NVRInitLLV(NVRamKV_t *nvr, NVRWriteDataV_t nvrWriteV);
+NVRError_t NVRInitDirect(NVRamKV_t *nvr, const uint8_t *base);
+NVRError_t NVRInitLock(NVRamKV_t *nvr, const NVRLock_t *lock);
+NVRError_t NVRMount(NVRamKV_t *nvr, NVRIndexEntry_t *index, uint32_t capacity);
 NVRError_t NVROpenFile(NVRamKV_t *nvr, uint64_t id, uint32_t *size, uint32_t flags, uint32_t emptyPagesLim);
+NVRError_t NVRCursorInit(NVRamKV_t *nvr, NVRCursor_t *cur, uint8_t *page);
+NVRError_t NVRCursorOpen(NVRamKV_t *nvr, NVRCursor_t *cur, uint64_t id, uint32_t *size, uint32_t flags, uint32_t emptyPagesLim);
+NVRError_t NVRCursorRead(NVRamKV_t *nvr, NVRCursor_t *cur, uint32_t pos, uint8_t *data, uint32_t size);
+NVRError_t NVRIterInit(NVRamKV_t *nvr, NVRIter_t *it, uint8_t *buf, uint32_t bufSize);
+NVRError_t NVRIterSeek(NVRamKV_t *nvr, NVRIter_t *it, uint64_t idFrom, uint64_t idTo, uint32_t flags);
+NVRError_t NVRIterNext(NVRamKV_t *nvr, NVRIter_t *it);
+NVRError_t NVRIterRead(NVRamKV_t *nvr, NVRIter_t *it, uint32_t pos, uint8_t *data, uint32_t size);
 uint32_t   NVRGetCurrAddr(const NVRamKV_t *nvr);
 uint32_t   NVRGetFoundFileAddr(const NVRamKV_t *nvr);
 uint32_t   NVRGetNextAddr(const NVRamKV_t *nvr);
@@ -93,8 +414,38 @@ uint32_t   NVRGetFileCRC(const NVRamKV_t *nvr);
 void       NVRMoveToStart(NVRamKV_t *nvr);
 void NVRMoveToFileAddr(NVRamKV_t *nvr, uint32_t addr, uint32_t size);
 uint64_t   NVRGetFoundId(const NVRamKV_t *nvr);
+uint32_t   NVRGetHeaderSize(const NVRamKV_t *nvr);
 NVRError_t NVRReadFile(NVRamKV_t *nvr, uint32_t pos, uint8_t *data, uint32_t size);
+NVRError_t NVRReadFileRaw(NVRamKV_t *nvr, uint32_t pos, uint8_t *data, uint32_t size);
+NVRError_t NVRGetView(NVRamKV_t *nvr, const uint8_t **data, uint32_t *size);
+NVRError_t NVRReadBegin(NVRamKV_t *nvr, NVRReadStream_t *rs);
+NVRError_t NVRReadChunk(NVRamKV_t *nvr, NVRReadStream_t *rs, uint8_t *data, uint32_t size, uint32_t *read);
+NVRError_t NVRReadFinish(NVRamKV_t *nvr, NVRReadStream_t *rs);
 NVRError_t NVRWriteFile(NVRamKV_t *nvr, uint64_t id, uint8_t *data, uint32_t size);
+NVRError_t NVRWriteFileV(NVRamKV_t *nvr, uint64_t id, const NVRIOVec_t *iov, uint32_t iovCnt);
+NVRError_t NVRWriteBatch(NVRamKV_t *nvr, const NVRRecord_t *recs, uint32_t count, uint32_t *written);
+NVRError_t NVRDeleteFile(NVRamKV_t *nvr, uint64_t id);
+NVRError_t NVRExport(NVRamKV_t *nvr, NVRStreamWrite_t write, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count);
+NVRError_t NVRImport(NVRamKV_t *nvr, NVRStreamRead_t read, void *ctx, uint8_t *buf, uint32_t bufSize, uint32_t *count);
+NVRError_t NVRAsyncInit(NVRamKV_t *nvr, const NVRAsyncLL_t *ll, NVRAsyncReq_t *queue, uint32_t depth);
+NVRError_t NVRAsyncWriteFile(NVRamKV_t *nvr, uint64_t id, const uint8_t *data, uint32_t size);
+NVRError_t NVRAsyncReadFile(NVRamKV_t *nvr, uint8_t *data);
+NVRError_t NVRAsyncPoll(NVRamKV_t *nvr);
+void       NVRAsyncComplete(NVRAsyncReq_t *req, int32_t status);
+NVRError_t NVRSummaryInit(NVRamKV_t *nvr, NVRSummary_t *summary, uint32_t count);
+NVRError_t NVRHeaderCacheInit(NVRamKV_t *nvr, NVRIndexEntry_t *ring, uint32_t count, uint8_t *block, uint32_t blockSize);
+NVRError_t NVRCompressInit(NVRamKV_t *nvr, uint8_t *work, uint32_t size);
+NVRError_t NVRWriteBackInit(NVRamKV_t *nvr, uint8_t *buf, NVRClock_t clock, uint32_t timeout);
+NVRError_t NVRWriteBackPoll(NVRamKV_t *nvr);
+NVRError_t NVRSync(NVRamKV_t *nvr);
+NVRError_t NVRPageCacheInit(NVRamKV_t *nvr, NVRPageCache_t *cache, NVRCacheSlot_t *slots, uint8_t *pages, uint32_t count);
+NVRError_t NVRSetEraseReserve(NVRamKV_t *nvr, uint32_t sectors);
+NVRError_t NVRMaintenance(NVRamKV_t *nvr, uint32_t maxSectors);
+NVRError_t NVRCheckpointInit(NVRamKV_t *nvr, uint32_t addr, uint32_t size, uint32_t interval);
+NVRError_t NVRCheckpoint(NVRamKV_t *nvr);
+NVRError_t NVRStatsInit(NVRamKV_t *nvr, NVRStats_t *stats, NVRClock_t clock);
+NVRError_t NVRStatsGet(const NVRamKV_t *nvr, NVRStats_t *snapshot);
+NVRError_t NVRStatsReset(NVRamKV_t *nvr);
 NVRError_t NVRCloseFile(NVRamKV_t *nvr, uint64_t id);
 NVRError_t NVREraseAll(NVRamKV_t *nvr);
 
@@ -0,0 +1,280 @@
+/**
+  ******************************************************************************
+  * @file    nvram_kv_stripe.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief
+  ******************************************************************************
+  */
+
+#include "nvram_kv_stripe.h"
+#include <string.h>
+
+
+
+
+static uint32_t NVRStripeDevOf(const NVRStripe_t *st, uint64_t id);
+static NVRError_t NVRStripeWriteDev(NVRamKV_t *dev, uint64_t id, const uint8_t *data, uint32_t size);
+static NVRError_t NVRStripeIterPick(NVRStripe_t *st, NVRStripeIter_t *it);
+
+
+/**
+  * @brief      Sets the striping over the stores. The stores are initialized by the caller and their heads are known:
+  *             NVRMount or NVROpenFile with NVR_OPEN_FLAGS_MAX_ID, NVRAsyncInit lets a store program in the background.
+  *             The round-robin appends expect every id to be written once, the ids ascending for the iterators.
+  * @param      pages: caller's memory of the cursors, the sum of the PageSize of the stores
+  * @param      flags: NVR_STRIPE_FLAGS_HASH or 0
+  * @retval
+  */
+NVRError_t NVRStripeInit(NVRStripe_t *st, NVRamKV_t *const *dev, uint32_t count, uint8_t *pages, uint32_t flags)
+{
+    uint32_t i;
+    if ((dev == 0) || (count == 0) || (count > NVR_STRIPE_DEV_MAX) || (pages == 0)) return NVR_ERROR_ARGUMENT;
+
+    memset(st, 0, sizeof(NVRStripe_t));
+    for (i = 0; i < count; i++) {
+        if (dev[i] == 0) return NVR_ERROR_ARGUMENT;
+        st->Dev[i] = dev[i];
+        NVRCursorInit(dev[i], &st->Cur[i], pages);
+        pages += dev[i]->PageSize;
+    }
+    st->Count = st->Opened = count;
+    st->Flags = flags;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Writes the record to its store, the round-robin takes the next store not busy with an async job.
+  *             The async stores only start the job, the data must be kept until NVRStripePoll completes it.
+  * @param
+  * @retval     NVR_ERROR_BUSY if the store (all the stores for the round-robin) is busy, NVR_ERROR_END_MEM if it wrapped around
+  */
+NVRError_t NVRStripeWriteFile(NVRStripe_t *st, uint64_t id, const uint8_t *data, uint32_t size)
+{
+    NVRError_t ret;
+    uint32_t i;
+
+    if (st->Flags & NVR_STRIPE_FLAGS_HASH) return NVRStripeWriteDev(st->Dev[NVRStripeDevOf(st, id)], id, data, size);
+    for (i = 0; i < st->Count; i++) {
+        uint32_t d = (st->Next + i) % st->Count;
+        if (NVR_ERROR_BUSY == (ret = NVRStripeWriteDev(st->Dev[d], id, data, size))) continue;
+        st->Next = (d + 1) % st->Count;
+        return ret;
+    }
+    return NVR_ERROR_BUSY;
+}
+
+/**
+  * @brief      Writes a tombstone of the id to the store having it: the store of the id hash or,
+  *             for the round-robin, the first one it is found in
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND if no store has it, NVR_ERROR_BUSY if the async job of the store is in progress
+  */
+NVRError_t NVRStripeDeleteFile(NVRStripe_t *st, uint64_t id)
+{
+    NVRError_t ret;
+    uint32_t size;
+
+    if (st->Flags & NVR_STRIPE_FLAGS_HASH) {
+        st->Opened = NVRStripeDevOf(st, id);
+    } else if (NVR_ERROR_OPENED != (ret = NVRStripeOpenFile(st, id, &size, 0))) {
+        return ret;
+    }
+    NVRamKV_t *dev = st->Dev[st->Opened];
+    st->Opened = st->Count;
+    if (dev->Async.LL) return NVRAsyncWriteFile(dev, id, (const uint8_t *)&id, 0);     // no payload, the pointer is not read
+    return NVRDeleteFile(dev, id);
+}
+
+/**
+  * @brief      Advances the async jobs of all the stores
+  * @param
+  * @retval     the first error of the finished jobs, else NVR_ERROR_BUSY while a job is in progress,
+  *             else NVR_ERROR_END_MEM if a store wrapped around
+  */
+NVRError_t NVRStripePoll(NVRStripe_t *st)
+{
+    NVRError_t ret = NVR_ERROR_NONE, r;
+    uint8_t busy = 0, wrapped = 0;
+    uint32_t i;
+
+    for (i = 0; i < st->Count; i++) {
+        if (st->Dev[i]->Async.LL == 0) continue;
+        r = NVRAsyncPoll(st->Dev[i]);
+        if (r == NVR_ERROR_BUSY) busy = 1;
+        else if (r == NVR_ERROR_END_MEM) wrapped = 1;
+        else if ((r != NVR_ERROR_NONE) && (ret == NVR_ERROR_NONE)) ret = r;     // the result of a job is given once
+    }
+    if (ret != NVR_ERROR_NONE) return ret;
+    if (busy) return NVR_ERROR_BUSY;
+    return (wrapped) ? NVR_ERROR_END_MEM : NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Opens the record by the cursors of the stores: the store of the id or, for the round-robin,
+  *             the first one having it. NVR_OPEN_FLAGS_MAX_ID opens the highest id of all the stores.
+  * @param      flags: 0 or NVR_OPEN_FLAGS_MAX_ID
+  * @retval     as NVROpenFile
+  */
+NVRError_t NVRStripeOpenFile(NVRStripe_t *st, uint64_t id, uint32_t *size, uint32_t flags)
+{
+    NVRError_t ret = NVR_ERROR_NOT_FOUND;
+    uint32_t i, s, best = st->Count;
+
+    st->Opened = st->Count;
+    if (flags == NVR_OPEN_FLAGS_MAX_ID) {
+        for (i = 0; i < st->Count; i++) {
+            if (NVR_ERROR_HW == (ret = NVRCursorOpen(st->Dev[i], &st->Cur[i], 0, &s, NVR_OPEN_FLAGS_MAX_ID, 0))) return ret;
+            if ((st->Cur[i].FileFound) && ((best == st->Count) || (st->Cur[i].FoundFileId > st->Cur[best].FoundFileId))) best = i;
+        }
+        if (best == st->Count) return NVR_ERROR_NOT_FOUND;
+        st->Opened = best;
+        *size = st->Cur[best].FoundFileSize;
+        return NVR_ERROR_OPENED;
+    }
+    if (flags) return NVR_ERROR_ARGUMENT;
+
+    for (i = 0; i < st->Count; i++) {
+        uint32_t d = (st->Flags & NVR_STRIPE_FLAGS_HASH) ? NVRStripeDevOf(st, id) : i;
+        ret = NVRCursorOpen(st->Dev[d], &st->Cur[d], id, size, 0, 0);
+        if ((ret == NVR_ERROR_OPENED) || ((st->Cur[d].FileFound) && (st->Cur[d].FoundFileId == id))) {
+            st->Opened = d;
+            return ret;
+        }
+        if ((ret == NVR_ERROR_HW) || (st->Flags & NVR_STRIPE_FLAGS_HASH)) return ret;
+    }
+    return NVR_ERROR_NOT_FOUND;
+}
+
+/**
+  * @brief      NVRCursorRead of the opened record
+  * @param
+  * @retval
+  */
+NVRError_t NVRStripeReadFile(NVRStripe_t *st, uint32_t pos, uint8_t *data, uint32_t size)
+{
+    if (st->Opened >= st->Count) return NVR_ERROR_NOT_FOUND;
+    return NVRCursorRead(st->Dev[st->Opened], &st->Cur[st->Opened], pos, data, size);
+}
+
+/**
+  * @brief
+  * @param
+  * @retval     id of the opened record, 0 if none
+  */
+uint64_t NVRStripeGetFoundId(const NVRStripe_t *st)
+{
+    return (st->Opened < st->Count) ? st->Cur[st->Opened].FoundFileId : 0;
+}
+
+/**
+  * @brief      Sets an iterator per store, the ids are expected to ascend in the order of writing as for NVRIterInit
+  * @param      buf: read-ahead shared evenly by the stores, at least PageSize bytes each
+  * @retval
+  */
+NVRError_t NVRStripeIterInit(NVRStripe_t *st, NVRStripeIter_t *it, uint8_t *buf, uint32_t bufSize)
+{
+    NVRError_t ret;
+    uint32_t i, share = bufSize / st->Count;
+
+    memset(it, 0, sizeof(NVRStripeIter_t));
+    for (i = 0; i < st->Count; i++) {
+        if (NVR_ERROR_NONE != (ret = NVRIterInit(st->Dev[i], &it->It[i], &buf[i * share], share))) return ret;
+    }
+    it->Dev = st->Count;
+    return NVR_ERROR_NONE;
+}
+
+/**
+  * @brief      Seeks every store, the current record is the lowest id of them (the highest with NVR_OPEN_FLAGS_BACKWARD),
+  *             it is in it->It[it->Dev].Rec
+  * @param      flags: NVR_OPEN_FLAGS_BACKWARD or 0
+  * @retval     NVR_ERROR_OPENED
+  */
+NVRError_t NVRStripeIterSeek(NVRStripe_t *st, NVRStripeIter_t *it, uint64_t idFrom, uint64_t idTo, uint32_t flags)
+{
+    NVRError_t ret;
+    uint32_t i;
+
+    it->Flags = flags;
+    for (i = 0; i < st->Count; i++) {
+        ret = NVRIterSeek(st->Dev[i], &it->It[i], idFrom, idTo, flags);
+        if ((ret != NVR_ERROR_OPENED) && (ret != NVR_ERROR_NOT_FOUND)) return ret;
+    }
+    return NVRStripeIterPick(st, it);
+}
+
+/**
+  * @brief      The next record of the range merged from the stores
+  * @param
+  * @retval     NVR_ERROR_NOT_FOUND at the end of the range
+  */
+NVRError_t NVRStripeIterNext(NVRStripe_t *st, NVRStripeIter_t *it)
+{
+    if (it->Dev >= st->Count) return NVR_ERROR_NOT_FOUND;
+
+    NVRError_t ret = NVRIterNext(st->Dev[it->Dev], &it->It[it->Dev]);
+    if ((ret != NVR_ERROR_OPENED) && (ret != NVR_ERROR_NOT_FOUND)) return ret;
+    return NVRStripeIterPick(st, it);
+}
+
+/**
+  * @brief      NVRIterRead of the current record
+  * @param
+  * @retval
+  */
+NVRError_t NVRStripeIterRead(NVRStripe_t *st, NVRStripeIter_t *it, uint32_t pos, uint8_t *data, uint32_t size)
+{
+    if (it->Dev >= st->Count) return NVR_ERROR_NOT_FOUND;
+    return NVRIterRead(st->Dev[it->Dev], &it->It[it->Dev], pos, data, size);
+}
+
+
+
+
+/**
+  * @brief
+  * @param
+  * @retval     store of the id
+  */
+static uint32_t NVRStripeDevOf(const NVRStripe_t *st, uint64_t id)
+{
+    id ^= id >> 33;     // the ids are often sequential, mix them
+    id *= 0xFF51AFD7ED558CCDULL;
+    id ^= id >> 33;
+    return (uint32_t)(id % st->Count);
+}
+
+/**
+  * @brief
+  * @param
+  * @retval     NVR_ERROR_BUSY if the async job of the store is in progress
+  */
+static NVRError_t NVRStripeWriteDev(NVRamKV_t *dev, uint64_t id, const uint8_t *data, uint32_t size)
+{
+    if (dev->Async.LL) return NVRAsyncWriteFile(dev, id, data, size);
+    return NVRWriteFile(dev, id, (uint8_t *)data, size);
+}
+
+/**
+  * @brief      Makes the store of the lowest id (highest backward) current
+  * @param
+  * @retval
+  */
+static NVRError_t NVRStripeIterPick(NVRStripe_t *st, NVRStripeIter_t *it)
+{
+    uint8_t backward = (it->Flags & NVR_OPEN_FLAGS_BACKWARD) ? 1 : 0;
+    uint32_t i;
+
+    it->Dev = st->Count;
+    for (i = 0; i < st->Count; i++) {
+        if (it->It[i].Valid == 0) continue;
+        if ((it->Dev == st->Count) ||
+            ((backward) ? (it->It[i].Rec.Id > it->It[it->Dev].Rec.Id) : (it->It[i].Rec.Id < it->It[it->Dev].Rec.Id))) it->Dev = i;
+    }
+    return (it->Dev < st->Count) ? NVR_ERROR_OPENED : NVR_ERROR_NOT_FOUND;
+}
+
+
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file    nvram_kv_stripe.h
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Striping of the records over several stores, a store per flash chip.
+  *          A record goes to the store of its id hash or the stores take the
+  *          appends in turn. The lookups and the iterators merge the stores.
+  *          The stores with the async driver program concurrently, the stores
+  *          share nothing, so each may also be mounted on its own thread.
+  ******************************************************************************
+  */
+#ifndef _NVRAM_KV_STRIPE_H
+#define _NVRAM_KV_STRIPE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "nvram_kv.h"
+
+
+
+#ifndef NVR_STRIPE_DEV_MAX
+#define NVR_STRIPE_DEV_MAX                              4
+#endif
+
+
+#define NVR_STRIPE_FLAGS_HASH                           (1 << 0)        // the store of a record by its id hash, else round-robin appends of unique ids
+
+
+
+typedef struct {
+    NVRamKV_t                   *Dev[NVR_STRIPE_DEV_MAX];
+    NVRCursor_t                 Cur[NVR_STRIPE_DEV_MAX];       // the lookups dont move the write position of the stores
+    uint32_t                    Count;
+    uint32_t                    Flags;
+    uint32_t                    Next;               // round-robin: the store tried first by the next write
+    uint32_t                    Opened;             // store of the opened record, Count if none
+} NVRStripe_t;
+
+
+typedef struct {
+    NVRIter_t                   It[NVR_STRIPE_DEV_MAX];
+    uint32_t                    Dev;                // store of the current record, the one of the lowest id (highest backward)
+    uint32_t                    Flags;              // NVR_OPEN_FLAGS_BACKWARD
+} NVRStripeIter_t;
+
+
+
+NVRError_t NVRStripeInit(NVRStripe_t *st, NVRamKV_t *const *dev, uint32_t count, uint8_t *pages, uint32_t flags);
+NVRError_t NVRStripeWriteFile(NVRStripe_t *st, uint64_t id, const uint8_t *data, uint32_t size);
+NVRError_t NVRStripeDeleteFile(NVRStripe_t *st, uint64_t id);
+NVRError_t NVRStripePoll(NVRStripe_t *st);
+NVRError_t NVRStripeOpenFile(NVRStripe_t *st, uint64_t id, uint32_t *size, uint32_t flags);
+NVRError_t NVRStripeReadFile(NVRStripe_t *st, uint32_t pos, uint8_t *data, uint32_t size);
+uint64_t   NVRStripeGetFoundId(const NVRStripe_t *st);
+NVRError_t NVRStripeIterInit(NVRStripe_t *st, NVRStripeIter_t *it, uint8_t *buf, uint32_t bufSize);
+NVRError_t NVRStripeIterSeek(NVRStripe_t *st, NVRStripeIter_t *it, uint64_t idFrom, uint64_t idTo, uint32_t flags);
+NVRError_t NVRStripeIterNext(NVRStripe_t *st, NVRStripeIter_t *it);
+NVRError_t NVRStripeIterRead(NVRStripe_t *st, NVRStripeIter_t *it, uint32_t pos, uint8_t *data, uint32_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NVRAM_KV_STRIPE_H
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
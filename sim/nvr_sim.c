@@ -0,0 +1,387 @@
+/**
+  ******************************************************************************
+  * @file    nvr_sim.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief
+  ******************************************************************************
+  */
+
+#include "nvr_sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+
+
+static int32_t NVRSimSubmit(void *ctx, NVRAsyncReq_t *req);
+static void NVRSimPoll(void *ctx);
+static void *NVRSimWorker(void *arg);
+static void NVRSimSleep(uint32_t us);
+static void NVRSimAccount(NVRSim_t *sim, uint8_t op, uint32_t size, uint32_t violations);
+
+
+
+static NVRSim_t                 *Bound;             // the sim of the synchronous driver
+
+
+/**
+  * @brief
+  * @param      startAddr: absolute addr the memory is seen at by the store
+  * @retval     0 if OK
+  */
+int32_t NVRSimInit(NVRSim_t *sim, uint32_t startAddr, uint32_t size, uint32_t pageSize, uint32_t sectorSize, const NVRSimTiming_t *timing)
+{
+    if ((size == 0) || (pageSize == 0) || (sectorSize % pageSize) || (size % sectorSize)) return -1;
+    memset(sim, 0, sizeof(NVRSim_t));
+    if (0 == (sim->Mem = malloc(size))) return -1;
+    memset(sim->Mem, 0xFF, size);
+    sim->Fd = -1;
+    sim->StartAddr = startAddr;
+    sim->Size = size;
+    sim->PageSize = pageSize;
+    sim->SectorSize = sectorSize;
+    if (timing) sim->Timing = *timing;
+    return 0;
+}
+
+/**
+  * @brief      The memory is the file mapped shared, a new or shorter file is extended by erased bytes
+  * @param      startAddr: absolute addr the memory is seen at by the store
+  * @retval     0 if OK
+  */
+int32_t NVRSimInitFile(NVRSim_t *sim, const char *path, uint32_t startAddr, uint32_t size, uint32_t pageSize, uint32_t sectorSize, const NVRSimTiming_t *timing)
+{
+    struct stat st;
+    
+    if ((size == 0) || (pageSize == 0) || (sectorSize % pageSize) || (size % sectorSize)) return -1;
+    memset(sim, 0, sizeof(NVRSim_t));
+    if (0 > (sim->Fd = open(path, O_RDWR | O_CREAT, 0644))) return -1;
+    if ((0 != fstat(sim->Fd, &st)) || ((st.st_size < size) && (0 != ftruncate(sim->Fd, size)))) {
+        close(sim->Fd);
+        return -1;
+    }
+    sim->Mem = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, sim->Fd, 0);
+    if (sim->Mem == MAP_FAILED) {
+        close(sim->Fd);
+        sim->Mem = 0;
+        return -1;
+    }
+    if (st.st_size < size) memset(&sim->Mem[st.st_size], 0xFF, size - st.st_size);
+    sim->StartAddr = startAddr;
+    sim->Size = size;
+    sim->PageSize = pageSize;
+    sim->SectorSize = sectorSize;
+    if (timing) sim->Timing = *timing;
+    return 0;
+}
+
+/**
+  * @brief      Stops the workers and frees the memory
+  * @param
+  * @retval
+  */
+void NVRSimDeInit(NVRSim_t *sim)
+{
+    if (sim->Started) {
+        pthread_mutex_lock(&sim->Lock);
+        sim->Stop = 1;
+        pthread_cond_broadcast(&sim->Cond);
+        pthread_mutex_unlock(&sim->Lock);
+        for (uint32_t b = 0; b < sim->Banks; b++) pthread_join(sim->Worker[b].Thread, 0);
+        pthread_mutex_destroy(&sim->Lock);
+        pthread_cond_destroy(&sim->Cond);
+        sim->Started = 0;
+    }
+    if (sim->Fd >= 0) {
+        munmap(sim->Mem, sim->Size);
+        close(sim->Fd);
+        sim->Fd = -1;
+    } else {
+        free(sim->Mem);
+    }
+    if (Bound == sim) Bound = 0;
+    sim->Mem = 0;
+}
+
+/**
+  * @brief
+  * @param      flags: NVR_SIM_FLAGS_xxx
+  * @retval
+  */
+void NVRSimSetFlags(NVRSim_t *sim, uint32_t flags)
+{
+    sim->Flags = flags;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+void NVRSimResetStats(NVRSim_t *sim)
+{
+    memset(&sim->Stats, 0, sizeof(NVRSimStats_t));
+}
+
+/**
+  * @brief      Starts the workers and returns the driver for NVRAsyncInit
+  * @param      banks: operations on different banks overlap, 1 for a plain SPI NOR
+  * @retval     0 on error
+  */
+const NVRAsyncLL_t *NVRSimAsyncLL(NVRSim_t *sim, uint32_t banks)
+{
+    if (sim->Started) return &sim->AsyncLL;
+    if ((banks == 0) || (banks > NVR_SIM_BANKS_MAX)) return 0;
+    
+    pthread_mutex_init(&sim->Lock, 0);
+    pthread_cond_init(&sim->Cond, 0);
+    sim->Banks = banks;
+    sim->Stop = 0;
+    for (uint32_t b = 0; b < banks; b++) {
+        sim->Worker[b].Sim = sim;
+        sim->Worker[b].Bank = b;
+        pthread_create(&sim->Worker[b].Thread, 0, NVRSimWorker, &sim->Worker[b]);
+    }
+    sim->Started = 1;
+    sim->AsyncLL.Submit = NVRSimSubmit;
+    sim->AsyncLL.Poll = NVRSimPoll;
+    sim->AsyncLL.Ctx = sim;
+    return &sim->AsyncLL;
+}
+
+/**
+  * @brief
+  * @param      addr: absolute addr
+  * @retval     0 if OK
+  */
+int32_t NVRSimRead(NVRSim_t *sim, uint32_t addr, uint8_t *data, uint32_t size)
+{
+    if ((addr < sim->StartAddr) || (addr - sim->StartAddr + size > sim->Size)) return -1;
+    memcpy(data, &sim->Mem[addr - sim->StartAddr], size);
+    NVRSimAccount(sim, NVR_ASYNC_OP_READ, size, 0);
+    return 0;
+}
+
+/**
+  * @brief      Programs the bytes, a program can only clear bits and never crosses a page.
+  *             0xFF leaves the byte as it is, other bytes need it erased or just clear more bits
+  * @param      addr: absolute addr
+  * @retval     0 if OK
+  */
+int32_t NVRSimWrite(NVRSim_t *sim, uint32_t addr, const uint8_t *data, uint32_t size)
+{
+    uint32_t i, violations = 0;
+    
+    if ((addr < sim->StartAddr) || (addr - sim->StartAddr + size > sim->Size)) return -1;
+    addr -= sim->StartAddr;
+    if ((size) && ((addr / sim->PageSize) != ((addr + size - 1) / sim->PageSize))) return -1;
+    for (i = 0; i < size; i++) {
+        if ((data[i] != 0xFF) && ((sim->Mem[addr + i] & data[i]) != data[i])) violations++;
+    }
+    if ((violations) && (sim->Flags & NVR_SIM_FLAGS_STRICT)) {
+        NVRSimAccount(sim, NVR_ASYNC_OP_WRITE, 0, violations);
+        return -1;
+    }
+    for (i = 0; i < size; i++) sim->Mem[addr + i] &= data[i];
+    NVRSimAccount(sim, NVR_ASYNC_OP_WRITE, size, violations);
+    return 0;
+}
+
+/**
+  * @brief
+  * @param      addr: absolute addr of the sector
+  * @retval     0 if OK
+  */
+int32_t NVRSimErase(NVRSim_t *sim, uint32_t addr)
+{
+    if ((addr < sim->StartAddr) || (addr - sim->StartAddr >= sim->Size)) return -1;
+    addr -= sim->StartAddr;
+    if (addr % sim->SectorSize) return -1;
+    memset(&sim->Mem[addr], 0xFF, sim->SectorSize);
+    NVRSimAccount(sim, NVR_ASYNC_OP_ERASE, sim->SectorSize, 0);
+    return 0;
+}
+
+/**
+  * @brief      Sets the sim of the synchronous driver, the LL functions have no context
+  * @param
+  * @retval
+  */
+void NVRSimBind(NVRSim_t *sim)
+{
+    Bound = sim;
+}
+
+/**
+  * @brief      NVRReadData_t of the bound sim
+  * @param
+  * @retval
+  */
+int32_t NVRSimReadLL(uint32_t addr, uint8_t *data, uint32_t size)
+{
+    return NVRSimRead(Bound, addr, data, size);
+}
+
+/**
+  * @brief      NVRWriteData_t of the bound sim
+  * @param
+  * @retval
+  */
+int32_t NVRSimWriteLL(uint32_t addr, uint8_t *data, uint32_t size)
+{
+    return NVRSimWrite(Bound, addr, data, size);
+}
+
+/**
+  * @brief      NVREraseSector_t of the bound sim
+  * @param
+  * @retval
+  */
+int32_t NVRSimEraseLL(uint32_t addr)
+{
+    return NVRSimErase(Bound, addr);
+}
+
+/* ----------------------------------------- Private functions -------------------------------------------------*/    
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static int32_t NVRSimSubmit(void *ctx, NVRAsyncReq_t *req)
+{
+    NVRSim_t *sim = (NVRSim_t *)ctx;
+    int32_t ret = 0;
+    
+    pthread_mutex_lock(&sim->Lock);
+    if (sim->QueueCount + sim->DoneCount >= NVR_SIM_QUEUE_MAX) {
+        ret = NVR_ERROR_BUSY;
+    } else {
+        sim->Queue[sim->QueueCount++] = req;
+        pthread_cond_broadcast(&sim->Cond);
+    }
+    pthread_mutex_unlock(&sim->Lock);
+    return ret;
+}
+
+/**
+  * @brief      Reports the finished requests in the caller's thread
+  * @param
+  * @retval
+  */
+static void NVRSimPoll(void *ctx)
+{
+    NVRSim_t *sim = (NVRSim_t *)ctx;
+    NVRAsyncReq_t *done[NVR_SIM_QUEUE_MAX];
+    int32_t status[NVR_SIM_QUEUE_MAX];
+    uint32_t i, n;
+    
+    pthread_mutex_lock(&sim->Lock);
+    n = sim->DoneCount;
+    memcpy(done, sim->Done, n * sizeof(done[0]));
+    memcpy(status, sim->DoneStatus, n * sizeof(status[0]));
+    sim->DoneCount = 0;
+    pthread_mutex_unlock(&sim->Lock);
+    
+    for (i = 0; i < n; i++) NVRAsyncComplete(done[i], status[i]);
+}
+
+/**
+  * @brief      Executes the requests of its bank in the submission order
+  * @param
+  * @retval
+  */
+static void *NVRSimWorker(void *arg)
+{
+    NVRSimWorker_t *w = (NVRSimWorker_t *)arg;
+    NVRSim_t *sim = w->Sim;
+    
+    pthread_mutex_lock(&sim->Lock);
+    while (sim->Stop == 0) {
+        NVRAsyncReq_t *req = 0;
+        uint32_t i;
+        for (i = 0; i < sim->QueueCount; i++) {
+            if ((((sim->Queue[i]->Addr - sim->StartAddr) / sim->SectorSize) % sim->Banks) == w->Bank) {
+                req = sim->Queue[i];
+                memmove(&sim->Queue[i], &sim->Queue[i + 1], (sim->QueueCount - i - 1) * sizeof(sim->Queue[0]));
+                sim->QueueCount--;
+                break;
+            }
+        }
+        if (req == 0) {
+            pthread_cond_wait(&sim->Cond, &sim->Lock);
+            continue;
+        }
+        pthread_mutex_unlock(&sim->Lock);
+        
+        int32_t status;
+        uint32_t busUs = (uint32_t)(((uint64_t)req->Size * sim->Timing.BusNsPerByte) / 1000);
+        if (req->Op == NVR_ASYNC_OP_READ) {
+            NVRSimSleep(sim->Timing.ReadUs + busUs);
+            status = NVRSimRead(sim, req->Addr, req->Data, req->Size);
+        } else if (req->Op == NVR_ASYNC_OP_WRITE) {
+            NVRSimSleep(sim->Timing.ProgramUs + busUs);
+            status = NVRSimWrite(sim, req->Addr, req->Data, req->Size);
+        } else {
+            NVRSimSleep(sim->Timing.EraseUs);
+            status = NVRSimErase(sim, req->Addr);
+        }
+        
+        pthread_mutex_lock(&sim->Lock);
+        sim->Done[sim->DoneCount] = req;
+        sim->DoneStatus[sim->DoneCount++] = status;
+    }
+    pthread_mutex_unlock(&sim->Lock);
+    return 0;
+}
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+static void NVRSimSleep(uint32_t us)
+{
+    struct timespec ts;
+    if (us == 0) return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (long)(us % 1000000) * 1000;
+    nanosleep(&ts, 0);
+}
+
+/**
+  * @brief      Counts the operation and its modelled time: the busy time plus the transfer
+  * @param      op: NVR_ASYNC_OP_xxx
+  * @retval
+  */
+static void NVRSimAccount(NVRSim_t *sim, uint8_t op, uint32_t size, uint32_t violations)
+{
+    NVRSimStats_t *st = &sim->Stats;
+    
+    if (sim->Started) pthread_mutex_lock(&sim->Lock);     // the workers of the banks run at once
+    if (op == NVR_ASYNC_OP_READ) {
+        st->Reads++;
+        st->ReadBytes += size;
+        st->TimeNs += (uint64_t)sim->Timing.ReadUs * 1000 + (uint64_t)size * sim->Timing.BusNsPerByte;
+    } else if (op == NVR_ASYNC_OP_WRITE) {
+        st->Programs++;
+        st->ProgramBytes += size;
+        st->Violations += violations;
+        st->TimeNs += (uint64_t)sim->Timing.ProgramUs * 1000 + (uint64_t)size * sim->Timing.BusNsPerByte;
+    } else {
+        st->Erases++;
+        st->TimeNs += (uint64_t)sim->Timing.EraseUs * 1000;
+    }
+    if (sim->Started) pthread_mutex_unlock(&sim->Lock);
+}
+
+
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
@@ -0,0 +1,113 @@
+/**
+  ******************************************************************************
+  * @file    nvr_sim.h
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Linux NOR flash simulator for testing and benchmarking the store.
+  *          Programming clears bits only, erasing sets a sector to 0xFF.
+  *          The memory is RAM or a mmap'd file that keeps the image between runs.
+  *          The synchronous driver (NVRSimReadLL...) adds up the modelled device
+  *          time instead of sleeping, so the benchmarks are reproducible.
+  *          The asynchronous driver executes the requests on a worker thread
+  *          per bank (sectors are interleaved over the banks) sleeping for the
+  *          busy time of the operation.
+  ******************************************************************************
+  */
+#ifndef _NVR_SIM_H
+#define _NVR_SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include "nvram_kv.h"
+
+
+
+#define NVR_SIM_BANKS_MAX                               4
+#define NVR_SIM_QUEUE_MAX                               64
+
+
+#define NVR_SIM_FLAGS_STRICT                            (1 << 0)        // a program that would set a bit fails instead of being counted
+
+
+
+typedef struct {
+    uint32_t                    ReadUs;             // busy time of a read request
+    uint32_t                    ProgramUs;          // of a page program
+    uint32_t                    EraseUs;            // of a sector erase
+    uint32_t                    BusNsPerByte;       // transfer time on the bus, both directions
+} NVRSimTiming_t;
+
+
+typedef struct {
+    uint64_t                    Reads;
+    uint64_t                    ReadBytes;
+    uint64_t                    Programs;
+    uint64_t                    ProgramBytes;
+    uint64_t                    Erases;
+    uint64_t                    Violations;         // programs that tried to set a bit, the bit stays 0 as on NOR
+    uint64_t                    TimeNs;             // modelled busy time of the device
+} NVRSimStats_t;
+
+
+typedef struct {
+    pthread_t                   Thread;
+    struct NVRSim               *Sim;
+    uint32_t                    Bank;
+} NVRSimWorker_t;
+
+
+typedef struct NVRSim {
+    uint8_t                     *Mem;
+    uint32_t                    StartAddr;
+    uint32_t                    Size;
+    uint32_t                    PageSize;
+    uint32_t                    SectorSize;
+    uint32_t                    Banks;
+    NVRSimTiming_t              Timing;
+    uint32_t                    Flags;
+    int                         Fd;                 // -1 if the memory is RAM
+    NVRSimStats_t               Stats;
+    
+    NVRAsyncLL_t                AsyncLL;
+    NVRSimWorker_t              Worker[NVR_SIM_BANKS_MAX];
+    pthread_mutex_t             Lock;
+    pthread_cond_t              Cond;
+    NVRAsyncReq_t               *Queue[NVR_SIM_QUEUE_MAX];     // submitted, in order
+    uint32_t                    QueueCount;
+    NVRAsyncReq_t               *Done[NVR_SIM_QUEUE_MAX];      // finished, not reported yet
+    int32_t                     DoneStatus[NVR_SIM_QUEUE_MAX];
+    uint32_t                    DoneCount;
+    uint8_t                     Stop;
+    uint8_t                     Started;
+} NVRSim_t;
+
+
+
+
+int32_t             NVRSimInit(NVRSim_t *sim, uint32_t startAddr, uint32_t size, uint32_t pageSize, uint32_t sectorSize, const NVRSimTiming_t *timing);
+int32_t             NVRSimInitFile(NVRSim_t *sim, const char *path, uint32_t startAddr, uint32_t size, uint32_t pageSize, uint32_t sectorSize, const NVRSimTiming_t *timing);
+void                NVRSimDeInit(NVRSim_t *sim);
+void                NVRSimSetFlags(NVRSim_t *sim, uint32_t flags);
+void                NVRSimResetStats(NVRSim_t *sim);
+const NVRAsyncLL_t *NVRSimAsyncLL(NVRSim_t *sim, uint32_t banks);
+int32_t             NVRSimRead(NVRSim_t *sim, uint32_t addr, uint8_t *data, uint32_t size);
+int32_t             NVRSimWrite(NVRSim_t *sim, uint32_t addr, const uint8_t *data, uint32_t size);
+int32_t             NVRSimErase(NVRSim_t *sim, uint32_t addr);
+
+void                NVRSimBind(NVRSim_t *sim);
+int32_t             NVRSimReadLL(uint32_t addr, uint8_t *data, uint32_t size);
+int32_t             NVRSimWriteLL(uint32_t addr, uint8_t *data, uint32_t size);
+int32_t             NVRSimEraseLL(uint32_t addr);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NVR_SIM_H
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
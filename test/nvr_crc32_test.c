@@ -0,0 +1,109 @@
+/**
+  ******************************************************************************
+  * @file    nvr_crc32_test.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Check value of every CRC-32 engine: 0xCBF43926 for "123456789".
+  *          Every engine also gives the bitwise result on the data split at any point
+  *          and on the unaligned ends of a longer buffer.
+  ******************************************************************************
+  */
+
+#include "nvram_crc32.h"
+#include <stdio.h>
+#include <string.h>
+
+
+
+
+#define CHECK_VALUE             0xCBF43926
+#define DATA_SIZE               1024
+
+
+
+typedef uint32_t (*CRCUpdate_t)(uint32_t crc, const uint8_t *data, uint32_t size);
+
+typedef struct {
+    const char                  *Name;
+    CRCUpdate_t                 Update;
+} Engine_t;
+
+
+static const Engine_t           Engines[] = {
+    {"bitwise", NVRCRC32UpdateBitwise},
+    {"slice8",  NVRCRC32UpdateSlice8},
+#ifdef NVR_CRC32_HW_AVAILABLE
+    {"hw",      NVRCRC32UpdateHW},
+#endif
+};
+
+static const uint8_t            Check[] = "123456789";
+static uint8_t                  Data[DATA_SIZE];
+
+
+
+static int TestEngine(const Engine_t *e);
+
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+int main(void)
+{
+    uint32_t i, crc, failed = 0;
+
+    for (i = 0; i < DATA_SIZE; i++) Data[i] = (uint8_t)(i * 131 + (i >> 3));
+    for (i = 0; i < sizeof(Engines) / sizeof(Engines[0]); i++) {
+        if (0 != TestEngine(&Engines[i])) failed++;
+    }
+    crc = NVRCRC32(Check, sizeof(Check) - 1);
+    if (crc != CHECK_VALUE) {
+        printf("NVRCRC32: %08X, expected %08X\n", crc, CHECK_VALUE);
+        failed++;
+    }
+    crc = NVRCRC32Final(NVRCRC32Update(NVRCRC32Init(), Check, sizeof(Check) - 1));
+    if (crc != CHECK_VALUE) {
+        printf("NVRCRC32Update: %08X, expected %08X\n", crc, CHECK_VALUE);
+        failed++;
+    }
+    printf("%u failed\n", failed);
+    return (failed) ? 1 : 0;
+}
+
+/**
+  * @brief      The check value, the splits and the unaligned ends against the bitwise engine
+  * @param
+  * @retval     0 if OK
+  */
+static int TestEngine(const Engine_t *e)
+{
+    uint32_t crc, ref, split, start, size;
+
+    crc = NVRCRC32Final(e->Update(NVR_CRC32_INIT, Check, sizeof(Check) - 1));
+    if (crc != CHECK_VALUE) {
+        printf("%s: %08X, expected %08X\n", e->Name, crc, CHECK_VALUE);
+        return -1;
+    }
+    ref = NVRCRC32UpdateBitwise(NVR_CRC32_INIT, Data, DATA_SIZE);
+    for (split = 0; split <= DATA_SIZE; split++) {
+        crc = e->Update(e->Update(NVR_CRC32_INIT, Data, split), Data + split, DATA_SIZE - split);
+        if (crc != ref) {
+            printf("%s: split at %u differs\n", e->Name, split);
+            return -1;
+        }
+    }
+    for (start = 0; start < 16; start++) {
+        for (size = 0; start + size <= DATA_SIZE; size += 1 + size / 4) {
+            if (e->Update(NVR_CRC32_INIT, Data + start, size) != NVRCRC32UpdateBitwise(NVR_CRC32_INIT, Data + start, size)) {
+                printf("%s: %u bytes at %u differ\n", e->Name, size, start);
+                return -1;
+            }
+        }
+    }
+    printf("%s ok\n", e->Name);
+    return 0;
+}
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------
@@ -0,0 +1,1305 @@
+/**
+  ******************************************************************************
+  * @file    nvr_kv_test.c
+  * @author  Yuri Martentsev <yurimartens@gmail.com>, <yuri.martens@yandex.ru>
+  * @brief   Model test of the store on the simulated NOR: random writes and deletes of a set of keys,
+  *          the store is mounted again from time to time and every key is checked against the model.
+  *          Runs over the combinations of NVR_FLAGS_PAGE_ALIGN, NVR_FLAGS_COMPACT, NVR_FLAGS_HEADER_V2,
+  *          the compression, the write-back page buff and the page cache, the cached keys are read between the
+  *          writes too. The random play runs with 
+  *          the async driver of the simulator as well, and with the erase reserve kept by NVRMaintenance.
+  *          With the checkpoints every mount is compared to a full mount of the memory.
+  *          With the write-back some writes after a sync are dropped by a remount: every key holds one of its values.
+  *          With the direct access the lookups and the reads dont go to the LL, the values are read by NVRGetView.
+  *          Built with NVR_STATS the counters of random ops are compared to the ops and to the simulator.
+  *          A fixed size record written to the keys in turn is mounted again after every write: the layout
+  *          repeats from pass to pass then and an old record follows the head with the same prev.
+  *          Compressed records of HEADER_V2 with deletes are mounted again with a tombstone at the head:
+  *          an old header lies further on in the free space after it.
+  *          A time series of ascending ids with deletes is walked by the iterators over ranges of the newest
+  *          records forward and backward across the wrap around, with the RAM index and without it. Without it
+  *          the ids are looked up by the exact scans with the sector summaries too, they read less than a plain handle.
+  *          The series is striped over two or three stores by the id hash and in turn: the lookups and the merged
+  *          walks forward and backward go across the stores.
+  *          A compressed record and a stored one are read through every read API.
+  *          The live keys are exported after random writes and deletes, the store is erased and the snapshot
+  *          is imported back.
+  *          Usage: nvr_kv_test [ops]
+  ******************************************************************************
+  */
+
+#include "nvram_kv.h"
+#include "nvram_kv_stripe.h"
+#include "nvr_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+
+
+#define PAGE_SIZE               256
+#define SECTOR_SIZE             4096
+#define STORE_SIZE              (64 * 1024)
+#define KEYS                    40
+#define VALUE_MAX               300
+#define OPS_DEFAULT             3000
+#define REMOUNT_ODDS            40          // a remount every that many ops on average
+#define CACHE_PAGES             4
+#define CACHE_READ_ODDS         2           // keys read between the writes with the page cache
+#define PERIODIC_SIZE           100
+#define PERIODIC_OPS            2000
+#define TOMBSTONE_OPS           3000
+#define TOMBSTONE_ODDS          4           // a delete every that many ops on average
+#define TOMBSTONE_RUNS          32
+#define SERIES_OPS              2000
+#define SERIES_IDS              1024        // the index capacity, the ids of a series on the memory
+#define SERIES_SIZE_MIN         64
+#define SERIES_WINDOW           100         // the newest records, all of them are still on the memory
+#define SERIES_CHECK_ODDS       16
+#define SERIES_LOOKUPS          8           // ids of the window looked up by the exact scans
+#define ASYNC_DEPTH             4
+#define ERASE_RESERVE           2
+#define CHECKPOINT_SIZE         (2 * SECTOR_SIZE)   // behind the store
+#define SNAPSHOT_OPS            1000
+#define HEADER_CACHE_SIZE       16
+#define POWER_LOSS_KEYS         3           // written after the sync, the buffer is dropped then
+#define STRIPE_DEVS             3
+#define STRIPE_STORE_SIZE       (STORE_SIZE / 4)    // a store per device, the devices one after another on the memory
+#define STRIPE_WINDOW           60          // the newest records of the series, all of them are still on the stores
+
+#define TEST_ALIGN              (1 << 0)
+#define TEST_COMPACT            (1 << 1)
+#define TEST_V2                 (1 << 2)
+#define TEST_LZ                 (1 << 3)
+#define TEST_WRITE_BACK         (1 << 4)
+#define TEST_CACHE              (1 << 5)
+#define TEST_ALL                (1 << 6)
+#define TEST_NO_INDEX           (1 << 7)    // the head is found by NVROpenFile or by NVRMount with TEST_SUMMARY, the series only
+#define TEST_DIRECT             (1 << 8)    // the reads go to the memory in place
+#define TEST_ASYNC              (1 << 9)    // the values are written and read by the async jobs
+#define TEST_RESERVE            (1 << 10)   // NVRMaintenance completes the erase reserve before some of the writes
+#define TEST_CHECKPOINT         (1 << 11)   // the mounts start at the checkpoints
+#define TEST_STATS              (1 << 12)   // the counters are set by the mount, NVR_STATS builds
+#define TEST_SUMMARY            (1 << 13)   // the exact scans skip the sectors by the summaries
+#define TEST_HEADER_CACHE       (1 << 14)   // the records before the head are walked through the header cache
+#define TEST_STRIPE_HASH        (1 << 15)   // the stripe puts the records by the id hash, else in turn
+#define TEST_STRIPE_WIDE        (1 << 16)   // three stores in the stripe, else two
+
+
+
+typedef int (*Play_t)(uint32_t mode, uint32_t ops);
+
+typedef struct {
+    uint32_t                    Size;               // 0 if the key is deleted or never written
+    uint8_t                     Data[VALUE_MAX];
+} Value_t;
+
+typedef struct {
+    uint8_t                     Data[2 * STORE_SIZE];   // the frames of the live records take less than the store
+    uint32_t                    Size;
+    uint32_t                    Pos;                // bytes read back
+} Stream_t;
+
+
+static NVRSim_t                 Sim;
+static NVRamKV_t                Nvr;
+static uint8_t                  Page[PAGE_SIZE];
+static uint8_t                  WriteBack[PAGE_SIZE];
+static uint8_t                  CachePages[CACHE_PAGES * PAGE_SIZE];
+static NVRCacheSlot_t           CacheSlots[CACHE_PAGES];
+static NVRPageCache_t           Cache;
+static uint32_t                 Work[(NVR_LZ_WORK_MIN + VALUE_MAX + 64) / 4];
+static NVRIndexEntry_t          Index[SERIES_IDS];
+static Value_t                  Model[KEYS];
+static Value_t                  Pending[POWER_LOSS_KEYS];
+static uint8_t                  Data[VALUE_MAX];
+static uint8_t                  Back[VALUE_MAX];
+static uint32_t                 Seed;
+static NVRIter_t                Iter;
+static uint8_t                  IterBuf[2 * PAGE_SIZE];
+static uint16_t                 SeriesSize[SERIES_OPS + 1];
+static uint8_t                  SeriesDeleted[SERIES_OPS + 1];
+static NVRCursor_t              Cursor;
+static uint8_t                  CursorPage[PAGE_SIZE];
+static NVRAsyncReq_t            Queue[ASYNC_DEPTH];
+static Stream_t                 Stream;
+static NVRamKV_t                Full;               // mounted by the scan of the whole memory
+static uint8_t                  FullPage[PAGE_SIZE];
+static NVRIndexEntry_t          FullIndex[SERIES_IDS];
+static uint32_t                 CheckpointInterval;
+static uint32_t                 PowerLossLost;      // writes after the sync dropped by the remount
+static uint32_t                 PowerLossKept;
+static uint32_t                 CheckpointShorter;  // mounts that read less than the full mount
+static NVRStats_t               Counters;
+static NVRSummary_t             Summaries[STORE_SIZE / SECTOR_SIZE];
+static uint32_t                 SummaryShorter;     // lookups that read less than the ones without the summaries
+static NVRIndexEntry_t          HeaderRing[HEADER_CACHE_SIZE];
+static uint8_t                  HeaderBlock[2 * PAGE_SIZE];
+static uint64_t                 HeaderCacheReads;   // LL reads of the walks with the cache
+static uint64_t                 HeaderCacheReadsFull;
+static uint32_t                 Ticks;
+static NVRamKV_t                StripeDev[STRIPE_DEVS];
+static NVRamKV_t *const         StripeDevs[STRIPE_DEVS] = {&StripeDev[0], &StripeDev[1], &StripeDev[2]};
+static uint8_t                  StripeDevPage[STRIPE_DEVS][PAGE_SIZE];
+static NVRIndexEntry_t          StripeIndex[STRIPE_DEVS][SERIES_IDS / 4];
+static uint8_t                  StripePages[STRIPE_DEVS * PAGE_SIZE];
+static NVRStripe_t              Stripe;
+static NVRStripeIter_t          StripeIter;
+static uint8_t                  StripeIterBuf[STRIPE_DEVS * 2 * PAGE_SIZE];
+static uint8_t                  StripeStore[SERIES_OPS + 1];   // in turn: the store of the id
+static uint32_t                 StripeSwitches;     // steps of the walks from a store to another one
+
+
+
+static uint32_t Rand(void);
+static int Mount(uint32_t mode);
+static int Check(uint32_t mode, uint32_t op);
+static int CheckKey(uint32_t mode, uint32_t op, uint32_t key);
+static int Run(uint32_t mode, uint32_t seed, uint32_t ops, Play_t play);
+static int Play(uint32_t mode, uint32_t ops);
+static int PowerLoss(uint32_t mode, uint32_t ops);
+static int Periodic(uint32_t mode, uint32_t ops);
+static int Tombstones(uint32_t mode, uint32_t ops);
+static int Series(uint32_t mode, uint32_t ops);
+static int SeriesWalk(uint32_t mode, uint32_t from, uint32_t to, uint32_t flags, uint32_t *wraps);
+static void SeriesFill(uint32_t id);
+static int ReadApis(uint32_t mode, uint32_t ops);
+static int ReadCheck(uint32_t mode, uint32_t id, const char *api, NVRError_t ret, NVRError_t expected, const uint8_t *data);
+static int Snapshot(uint32_t mode, uint32_t ops);
+static int32_t StreamWrite(void *ctx, const uint8_t *data, uint32_t size);
+static int32_t StreamRead(void *ctx, uint8_t *data, uint32_t size);
+static NVRError_t Write(uint32_t mode, uint32_t key, uint8_t *data, uint32_t size);
+static int MountFull(uint32_t mode, uint64_t reads);
+static NVRError_t Read(uint32_t mode, uint8_t *data, uint32_t size);
+#ifdef NVR_STATS
+static int Stats(uint32_t mode, uint32_t ops);
+static int StatsCheck(uint32_t mode, uint32_t op, const NVRSimStats_t *sim, const uint32_t *count);
+#endif
+static uint32_t Clock(void);
+static int SeriesLookup(uint32_t mode, uint32_t id);
+static int PrevWalk(uint32_t mode, uint32_t op);
+static int Stripes(uint32_t mode, uint32_t ops);
+static int StripeMount(uint32_t mode);
+static int StripeLookup(uint32_t mode, uint32_t id, uint32_t last);
+static int StripeWalk(uint32_t mode, uint32_t from, uint32_t to, uint32_t flags);
+
+
+/**
+  * @brief
+  * @param
+  * @retval
+  */
+int main(int argc, char **argv)
+{
+    uint32_t ops = (argc > 1) ? (uint32_t)strtoul(argv[1], 0, 0) : OPS_DEFAULT;
+    uint32_t mode, run, failed = 0;
+
+    for (mode = 0; mode < TEST_ALL; mode++) {
+        if (0 != Run(mode, mode + 1, ops, Play)) failed++;
+    }
+    printf("%u of %u modes failed\n", failed, TEST_ALL);
+    for (mode = TEST_ALIGN; mode < TEST_LZ; mode++) {
+        if (0 != Run(mode, mode + 1, PERIODIC_OPS, Periodic)) failed++;
+    }
+    for (mode = 0; mode < TEST_LZ; mode++) {
+        if (0 != Run(TEST_ASYNC | mode, mode + 1, ops / 2, Play)) failed++;
+        if (0 != Run(TEST_RESERVE | mode, mode + 1, ops / 2, Play)) failed++;
+    }
+    for (CheckpointInterval = 1; CheckpointInterval <= 4; CheckpointInterval *= 4) {
+        for (mode = 0; mode < TEST_LZ; mode++) {
+            if (0 != Run(TEST_CHECKPOINT | TEST_WRITE_BACK | mode, mode + 1, ops / 2, Play)) failed++;
+            if (0 != Run(TEST_CHECKPOINT | mode, mode + 1, PERIODIC_OPS / 4, Periodic)) failed++;
+        }
+    }
+    for (mode = 0; mode < TEST_CACHE; mode++) {
+        if (0 != Run(TEST_DIRECT | mode, mode + 1, ops / 4, Play)) failed++;
+    }
+    for (mode = 0; mode < TEST_WRITE_BACK; mode++) {
+        if (0 != Run(TEST_WRITE_BACK | mode, mode + 1, ops / 2, PowerLoss)) failed++;
+    }
+    if ((PowerLossLost == 0) || (PowerLossKept == 0)) {
+        printf("%u writes after the sync lost, %u kept\n", PowerLossLost, PowerLossKept);
+        failed++;
+    }
+#ifdef NVR_STATS
+    for (mode = 0; mode < TEST_LZ; mode++) {
+        if (0 != Run(TEST_STATS | mode, mode + 1, ops, Stats)) failed++;
+    }
+#else
+    if (NVR_ERROR_INIT != NVRStatsInit(&Nvr, &Counters, Clock)) failed++;
+#endif
+    for (mode = 0; mode < TEST_WRITE_BACK; mode++) {
+        HeaderCacheReads = HeaderCacheReadsFull = 0;
+        if (0 != Run(TEST_HEADER_CACHE | mode, mode + 1, ops / 4, Play)) {
+            failed++;
+        } else if (HeaderCacheReads > HeaderCacheReadsFull) {
+            printf("mode %02x: the walks have read %u times with the header cache, %u times without\n", TEST_HEADER_CACHE | mode,
+                   (uint32_t)HeaderCacheReads, (uint32_t)HeaderCacheReadsFull);
+            failed++;
+        }
+    }
+    if (CheckpointShorter == 0) {
+        printf("no mount started at a checkpoint\n");
+        failed++;
+    }
+    for (run = 0; run < TOMBSTONE_RUNS; run++) {
+        if (0 != Run(TEST_V2 | TEST_COMPACT | TEST_LZ, run + 1, TOMBSTONE_OPS, Tombstones)) failed++;
+        if (0 != Run(TEST_V2 | TEST_COMPACT | TEST_LZ | TEST_ALIGN, run + 1, TOMBSTONE_OPS, Tombstones)) failed++;
+    }
+    for (mode = 0; mode < 4; mode++) {
+        if (0 != Run(((mode & 1) ? TEST_NO_INDEX : 0) | ((mode & 2) ? TEST_V2 : 0), mode + 1, SERIES_OPS, Series)) failed++;
+    }
+    if (0 != Run(TEST_ALIGN | TEST_CACHE, 1, SERIES_OPS, Series)) failed++;
+    for (mode = 0; mode < 2; mode++) {
+        if (0 != Run(TEST_NO_INDEX | TEST_SUMMARY | ((mode & 1) ? TEST_V2 : 0), mode + 1, SERIES_OPS, Series)) failed++;
+    }
+    if (SummaryShorter == 0) {
+        printf("no lookup found its id skipping a sector by the summaries\n");
+        failed++;
+    }
+    for (mode = 0; mode < 4; mode++) {
+        if (0 != Run(((mode & 1) ? TEST_STRIPE_HASH : 0) | ((mode & 2) ? TEST_STRIPE_WIDE : 0), mode + 1, SERIES_OPS, Stripes)) failed++;
+    }
+    if (StripeSwitches == 0) {
+        printf("no walk went from a store to another one\n");
+        failed++;
+    }
+    for (mode = 0; mode < 4; mode++) {
+        if (0 != Run(TEST_LZ | ((mode & 1) ? TEST_V2 : 0) | ((mode & 2) ? TEST_DIRECT : 0), mode + 1, 0, ReadApis)) failed++;
+    }
+    for (mode = 0; mode < 4; mode++) {
+        if (0 != Run(TEST_LZ | ((mode & 1) ? TEST_V2 : TEST_COMPACT) | ((mode & 2) ? TEST_WRITE_BACK | TEST_ALIGN : 0), mode + 1, SNAPSHOT_OPS, Snapshot)) failed++;
+    }
+    return (failed) ? 1 : 0;
+}
+
+/**
+  * @brief      A run on an erased simulated memory
+  * @param
+  * @retval     0 if OK
+  */
+static int Run(uint32_t mode, uint32_t seed, uint32_t ops, Play_t play)
+{
+    int ret;
+
+    if (0 != NVRSimInit(&Sim, 0, STORE_SIZE + CHECKPOINT_SIZE, PAGE_SIZE, SECTOR_SIZE, 0)) exit(1);
+    NVRSimSetFlags(&Sim, NVR_SIM_FLAGS_STRICT);
+    NVRSimBind(&Sim);
+    memset(Model, 0, sizeof(Model));
+    Seed = seed;
+    ret = play(mode, ops);
+    NVRSimDeInit(&Sim);
+    return ret;
+}
+
+/**
+  * @brief      Random writes and deletes, the store is mounted again from time to time
+  * @param
+  * @retval     0 if the store matches the model all the time
+  */
+static int Play(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, k, size, key, n = 0;
+    NVRError_t ret;
+
+    if (0 != Mount(mode)) return -1;
+    for (i = 0; i < ops; i++) {
+        // with no compaction the ring erases the keys not written lately: all of them are written in turn then
+        key = (mode & TEST_COMPACT) ? Rand() % KEYS : i % KEYS;
+        if (Rand() % 8 == 0) {
+            ret = NVRDeleteFile(&Nvr, key + 1);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM) && !((ret == NVR_ERROR_NOT_FOUND) && (Model[key].Size == 0))) {
+                printf("mode %02x op %u: delete of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = 0;
+        } else {
+            size = 1 + Rand() % VALUE_MAX;
+            if (Rand() % 2) {
+                for (k = 0; k < size; k++) Data[k] = (uint8_t)Rand();
+            } else {
+                for (k = 0; k < size; k++) Data[k] = (uint8_t)(key + i + k / 32);      // compressible
+            }
+            ret = Write(mode, key + 1, Data, size);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = size;
+            memcpy(Model[key].Data, Data, size);
+        }
+        if ((mode & TEST_HEADER_CACHE) && (Rand() % REMOUNT_ODDS == 0) && (0 != PrevWalk(mode, i))) return -1;     // the cache filled by the writes
+        if ((mode & TEST_CACHE) && (Rand() % CACHE_READ_ODDS == 0)) {      // the pages cached before the writes and the erases
+            key = Rand() % KEYS;
+            if ((0 != CheckKey(mode, i, key)) || (0 != CheckKey(mode, i, (key + 1) % KEYS))) return -1;
+            NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+        }
+        if (Rand() % REMOUNT_ODDS == 0) {
+            if ((mode & TEST_WRITE_BACK) && (NVR_ERROR_NONE != NVRSync(&Nvr))) return -1;
+            if ((0 != Mount(mode)) || (0 != Check(mode, i))) return -1;
+            n++;
+        }
+    }
+    if ((mode & TEST_WRITE_BACK) && (NVR_ERROR_NONE != NVRSync(&Nvr))) return -1;
+    if ((0 != Mount(mode)) || (0 != Check(mode, i))) return -1;
+    printf("mode %02x: %u ops, %u remounts ok\n", mode, ops, n + 1);
+    return 0;
+}
+
+/**
+  * @brief      Random writes are synced from time to time, a few keys are written after the sync and the store 
+  *             is mounted again: a fresh handle drops the buffer as a power loss does. Every key holds its synced 
+  *             value or the new one, the buffer is programmed in order and no new value follows an old one. 
+  *             The values found are the model then. The handle not ready refuses the write-back calls.
+  * @param
+  * @retval     0 if the store matches the model all the time
+  */
+static int PowerLoss(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, j, k, size, key, lost = PowerLossLost, kept = PowerLossKept;
+    uint8_t older;
+    NVRError_t ret;
+
+    if ((NVR_ERROR_NONE != NVRInit(&Nvr, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, Page, 0)) ||
+        (NVR_ERROR_INIT != NVRWriteBackPoll(&Nvr)) || (NVR_ERROR_INIT != NVRSync(&Nvr))) {
+        printf("mode %02x: the write-back of a handle with no LL is not refused\n", mode);
+        return -1;
+    }
+    if (0 != Mount(mode)) return -1;
+    for (i = 0; i < ops; i++) {
+        key = i % KEYS;
+        size = 1 + Rand() % VALUE_MAX;
+        for (k = 0; k < size; k++) Data[k] = (uint8_t)Rand();
+        ret = Write(mode, key + 1, Data, size);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+            printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+            return -1;
+        }
+        Model[key].Size = size;
+        memcpy(Model[key].Data, Data, size);
+        if (Rand() % REMOUNT_ODDS) continue;
+        if (NVR_ERROR_NONE != NVRSync(&Nvr)) return -1;
+        for (j = 0; j < POWER_LOSS_KEYS; j++) {
+            key = (i + 1 + j) % KEYS;       // the next ones in turn
+            Pending[j].Size = 1 + Rand() % VALUE_MAX;
+            for (k = 0; k < Pending[j].Size; k++) Pending[j].Data[k] = (uint8_t)Rand();
+            ret = Write(mode, key + 1, Pending[j].Data, Pending[j].Size);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+        }
+        if (0 != Mount(mode)) return -1;
+        for (j = 0, older = 0; j < POWER_LOSS_KEYS; j++) {
+            key = (i + 1 + j) % KEYS;
+            ret = NVROpenFile(&Nvr, key + 1, &size, 0, 0);
+            if ((ret == NVR_ERROR_OPENED) && (NVR_ERROR_NONE != (ret = Read(mode, Back, size)))) size = 0;
+            if ((ret == NVR_ERROR_NONE) && (size == Pending[j].Size) && (0 == memcmp(Back, Pending[j].Data, size)) && (older == 0)) {
+                Model[key] = Pending[j];
+                PowerLossKept++;
+                continue;
+            }
+            if (((ret == NVR_ERROR_NONE) && (size == Model[key].Size) && (0 == memcmp(Back, Model[key].Data, size))) || 
+                ((ret == NVR_ERROR_NOT_FOUND) && (Model[key].Size == 0))) {
+                older = 1;
+                PowerLossLost++;
+                continue;
+            }
+            printf("mode %02x op %u: key %u written after the sync returned %d size %u, neither value %s\n", mode, i, key + 1, 
+                   ret, size, (older) ? "after a write lost" : "");
+            return -1;
+        }
+        if (0 != Check(mode, i)) return -1;
+    }
+    printf("mode %02x: %u writes after the sync lost, %u kept ok\n", mode, PowerLossLost - lost, PowerLossKept - kept);
+    return 0;
+}
+
+/**
+  * @brief      The same size written to the keys in turn, a remount after every write
+  * @param
+  * @retval     0 if the store matches the model all the time
+  */
+static int Periodic(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, k, key;
+    NVRError_t ret;
+
+    if (0 != Mount(mode)) return -1;
+    for (i = 0; i < ops; i++) {
+        key = i % KEYS;
+        for (k = 0; k < PERIODIC_SIZE; k++) Data[k] = (uint8_t)(i + k);
+        ret = NVRWriteFile(&Nvr, key + 1, Data, PERIODIC_SIZE);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+            printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+            return -1;
+        }
+        Model[key].Size = PERIODIC_SIZE;
+        memcpy(Model[key].Data, Data, PERIODIC_SIZE);
+        if ((mode & TEST_WRITE_BACK) && (NVR_ERROR_NONE != NVRSync(&Nvr))) return -1;
+        if ((0 != Mount(mode)) || (0 != Check(mode, i))) return -1;
+    }
+    printf("mode %02x: %u periodic writes ok\n", mode, ops);
+    return 0;
+}
+
+/**
+  * @brief      Compressible writes and deletes, a remount after every delete
+  * @param
+  * @retval     0 if the store matches the model all the time
+  */
+static int Tombstones(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, k, size, key;
+    NVRError_t ret;
+
+    if (0 != Mount(mode)) return -1;
+    for (i = 0; i < ops; i++) {
+        key = Rand() % KEYS;
+        if (Rand() % TOMBSTONE_ODDS == 0) {
+            ret = NVRDeleteFile(&Nvr, key + 1);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM) && !((ret == NVR_ERROR_NOT_FOUND) && (Model[key].Size == 0))) {
+                printf("mode %02x op %u: delete of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = 0;
+            if ((0 != Mount(mode)) || (0 != Check(mode, i))) return -1;
+        } else {
+            size = 1 + Rand() % VALUE_MAX;
+            for (k = 0; k < size; k++) Data[k] = (uint8_t)(key + i + k / 16);
+            ret = NVRWriteFile(&Nvr, key + 1, Data, size);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = size;
+            memcpy(Model[key].Data, Data, size);
+        }
+    }
+    printf("mode %02x: %u writes and deletes ok\n", mode, ops);
+    return 0;
+}
+
+/**
+  * @brief      Ascending ids of random sizes, some of the newest ones are deleted. The newest records are 
+  *             walked from time to time, the store is mounted again before some of the walks
+  * @param
+  * @retval     0 if the walks match the model and some of them go across the wrap around
+  */
+static int Series(uint32_t mode, uint32_t ops)
+{
+    uint32_t id, k, from, to, wraps = 0;
+    NVRError_t ret;
+
+    if (ops > SERIES_OPS) ops = SERIES_OPS;
+    memset(SeriesDeleted, 0, sizeof(SeriesDeleted));
+    if ((0 != Mount(mode)) || (NVR_ERROR_NONE != NVRIterInit(&Nvr, &Iter, IterBuf, sizeof(IterBuf)))) return -1;
+    for (id = 1; id <= ops; id++) {
+        SeriesSize[id] = (uint16_t)(SERIES_SIZE_MIN + Rand() % (VALUE_MAX - SERIES_SIZE_MIN));
+        SeriesFill(id);
+        ret = NVRWriteFile(&Nvr, id, Data, SeriesSize[id]);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+            printf("mode %02x: write of %u returned %d\n", mode, id, ret);
+            return -1;
+        }
+        k = id - Rand() % (SERIES_WINDOW / 2);
+        if ((id > SERIES_WINDOW) && (Rand() % TOMBSTONE_ODDS == 0) && (SeriesDeleted[k] == 0)) {
+            ret = NVRDeleteFile(&Nvr, k);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x: delete of %u returned %d\n", mode, k, ret);
+                return -1;
+            }
+            SeriesDeleted[k] = 1;
+        }
+        if ((id <= SERIES_WINDOW) || (Rand() % SERIES_CHECK_ODDS)) continue;
+        if ((Rand() % 4 == 0) && (0 != Mount(mode))) return -1;
+        from = id - SERIES_WINDOW + 1;
+        k = from + Rand() % SERIES_WINDOW;
+        to = k + Rand() % (id - k + 1);
+        if ((mode & TEST_SUMMARY) && (0 != SeriesLookup(mode, id))) return -1;
+        if ((0 != SeriesWalk(mode, from, id, 0, &wraps)) || (0 != SeriesWalk(mode, from, id, NVR_OPEN_FLAGS_BACKWARD, &wraps)) || 
+            (0 != SeriesWalk(mode, k, to, 0, &wraps)) || (0 != SeriesWalk(mode, k, to, NVR_OPEN_FLAGS_BACKWARD, &wraps))) return -1;
+    }
+    if (wraps == 0) {
+        printf("mode %02x: no walk went across the wrap around\n", mode);
+        return -1;
+    }
+    printf("mode %02x: %u series records, %u walks across the wrap around ok\n", mode, ops, wraps);
+    return 0;
+}
+
+/**
+  * @brief      Seeks the range and walks it to the end: every id of it is expected once in order, the 
+  *             tombstones are skipped and, with the RAM index, the deleted ids as well
+  * @param      flags: NVR_OPEN_FLAGS_BACKWARD or 0
+  * @param      wraps: counts the walks going across the end of the memory
+  * @retval     0 if OK
+  */
+static int SeriesWalk(uint32_t mode, uint32_t from, uint32_t to, uint32_t flags, uint32_t *wraps)
+{
+    int step = (flags & NVR_OPEN_FLAGS_BACKWARD) ? -1 : 1;
+    uint32_t id = (step < 0) ? to : from, addr = 0, wrapped = 0;
+    NVRError_t ret = NVRIterSeek(&Nvr, &Iter, from, to, flags);
+
+    for (;; id += step) {
+        while ((id >= from) && (id <= to) && (SeriesDeleted[id]) && (0 == (mode & TEST_NO_INDEX))) id += step;
+        if ((id < from) || (id > to)) break;
+        if ((ret != NVR_ERROR_OPENED) || (Iter.Rec.Id != id) || (Iter.Rec.Size != SeriesSize[id])) {
+            printf("mode %02x: walk %u..%u %s returned %d id %u size %u, expected %u size %u\n", mode, from, to, (step < 0) ? "backward" : "forward", 
+                   ret, (uint32_t)Iter.Rec.Id, Iter.Rec.Size, id, SeriesSize[id]);
+            return -1;
+        }
+        if ((addr) && ((step < 0) ? (Iter.Rec.Addr > addr) : (Iter.Rec.Addr < addr))) wrapped = 1;
+        addr = Iter.Rec.Addr;
+        SeriesFill(id);
+        if ((NVR_ERROR_NONE != (ret = NVRIterRead(&Nvr, &Iter, 0, Back, SeriesSize[id]))) || (0 != memcmp(Back, Data, SeriesSize[id]))) {
+            printf("mode %02x: id %u read returned %d or the data differ\n", mode, id, ret);
+            return -1;
+        }
+        ret = NVRIterNext(&Nvr, &Iter);
+    }
+    if (ret != NVR_ERROR_NOT_FOUND) {
+        printf("mode %02x: walk %u..%u returned %d id %u past the range\n", mode, from, to, ret, (uint32_t)Iter.Rec.Id);
+        return -1;
+    }
+    *wraps += wrapped;
+    return 0;
+}
+
+/**
+  * @brief      Exact lookups of some live ids of the window and of the next id, not written yet. The ones 
+  *             of a handle without the summaries give the same and read no less. The scan ends in the 
+  *             free space after the head or at the end of the memory, the records behind the head after 
+  *             the wrap around arent found
+  * @param      id: the newest id
+  * @retval     0 if OK
+  */
+static int SeriesLookup(uint32_t mode, uint32_t id)
+{
+    uint32_t i, look, size, sizeFull;
+    uint64_t reads, readsFull;
+    NVRError_t ret, retFull;
+
+    if ((NVR_ERROR_NONE != NVRInit(&Full, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, FullPage, Nvr.Flags)) ||
+        (NVR_ERROR_NONE != NVRInitLL(&Full, NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL))) return -1;
+    NVROpenFile(&Full, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    for (i = 0; i <= SERIES_LOOKUPS; i++) {
+        look = (i == SERIES_LOOKUPS) ? id + 1 : id - Rand() % SERIES_WINDOW;
+        if ((i < SERIES_LOOKUPS) && (SeriesDeleted[look])) continue;
+        reads = Sim.Stats.ReadBytes;
+        ret = NVROpenFile(&Nvr, look, &size, 0, 0);
+        reads = Sim.Stats.ReadBytes - reads;
+        readsFull = Sim.Stats.ReadBytes;
+        retFull = NVROpenFile(&Full, look, &sizeFull, 0, 0);
+        readsFull = Sim.Stats.ReadBytes - readsFull;
+        if ((ret != retFull) || (size != sizeFull) || ((i == SERIES_LOOKUPS) && (ret != NVR_ERROR_NOT_FOUND) && (ret != NVR_ERROR_END_MEM)) || ((ret == NVR_ERROR_OPENED) && (size != SeriesSize[look]))) {
+            printf("mode %02x: the lookup of %u returned %d size %u, without the summaries %d size %u\n", mode, look, ret, size, retFull, sizeFull);
+            return -1;
+        }
+        SeriesFill(look);
+        if ((ret == NVR_ERROR_OPENED) && ((NVR_ERROR_NONE != (ret = NVRReadFile(&Nvr, 0, Back, size))) || (0 != memcmp(Back, Data, size)))) {
+            printf("mode %02x: id %u read returned %d or the data differ\n", mode, look, ret);
+            return -1;
+        }
+        if (reads > readsFull) {
+            printf("mode %02x: the lookup of %u has read %u bytes with the summaries, %u without\n", mode, look, (uint32_t)reads, (uint32_t)readsFull);
+            return -1;
+        }
+        if ((reads < readsFull) && (retFull == NVR_ERROR_OPENED)) SummaryShorter++;
+    }
+    NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    return 0;
+}
+
+/**
+  * @brief      The value of a series id to Data
+  * @param
+  * @retval
+  */
+static void SeriesFill(uint32_t id)
+{
+    uint32_t k;
+    for (k = 0; k < SeriesSize[id]; k++) Data[k] = (uint8_t)(id * 7 + k);
+}
+
+/**
+  * @brief      Key 1 is compressed, key 2 is stored as is. NVRReadFile, NVRReadFileRaw and the streams unpack 
+  *             the compressed one, the cursor, the iterator, the async read and the view refuse it
+  * @param
+  * @retval     0 if every read gives the value or the expected error
+  */
+static int ReadApis(uint32_t mode, uint32_t ops)
+{
+    uint32_t id, k, size, read, pos;
+    const uint8_t *view;
+    NVRReadStream_t rs;
+    NVRError_t ret, packed;
+
+    (void)ops;
+    if ((0 != Mount(mode)) || (NVR_ERROR_NONE != NVRAsyncInit(&Nvr, NVRSimAsyncLL(&Sim, 1), Queue, ASYNC_DEPTH)) || 
+        (NVR_ERROR_NONE != NVRCursorInit(&Nvr, &Cursor, CursorPage)) || (NVR_ERROR_NONE != NVRIterInit(&Nvr, &Iter, IterBuf, sizeof(IterBuf)))) return -1;
+    for (k = 0; k < VALUE_MAX; k++) {
+        Model[0].Data[k] = (uint8_t)(k / 32);
+        Model[1].Data[k] = (uint8_t)Rand();
+    }
+    for (id = 1; id <= 2; id++) {
+        Model[id - 1].Size = VALUE_MAX;
+        if (NVR_ERROR_NONE != NVRWriteFile(&Nvr, id, Model[id - 1].Data, VALUE_MAX)) return -1;
+    }
+    for (id = 1; id <= 2; id++) {
+        packed = (id == 1) ? NVR_ERROR_ARGUMENT : NVR_ERROR_NONE;
+        ret = NVROpenFile(&Nvr, id, &size, 0, 0);
+        if ((ret != NVR_ERROR_OPENED) || (size != VALUE_MAX)) {
+            printf("mode %02x: key %u open returned %d size %u\n", mode, id, ret, size);
+            return -1;
+        }
+        if ((id == 1) && (Nvr.FoundFileSize >= VALUE_MAX)) {
+            printf("mode %02x: key 1 is not compressed\n", mode);
+            return -1;
+        }
+        if (0 != ReadCheck(mode, id, "read", NVRReadFile(&Nvr, 0, Back, VALUE_MAX), NVR_ERROR_NONE, Back)) return -1;
+        pos = VALUE_MAX / 3;
+        memcpy(Back, Model[id - 1].Data, pos);      // a part at an offset
+        ret = NVRReadFileRaw(&Nvr, pos, &Back[pos], VALUE_MAX - pos);
+        if (0 != ReadCheck(mode, id, "raw read", ret, NVR_ERROR_NONE, Back)) return -1;
+        ret = NVRReadBegin(&Nvr, &rs);
+        for (pos = 0; (ret == NVR_ERROR_NONE) && (pos < VALUE_MAX); pos += read) {
+            ret = NVRReadChunk(&Nvr, &rs, &Back[pos], 64, &read);
+            if (read == 0) break;
+        }
+        if ((ret == NVR_ERROR_NONE) && (pos != VALUE_MAX)) ret = NVR_ERROR_END_MEM;
+        if (0 != ReadCheck(mode, id, "stream", ret, NVR_ERROR_NONE, Back)) return -1;
+        ret = NVRGetView(&Nvr, &view, &size);
+        if (0 != ReadCheck(mode, id, "view", ret, (mode & TEST_DIRECT) ? packed : NVR_ERROR_INIT, view)) return -1;
+        ret = NVRAsyncReadFile(&Nvr, Back);
+        if (ret == NVR_ERROR_NONE) {
+            while (NVR_ERROR_BUSY == (ret = NVRAsyncPoll(&Nvr)));
+        }
+        if (0 != ReadCheck(mode, id, "async read", ret, packed, Back)) return -1;
+        ret = NVRCursorOpen(&Nvr, &Cursor, id, &size, 0, 0);
+        if (ret == NVR_ERROR_OPENED) ret = NVRCursorRead(&Nvr, &Cursor, 0, Back, size);
+        if (0 != ReadCheck(mode, id, "cursor read", ret, packed, Back)) return -1;
+        ret = NVRIterSeek(&Nvr, &Iter, id, id, 0);
+        if (ret == NVR_ERROR_OPENED) ret = NVRIterRead(&Nvr, &Iter, 0, Back, Iter.Rec.Size);
+        if (0 != ReadCheck(mode, id, "iterator read", ret, packed, Back)) return -1;
+    }
+    printf("mode %02x: read APIs ok\n", mode);
+    return 0;
+}
+
+/**
+  * @brief      The result of a read of the key, the value if it has been read
+  * @param      data: VALUE_MAX bytes read
+  * @retval     0 if OK
+  */
+static int ReadCheck(uint32_t mode, uint32_t id, const char *api, NVRError_t ret, NVRError_t expected, const uint8_t *data)
+{
+    if (ret != expected) {
+        printf("mode %02x: key %u %s returned %d, expected %d\n", mode, id, api, ret, expected);
+        return -1;
+    }
+    if ((ret == NVR_ERROR_NONE) && (0 != memcmp(data, Model[id - 1].Data, VALUE_MAX))) {
+        printf("mode %02x: key %u %s data differ\n", mode, id, api);
+        return -1;
+    }
+    memset(Back, 0, sizeof(Back));
+    return 0;
+}
+
+/**
+  * @brief      Random writes and deletes, the live keys are exported, the store is erased and the snapshot 
+  *             is imported back. An export by a handle not ready gives no records
+  * @param
+  * @retval     0 if the imported store matches the model
+  */
+static int Snapshot(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, k, size, key, count = 1, live = 0, packed = 0;
+    NVRSnapshotFrame_t f;
+    NVRError_t ret;
+
+    if ((NVR_ERROR_NONE != NVRInit(&Nvr, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, Page, 0)) || 
+        (NVR_ERROR_INIT != NVRExport(&Nvr, StreamWrite, &Stream, IterBuf, sizeof(IterBuf), &count)) || (count != 0)) {
+        printf("mode %02x: export before NVRInitLL gave %u records\n", mode, count);
+        return -1;
+    }
+    if (0 != Mount(mode)) return -1;
+    for (i = 0; i < ops; i++) {
+        key = Rand() % KEYS;
+        if (Rand() % TOMBSTONE_ODDS == 0) {
+            ret = NVRDeleteFile(&Nvr, key + 1);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM) && !((ret == NVR_ERROR_NOT_FOUND) && (Model[key].Size == 0))) {
+                printf("mode %02x op %u: delete of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = 0;
+            continue;
+        }
+        size = 1 + Rand() % VALUE_MAX;
+        for (k = 0; k < size; k++) Data[k] = (key % 2) ? (uint8_t)Rand() : (uint8_t)(key + i + k / 16);
+        ret = NVRWriteFile(&Nvr, key + 1, Data, size);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+            printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+            return -1;
+        }
+        Model[key].Size = size;
+        memcpy(Model[key].Data, Data, size);
+    }
+    for (key = 0; key < KEYS; key++) {
+        if (Model[key].Size) live++;
+    }
+    
+    Stream.Size = 0;
+    if ((NVR_ERROR_NONE != (ret = NVRExport(&Nvr, StreamWrite, &Stream, IterBuf, sizeof(IterBuf), &count))) || (count != live)) {
+        printf("mode %02x: export returned %d, %u records of %u\n", mode, ret, count, live);
+        return -1;
+    }
+    for (i = sizeof(NVRSnapshotHeader_t); i + sizeof(f) <= Stream.Size; i += sizeof(f) + (f.Size & ~NVR_SNAPSHOT_LZ)) {
+        memcpy(&f, &Stream.Data[i], sizeof(f));
+        if (f.Size == NVR_SNAPSHOT_END) break;
+        if (f.Size & NVR_SNAPSHOT_LZ) packed++;
+    }
+    if (packed == 0) {
+        printf("mode %02x: no compressed record in the snapshot\n", mode);
+        return -1;
+    }
+    if ((NVR_ERROR_NONE != NVREraseAll(&Nvr)) || (0 != Mount(mode))) return -1;
+    Stream.Pos = 0;
+    if ((NVR_ERROR_NONE != (ret = NVRImport(&Nvr, StreamRead, &Stream, IterBuf, sizeof(IterBuf), &count))) || (count != live)) {
+        printf("mode %02x: import returned %d, %u records of %u\n", mode, ret, count, live);
+        return -1;
+    }
+    if ((mode & TEST_WRITE_BACK) && (NVR_ERROR_NONE != NVRSync(&Nvr))) return -1;
+    if ((0 != Mount(mode)) || (0 != Check(mode, ops))) return -1;
+    printf("mode %02x: %u records, %u compressed, exported and imported ok\n", mode, live, packed);
+    return 0;
+}
+
+/**
+  * @brief      The export appends to the stream
+  * @param
+  * @retval     0 if OK
+  */
+static int32_t StreamWrite(void *ctx, const uint8_t *data, uint32_t size)
+{
+    Stream_t *st = (Stream_t *)ctx;
+    if (st->Size + size > sizeof(st->Data)) return -1;
+    memcpy(&st->Data[st->Size], data, size);
+    st->Size += size;
+    return 0;
+}
+
+/**
+  * @brief      The import reads the stream back
+  * @param
+  * @retval     0 if OK
+  */
+static int32_t StreamRead(void *ctx, uint8_t *data, uint32_t size)
+{
+    Stream_t *st = (Stream_t *)ctx;
+    if (st->Pos + size > st->Size) return -1;
+    memcpy(data, &st->Data[st->Pos], size);
+    st->Pos += size;
+    return 0;
+}
+
+#ifdef NVR_STATS
+/**
+  * @brief      Random writes, deletes and reads on the mounted store. Before every remount the counters
+  *             are compared to the ops and to the ones of the simulator, then they are reset
+  * @param
+  * @retval     0 if the counters match
+  */
+static int Stats(uint32_t mode, uint32_t ops)
+{
+    uint32_t i, k, size, key, count[NVR_STATS_OPS] = {0};
+    NVRSimStats_t sim = Sim.Stats;
+    NVRError_t ret;
+
+    if (0 != Mount(mode)) return -1;
+    count[NVR_STATS_OPEN] = 1;                              // the head by the mount
+    if ((Counters.LLReads == 0) || (Counters.HeadersParsed != 0)) {
+        printf("mode %02x: the mount of the erased memory has %u reads, %u headers\n", mode, Counters.LLReads, Counters.HeadersParsed);
+        return -1;
+    }
+    for (i = 0; i < ops; i++) {
+        key = (mode & TEST_COMPACT) ? Rand() % KEYS : i % KEYS;
+        if (Rand() % 4 == 0) {
+            ret = NVROpenFile(&Nvr, key + 1, &size, 0, 0);
+            count[NVR_STATS_OPEN]++;
+            if (ret == NVR_ERROR_OPENED) {
+                count[NVR_STATS_READ]++;
+                if ((NVR_ERROR_NONE != (ret = NVRReadFile(&Nvr, 0, Back, size))) || (size != Model[key].Size) || 
+                    (0 != memcmp(Back, Model[key].Data, size))) {
+                    printf("mode %02x op %u: key %u read returned %d or the data differ\n", mode, i, key + 1, ret);
+                    return -1;
+                }
+            } else if ((ret != NVR_ERROR_NOT_FOUND) || (Model[key].Size)) {
+                printf("mode %02x op %u: key %u open returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);     // the head for the writes
+            count[NVR_STATS_OPEN]++;
+        } else if (Rand() % 8 == 0) {
+            ret = NVRDeleteFile(&Nvr, key + 1);
+            count[NVR_STATS_WRITE]++;
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM) && !((ret == NVR_ERROR_NOT_FOUND) && (Model[key].Size == 0))) {
+                printf("mode %02x op %u: delete of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = 0;
+        } else {
+            size = 1 + Rand() % VALUE_MAX;
+            for (k = 0; k < size; k++) Data[k] = (uint8_t)Rand();
+            ret = NVRWriteFile(&Nvr, key + 1, Data, size);
+            count[NVR_STATS_WRITE]++;
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x op %u: write of %u returned %d\n", mode, i, key + 1, ret);
+                return -1;
+            }
+            Model[key].Size = size;
+            memcpy(Model[key].Data, Data, size);
+        }
+        if (Rand() % REMOUNT_ODDS == 0) {
+            if (0 != StatsCheck(mode, i, &sim, count)) return -1;
+            if (NVR_ERROR_NONE != NVRStatsReset(&Nvr)) return -1;
+            sim = Sim.Stats;
+            if ((0 != Mount(mode)) || (0 != Check(mode, i))) return -1;
+            count[NVR_STATS_OPEN] = 1 + KEYS + 1;           // the mount, the keys and the head again
+            count[NVR_STATS_READ] = 0;
+            for (key = 0; key < KEYS; key++) {
+                if (Model[key].Size) count[NVR_STATS_READ]++;
+            }
+            count[NVR_STATS_WRITE] = 0;
+            if (Counters.HeadersParsed == 0) {
+                printf("mode %02x op %u: the mount has parsed no header\n", mode, i);
+                return -1;
+            }
+        }
+    }
+    if (0 != StatsCheck(mode, i, &sim, count)) return -1;
+    if ((NVR_ERROR_ARGUMENT != NVRStatsGet(&Nvr, 0)) || (NVR_ERROR_NONE != NVRStatsInit(&Nvr, 0, 0)) ||
+        (NVR_ERROR_INIT != NVRStatsGet(&Nvr, &Counters)) || (NVR_ERROR_INIT != NVRStatsReset(&Nvr))) {
+        printf("mode %02x: the calls without the counters dont return NVR_ERROR_INIT\n", mode);
+        return -1;
+    }
+    printf("mode %02x: %u ops, the counters ok\n", mode, ops);
+    return 0;
+}
+
+/**
+  * @brief      The LL counters against the simulator since its snapshot, the latencies against the ops
+  * @param      sim: the simulator stats at the reset of the counters
+  * @param      count: the ops by NVR_STATS_xxx
+  * @retval     0 if they match
+  */
+static int StatsCheck(uint32_t mode, uint32_t op, const NVRSimStats_t *sim, const uint32_t *count)
+{
+    NVRStats_t snapshot;
+    uint32_t i, k, sum;
+
+    if (NVR_ERROR_NONE != NVRStatsGet(&Nvr, &snapshot)) return -1;
+    if ((snapshot.LLReads != Sim.Stats.Reads - sim->Reads) || (snapshot.BytesRead != Sim.Stats.ReadBytes - sim->ReadBytes) ||
+        (snapshot.LLWrites != Sim.Stats.Programs - sim->Programs) || (snapshot.BytesWritten != Sim.Stats.ProgramBytes - sim->ProgramBytes) ||
+        (snapshot.LLErases != Sim.Stats.Erases - sim->Erases)) {
+        printf("mode %02x op %u: the counters have %u reads %u writes %u erases, the simulator %u %u %u\n", mode, op, 
+               snapshot.LLReads, snapshot.LLWrites, snapshot.LLErases, (uint32_t)(Sim.Stats.Reads - sim->Reads), 
+               (uint32_t)(Sim.Stats.Programs - sim->Programs), (uint32_t)(Sim.Stats.Erases - sim->Erases));
+        return -1;
+    }
+    if ((count[NVR_STATS_READ]) && (snapshot.CRCBytes == 0)) {
+        printf("mode %02x op %u: no CRC bytes counted\n", mode, op);
+        return -1;
+    }
+    for (i = 0; i < NVR_STATS_OPS; i++) {
+        for (k = 0, sum = 0; k < NVR_STATS_BINS; k++) sum += snapshot.Latency[i].Bins[k];
+        if (i == NVR_STATS_ERASE) {
+            if (snapshot.Latency[i].Count == snapshot.LLErases) continue;
+        } else if (snapshot.Latency[i].Count == count[i]) {
+            if ((sum == count[i]) && (snapshot.Latency[i].Sum >= count[i])) continue;  // the clock ticks on every call
+        }
+        printf("mode %02x op %u: %u latencies of the op %u, %u in the bins, expected %u\n", mode, op, snapshot.Latency[i].Count, i, sum, 
+               (i == NVR_STATS_ERASE) ? snapshot.LLErases : count[i]);
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+/**
+  * @brief      Walks the records back from the head by NVR_OPEN_FLAGS_PREVIOUS with the header cache and 
+  *             on a handle mounted without it: the same records in the same order. The LL reads of the
+  *             steps are summed up, the cache must save them over a run.
+  *             The scan doesnt stop at the oldest record, the walk ends when it gets back to the head or to 
+  *             the record it steps from
+  * @param
+  * @retval     0 if OK, the head is opened again for the writes
+  */
+static int PrevWalk(uint32_t mode, uint32_t op)
+{
+    uint32_t size, sizeFull, head, addr = 0, steps = 0;
+    NVRError_t ret, retFull;
+
+    if ((NVR_ERROR_NONE != NVRInit(&Full, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, FullPage, Nvr.Flags)) ||
+        (NVR_ERROR_NONE != NVRInitLL(&Full, NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL)) ||
+        ((mode & TEST_LZ) && (NVR_ERROR_NONE != NVRCompressInit(&Full, (uint8_t *)Work, sizeof(Work)))) ||   // the unpacked sizes
+        (NVR_ERROR_NONE != NVRMount(&Full, FullIndex, SERIES_IDS))) return -1;
+    ret = NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    retFull = NVROpenFile(&Full, 0, &sizeFull, NVR_OPEN_FLAGS_MAX_ID, 0);
+    head = Full.FoundFileAddr;
+    while ((ret == retFull) && (Nvr.FoundFileId == Full.FoundFileId) && (Nvr.FoundFileAddr == Full.FoundFileAddr) && (size == sizeFull)) {
+        if ((ret != NVR_ERROR_OPENED) || (Full.FoundFileAddr == addr) || ((steps) && (Full.FoundFileAddr == head)) || (steps == STORE_SIZE / 16)) break;
+        addr = Full.FoundFileAddr;
+        HeaderCacheReads -= Sim.Stats.Reads;
+        ret = NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_PREVIOUS, 0);
+        HeaderCacheReads += Sim.Stats.Reads;
+        HeaderCacheReadsFull -= Sim.Stats.Reads;
+        retFull = NVROpenFile(&Full, 0, &sizeFull, NVR_OPEN_FLAGS_PREVIOUS, 0);
+        HeaderCacheReadsFull += Sim.Stats.Reads;
+        steps++;
+    }
+    if ((ret != retFull) || (Nvr.FoundFileId != Full.FoundFileId) || (Nvr.FoundFileAddr != Full.FoundFileAddr) || (size != sizeFull)) {
+        printf("mode %02x op %u: step %u back returned %d id %u at %u size %u, without the cache %d id %u at %u size %u\n", mode, op, steps, 
+               ret, (uint32_t)Nvr.FoundFileId, Nvr.FoundFileAddr, size, retFull, (uint32_t)Full.FoundFileId, Full.FoundFileAddr, sizeFull);
+        return -1;
+    }
+    NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    return 0;
+}
+
+/**
+  * @brief      Ticks once on every call
+  * @param
+  * @retval
+  */
+static uint32_t Clock(void)
+{
+    return Ticks++;
+}
+
+/**
+  * @brief      Writes a value, an async job is submitted and polled until it ends with TEST_ASYNC.
+  *             With TEST_RESERVE a write after the reserve is complete only programs pages.
+  * @param
+  * @retval     the result of the write
+  */
+static NVRError_t Write(uint32_t mode, uint32_t key, uint8_t *data, uint32_t size)
+{
+    uint64_t erases;
+    NVRError_t ret;
+
+    if ((mode & TEST_RESERVE) && (Rand() % 2)) {
+        while (NVR_ERROR_BUSY == (ret = NVRMaintenance(&Nvr, 1)));
+        if (ret != NVR_ERROR_NONE) return ret;
+        erases = Sim.Stats.Erases;
+        ret = NVRWriteFile(&Nvr, key, data, size);
+        if (Sim.Stats.Erases != erases) {
+            printf("mode %02x: the write of %u erased a sector, the reserve is complete\n", mode, key);
+            return NVR_ERROR_HW;
+        }
+        return ret;
+    }
+    if (0 == (mode & TEST_ASYNC)) return NVRWriteFile(&Nvr, key, data, size);
+    if (NVR_ERROR_NONE != (ret = NVRAsyncWriteFile(&Nvr, key, data, size))) return ret;
+    if (NVR_ERROR_BUSY != NVRAsyncWriteFile(&Nvr, key, data, size)) return NVR_ERROR_ARGUMENT;     // one job at a time
+    while (NVR_ERROR_BUSY == (ret = NVRAsyncPoll(&Nvr)));
+    return ret;
+}
+
+/**
+  * @brief      Reads the whole opened value as Write has written it, in place with TEST_DIRECT 
+  *             unless the value is compressed
+  * @param
+  * @retval     the result of the read
+  */
+static NVRError_t Read(uint32_t mode, uint8_t *data, uint32_t size)
+{
+    const uint8_t *view;
+    uint32_t viewSize;
+    NVRError_t ret;
+
+    if (mode & TEST_DIRECT) {
+        ret = NVRGetView(&Nvr, &view, &viewSize);
+        if ((ret == NVR_ERROR_ARGUMENT) && (mode & TEST_LZ)) return NVRReadFile(&Nvr, 0, data, size);
+        if (ret != NVR_ERROR_NONE) return ret;
+        if ((viewSize != size) || (view < Sim.Mem) || (view + size > Sim.Mem + STORE_SIZE)) return NVR_ERROR_ARGUMENT;
+        memcpy(data, view, size);
+        return NVR_ERROR_NONE;
+    }
+
+    if ((0 == (mode & TEST_ASYNC)) || (mode & TEST_LZ)) return NVRReadFile(&Nvr, 0, data, size);
+    if (NVR_ERROR_NONE != (ret = NVRAsyncReadFile(&Nvr, data))) return ret;
+    while (NVR_ERROR_BUSY == (ret = NVRAsyncPoll(&Nvr)));
+    return ret;
+}
+
+/**
+  * @brief      Mounts the memory by the scan of all of it and compares the index and the head 
+  *             to the ones of the mount of Nvr
+  * @param      reads: bytes read by the mount of Nvr
+  * @retval     0 if they are the same
+  */
+static int MountFull(uint32_t mode, uint64_t reads)
+{
+    NVRError_t ret;
+
+    if ((NVR_ERROR_NONE != NVRInit(&Full, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, FullPage, Nvr.Flags)) ||
+        (NVR_ERROR_NONE != NVRInitLL(&Full, NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL))) return -1;
+    reads = Sim.Stats.ReadBytes + reads;
+    if (NVR_ERROR_NONE != (ret = NVRMount(&Full, FullIndex, SERIES_IDS))) {
+        printf("mode %02x: full mount returned %d\n", mode, ret);
+        return -1;
+    }
+    if ((Full.IndexCount != Nvr.IndexCount) || (0 != memcmp(FullIndex, Index, Full.IndexCount * sizeof(NVRIndexEntry_t))) || 
+        (0 != memcmp(&Full.IndexHead, &Nvr.IndexHead, sizeof(NVRIndexEntry_t)))) {
+        printf("mode %02x: the checkpoint mount has %u ids head at %u, the full one %u ids head at %u\n", mode, 
+               Nvr.IndexCount, Nvr.IndexHead.Addr, Full.IndexCount, Full.IndexHead.Addr);
+        return -1;
+    }
+    if (Sim.Stats.ReadBytes > reads) CheckpointShorter++;
+    return 0;
+}
+
+/**
+  * @brief      A fresh handle over the memory, the head is opened for the writes
+  * @param
+  * @retval     0 if OK
+  */
+static int Mount(uint32_t mode)
+{
+    uint32_t size, flags = 0;
+    uint64_t reads;
+    NVRError_t ret;
+
+    if (mode & TEST_ALIGN) flags |= NVR_FLAGS_PAGE_ALIGN;
+    if (mode & TEST_COMPACT) flags |= NVR_FLAGS_COMPACT;
+    if (mode & TEST_V2) flags |= NVR_FLAGS_HEADER_V2;
+    if ((NVR_ERROR_NONE != NVRInit(&Nvr, PAGE_SIZE, SECTOR_SIZE, 0, STORE_SIZE, Page, flags)) ||
+        (NVR_ERROR_NONE != NVRInitLL(&Nvr, NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL))) return -1;
+    if ((mode & TEST_STATS) && (NVR_ERROR_NONE != NVRStatsInit(&Nvr, &Counters, Clock))) return -1;
+    if ((mode & TEST_LZ) && (NVR_ERROR_NONE != NVRCompressInit(&Nvr, (uint8_t *)Work, sizeof(Work)))) return -1;
+    if ((mode & TEST_WRITE_BACK) && (NVR_ERROR_NONE != NVRWriteBackInit(&Nvr, WriteBack, 0, 0))) return -1;
+    if ((mode & TEST_CACHE) && (NVR_ERROR_NONE != NVRPageCacheInit(&Nvr, &Cache, CacheSlots, CachePages, CACHE_PAGES))) return -1;
+    if ((mode & TEST_DIRECT) && (NVR_ERROR_NONE != NVRInitDirect(&Nvr, Sim.Mem))) return -1;
+    if ((mode & TEST_ASYNC) && (NVR_ERROR_NONE != NVRAsyncInit(&Nvr, NVRSimAsyncLL(&Sim, 2), Queue, ASYNC_DEPTH))) return -1;
+    if ((mode & TEST_RESERVE) && (NVR_ERROR_NONE != NVRSetEraseReserve(&Nvr, ERASE_RESERVE))) return -1;
+    if ((mode & TEST_CHECKPOINT) && (NVR_ERROR_NONE != NVRCheckpointInit(&Nvr, STORE_SIZE, CHECKPOINT_SIZE, CheckpointInterval))) return -1;
+    if ((mode & TEST_HEADER_CACHE) && (NVR_ERROR_NONE != NVRHeaderCacheInit(&Nvr, HeaderRing, HEADER_CACHE_SIZE, HeaderBlock, sizeof(HeaderBlock)))) return -1;
+    if ((mode & TEST_SUMMARY) && (NVR_ERROR_NONE != NVRSummaryInit(&Nvr, Summaries, STORE_SIZE / SECTOR_SIZE))) return -1;
+    reads = Sim.Stats.ReadBytes;
+    if (((0 == (mode & TEST_NO_INDEX)) && (NVR_ERROR_NONE != (ret = NVRMount(&Nvr, Index, SERIES_IDS)))) ||
+        ((mode & TEST_NO_INDEX) && (mode & TEST_SUMMARY) && (NVR_ERROR_NONE != (ret = NVRMount(&Nvr, 0, 0))))) {
+        printf("mode %02x: mount returned %d\n", mode, ret);
+        return -1;
+    }
+    if ((mode & TEST_CHECKPOINT) && (0 != MountFull(mode, Sim.Stats.ReadBytes - reads))) return -1;
+    NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    return 0;
+}
+
+/**
+  * @brief      Every key is read and compared to the model, the head is opened again for the writes
+  * @param
+  * @retval     0 if OK
+  */
+static int Check(uint32_t mode, uint32_t op)
+{
+    uint32_t key, size;
+    uint64_t reads = Sim.Stats.Reads;
+
+    if (Nvr.IndexCount > KEYS) {
+        printf("mode %02x op %u: %u ids in the index\n", mode, op, Nvr.IndexCount);
+        return -1;
+    }
+    for (key = 0; key < KEYS; key++) {
+        if (0 != CheckKey(mode, op, key)) return -1;
+    }
+    if ((mode & TEST_DIRECT) && (Sim.Stats.Reads != reads)) {
+        printf("mode %02x op %u: the direct access has read by the LL\n", mode, op);
+        return -1;
+    }
+    if ((mode & TEST_HEADER_CACHE) && (0 != PrevWalk(mode, op))) return -1;
+    NVROpenFile(&Nvr, 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    return 0;
+}
+
+/**
+  * @brief      A series of ascending ids with deletes striped over the stores, the store is mounted again from time 
+  *             to time. Some ids of the newest records are looked up and read, the records are walked forward and 
+  *             backward merged from the stores.
+  * @param
+  * @retval     0 if the stores match the series all the time
+  */
+static int Stripes(uint32_t mode, uint32_t ops)
+{
+    uint32_t id, k, from, to, n;
+    NVRError_t ret;
+
+    if (ops > SERIES_OPS) ops = SERIES_OPS;
+    memset(SeriesDeleted, 0, sizeof(SeriesDeleted));
+    if (0 != StripeMount(mode)) return -1;
+    for (id = 1; id <= ops; id++) {
+        SeriesSize[id] = (uint16_t)(SERIES_SIZE_MIN + Rand() % (VALUE_MAX - SERIES_SIZE_MIN));
+        SeriesFill(id);
+        StripeStore[id] = (uint8_t)Stripe.Next;
+        ret = NVRStripeWriteFile(&Stripe, id, Data, SeriesSize[id]);
+        if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+            printf("mode %02x: write of %u returned %d\n", mode, id, ret);
+            return -1;
+        }
+        k = id - Rand() % (STRIPE_WINDOW / 2);
+        if ((id > STRIPE_WINDOW) && (Rand() % TOMBSTONE_ODDS == 0) && (SeriesDeleted[k] == 0)) {
+            ret = NVRStripeDeleteFile(&Stripe, k);
+            if ((ret != NVR_ERROR_NONE) && (ret != NVR_ERROR_END_MEM)) {
+                printf("mode %02x: delete of %u returned %d\n", mode, k, ret);
+                return -1;
+            }
+            SeriesDeleted[k] = 1;
+        }
+        if ((id <= STRIPE_WINDOW) || (Rand() % SERIES_CHECK_ODDS)) continue;
+        if ((Rand() % 4 == 0) && (0 != StripeMount(mode))) return -1;
+        from = id - STRIPE_WINDOW + 1;
+        for (n = 0; n < SERIES_LOOKUPS; n++) {
+            if (0 != StripeLookup(mode, from + Rand() % STRIPE_WINDOW, id)) return -1;
+        }
+        k = from + Rand() % STRIPE_WINDOW;
+        to = k + Rand() % (id - k + 1);
+        if ((0 != StripeLookup(mode, id + 1, id)) || 
+            (0 != StripeWalk(mode, from, id, 0)) || (0 != StripeWalk(mode, from, id, NVR_OPEN_FLAGS_BACKWARD)) || 
+            (0 != StripeWalk(mode, k, to, 0)) || (0 != StripeWalk(mode, k, to, NVR_OPEN_FLAGS_BACKWARD))) return -1;
+    }
+    if ((0 != StripeMount(mode)) || (0 != StripeWalk(mode, ops - STRIPE_WINDOW + 1, ops, 0))) return -1;
+    printf("mode %02x: %u striped records ok\n", mode, ops);
+    return 0;
+}
+
+/**
+  * @brief      Fresh handles over the stores, the heads are opened for the writes as NVRStripeInit expects
+  * @param
+  * @retval     0 if OK
+  */
+static int StripeMount(uint32_t mode)
+{
+    uint32_t d, size, count = (mode & TEST_STRIPE_WIDE) ? 3 : 2;
+    NVRError_t ret;
+
+    for (d = 0; d < count; d++) {
+        if ((NVR_ERROR_NONE != NVRInit(&StripeDev[d], PAGE_SIZE, SECTOR_SIZE, d * STRIPE_STORE_SIZE, STRIPE_STORE_SIZE, StripeDevPage[d], 0)) ||
+            (NVR_ERROR_NONE != NVRInitLL(&StripeDev[d], NVRSimReadLL, NVRSimWriteLL, NVRSimEraseLL))) return -1;
+        if (NVR_ERROR_NONE != (ret = NVRMount(&StripeDev[d], StripeIndex[d], SERIES_IDS / 4))) {
+            printf("mode %02x: mount of store %u returned %d\n", mode, d, ret);
+            return -1;
+        }
+        NVROpenFile(&StripeDev[d], 0, &size, NVR_OPEN_FLAGS_MAX_ID, 0);
+    }
+    if ((NVR_ERROR_NONE != NVRStripeInit(&Stripe, StripeDevs, count, StripePages, (mode & TEST_STRIPE_HASH) ? NVR_STRIPE_FLAGS_HASH : 0)) ||
+        (NVR_ERROR_NONE != NVRStripeIterInit(&Stripe, &StripeIter, StripeIterBuf, count * sizeof(StripeIterBuf) / STRIPE_DEVS))) return -1;
+    return 0;
+}
+
+/**
+  * @brief      The id is opened and read through the stripe, in turn it is in the store that took its write
+  * @param      last: the newest id written
+  * @retval     0 if OK
+  */
+static int StripeLookup(uint32_t mode, uint32_t id, uint32_t last)
+{
+    uint32_t size;
+    NVRError_t ret = NVRStripeOpenFile(&Stripe, id, &size, 0);
+
+    if ((id > last) || (SeriesDeleted[id])) {
+        if (ret == NVR_ERROR_NOT_FOUND) return 0;
+        printf("mode %02x: id %u %s, open returned %d\n", mode, id, (id > last) ? "is not written" : "is deleted", ret);
+        return -1;
+    }
+    if ((ret != NVR_ERROR_OPENED) || (size != SeriesSize[id]) || (NVRStripeGetFoundId(&Stripe) != id) ||
+        ((0 == (mode & TEST_STRIPE_HASH)) && (Stripe.Opened != StripeStore[id]))) {
+        printf("mode %02x: id %u open returned %d size %u in store %u, expected size %u\n", mode, id, ret, size, Stripe.Opened, SeriesSize[id]);
+        return -1;
+    }
+    SeriesFill(id);
+    if ((NVR_ERROR_NONE != (ret = NVRStripeReadFile(&Stripe, 0, Back, size))) || (0 != memcmp(Back, Data, size))) {
+        printf("mode %02x: id %u read returned %d or the data differ\n", mode, id, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief      Seeks the range and walks it merged from the stores: every live id of it is expected once in order
+  * @param
+  * @retval     0 if OK
+  */
+static int StripeWalk(uint32_t mode, uint32_t from, uint32_t to, uint32_t flags)
+{
+    int step = (flags & NVR_OPEN_FLAGS_BACKWARD) ? -1 : 1;
+    uint32_t id = (step < 0) ? to : from, dev = Stripe.Count;
+    NVRError_t ret = NVRStripeIterSeek(&Stripe, &StripeIter, from, to, flags);
+
+    for (;; id += step) {
+        while ((id >= from) && (id <= to) && (SeriesDeleted[id])) id += step;
+        if ((id < from) || (id > to)) break;
+        if ((ret != NVR_ERROR_OPENED) || (StripeIter.It[StripeIter.Dev].Rec.Id != id) || (StripeIter.It[StripeIter.Dev].Rec.Size != SeriesSize[id])) {
+            printf("mode %02x: walk %u..%u %s returned %d id %u, expected %u size %u\n", mode, from, to, (step < 0) ? "backward" : "forward", 
+                   ret, (ret == NVR_ERROR_OPENED) ? (uint32_t)StripeIter.It[StripeIter.Dev].Rec.Id : 0, id, SeriesSize[id]);
+            return -1;
+        }
+        if ((dev != Stripe.Count) && (dev != StripeIter.Dev)) StripeSwitches++;
+        dev = StripeIter.Dev;
+        SeriesFill(id);
+        if ((NVR_ERROR_NONE != (ret = NVRStripeIterRead(&Stripe, &StripeIter, 0, Back, SeriesSize[id]))) || (0 != memcmp(Back, Data, SeriesSize[id]))) {
+            printf("mode %02x: id %u read returned %d or the data differ\n", mode, id, ret);
+            return -1;
+        }
+        ret = NVRStripeIterNext(&Stripe, &StripeIter);
+    }
+    if (ret != NVR_ERROR_NOT_FOUND) {
+        printf("mode %02x: walk %u..%u returned %d past the range\n", mode, from, to, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief      The key is opened and read, compared to the model
+  * @param
+  * @retval     0 if OK
+  */
+static int CheckKey(uint32_t mode, uint32_t op, uint32_t key)
+{
+    uint32_t size;
+    NVRError_t ret;
+
+    ret = NVROpenFile(&Nvr, key + 1, &size, 0, 0);
+    if (Model[key].Size == 0) {
+        if (ret == NVR_ERROR_NOT_FOUND) return 0;
+        printf("mode %02x op %u: key %u is deleted, open returned %d\n", mode, op, key + 1, ret);
+        return -1;
+    }
+    if ((ret != NVR_ERROR_OPENED) || (size != Model[key].Size)) {
+        printf("mode %02x op %u: key %u open returned %d size %u, expected %u\n", mode, op, key + 1, ret, size, Model[key].Size);
+        return -1;
+    }
+    if ((NVR_ERROR_NONE != (ret = Read(mode, Back, size))) || (0 != memcmp(Back, Model[key].Data, size))) {
+        printf("mode %02x op %u: key %u read returned %d or the data differ\n", mode, op, key + 1, ret);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief      xorshift32, the runs repeat
+  * @param
+  * @retval
+  */
+static uint32_t Rand(void)
+{
+    Seed ^= Seed << 13;
+    Seed ^= Seed >> 17;
+    Seed ^= Seed << 5;
+    return Seed;
+}
+//------------------------------------------------------------------------------
+// END
+//------------------------------------------------------------------------------